@@ -17,7 +17,12 @@ extern "C" {
 #include "mercury.h"
 #include "fdc.h"
 #include "fmg_wrap.h"
+#include "mixer.h"
+#include "vgmlog.h"
 
+}
+
+// fmgen はテンプレートを含むので extern "C" の外で
 #include "opm.h"
 #include "opna.h"
 
@@ -30,21 +35,33 @@ typedef struct {
 	BYTE data;
 } RMDATA;
 
-};
-
 static RMDATA RMData[RMBUFSIZE];
 static int RMPtrW;
 static int RMPtrR;
 
+// ミキサーのチップ ID（-1 なら合成側の SetReg をその場で呼ぶ）
+static int OPMMixId = -1;
+static int M288MixId[2] = { -1, -1 };
+
+// チップ 1 個につき fmgen のオブジェクトを 2 個持つ
+//  - MyOPM / YMF288 本体：エミュレーションスレッド専用。全レジスタを書いて
+//    タイマー・ステータス・レジスタ読み出しを受け持つ。Mix は呼ばない
+//  - Synth：合成専用。ミキサーのログ（ミキサーが無ければその場）で同じ書き込みを
+//    受けて Mix する。Count は呼ばないのでタイマーは動かない
+// 両スレッドで共有するフィールドは無いので、ロックは要らない
+
 class MyOPM : public FM::OPM
 {
 public:
 	MyOPM();
 	virtual ~MyOPM() {}
 	void WriteIO(DWORD adr, BYTE data);
+	void WriteReg(DWORD reg, BYTE data);
 	void Count2(DWORD clock);
+	FM::OPM Synth;
 private:
 	virtual void Intr(bool);
+	virtual void TimerA();
 	int CurReg;
 	DWORD CurCount;
 };
@@ -62,7 +79,12 @@ void MyOPM::WriteIO(DWORD adr, BYTE data)
 			::ADPCM_SetClock((data>>5)&4);
 			::FDC_SetForceReady((data>>6)&1);
 		}
+		::VGMLog_OPM((BYTE)CurReg, data);
 		SetReg((int)CurReg, (int)data);
+		if ( OPMMixId>=0 )
+			::Mixer_Write(OPMMixId, (DWORD)CurReg, data);
+		else
+			Synth.SetReg((int)CurReg, (int)data);
 		if ( (juliet_YM2151IsEnable())&&(Config.SoundROMEO) ) {
 			int newptr = (RMPtrW+1)%RMBUFSIZE;
 			if ( newptr!=RMPtrR ) {
@@ -88,11 +110,31 @@ if ( CurReg==0x14 ) data &= 0xf3;	// Int Enableはマスクする
 	}
 }
 
+// ミキサーのログから呼ばれる（0x100 は CSM のキーオン）
+void MyOPM::WriteReg(DWORD reg, BYTE data)
+{
+	if ( reg==0x100 )
+		Synth.KeyCSM();
+	else
+		Synth.SetReg((int)reg, (int)data);
+}
+
 void MyOPM::Intr(bool f)
 {
 	if ( f ) ::MFP_Int(12);
 }
 
+// CSM のキーオンは合成側へ（こちらのチャンネルは鳴らさないので叩かない）
+void MyOPM::TimerA()
+{
+	if ( regtc&0x80 ) {
+		if ( OPMMixId>=0 )
+			::Mixer_Write(OPMMixId, 0x100, 0);
+		else
+			Synth.KeyCSM();
+	}
+}
+
 
 void MyOPM::Count2(DWORD clock)
 {
@@ -114,7 +156,16 @@ int OPM_Init(int clock, int rate)
 
 	opm = new MyOPM();
 	if ( !opm ) return FALSE;
-	if ( !opm->Init(clock, rate, TRUE) ) {
+	// OPMNativeRate: 62.5kHz で合成してから rate へ変換する
+	opm->Synth.SetResampleQuality(Config.OPMResampleQuality);
+	// OPMSimd: SoA エンジンで合成する（この環境で従来の合成と一致しなければ使わない）
+	if ( Config.OPMSimd ) {
+		if ( FM::OPM::CheckSIMD(clock, rate) )
+			opm->Synth.SetSIMD(true);
+		else
+			fprintf(stderr, "OPM: SIMD engine output differs, using the scalar engine\n");
+	}
+	if ( (!opm->Init(clock, rate, Config.OPMNativeRate!=0))||(!opm->Synth.Init(clock, rate, Config.OPMNativeRate!=0)) ) {
 		delete opm;
 		opm = NULL;
 		return FALSE;
@@ -125,6 +176,7 @@ int OPM_Init(int clock, int rate)
 
 void OPM_Cleanup(void)
 {
+	Mixer_Sync();
 	juliet_YM2151Reset();
 	juliet_unload();
 	delete opm;
@@ -134,16 +186,24 @@ void OPM_Cleanup(void)
 
 void OPM_SetRate(int clock, int rate)
 {
-	if ( opm ) opm->SetRate(clock, rate, TRUE);
+	Mixer_Sync();
+	if ( opm ) {
+		opm->SetRate(clock, rate, Config.OPMNativeRate!=0);
+		opm->Synth.SetRate(clock, rate, Config.OPMNativeRate!=0);
+	}
 }
 
 
 void OPM_Reset(void)
 {
+	Mixer_Sync();
 	RMPtrW = RMPtrR = 0;
 	memset(RMData, 0, sizeof(RMData));
 
-	if ( opm ) opm->Reset();
+	if ( opm ) {
+		opm->Reset();
+		opm->Synth.Reset();
+	}
 	juliet_YM2151Reset();
 }
 
@@ -167,10 +227,26 @@ void FASTCALL OPM_Write(DWORD adr, BYTE data)
 }
 
 
-void OPM_Update(short *buffer, int length, int rate, BYTE *pbsp, BYTE *pbep)
+// buffer は L,R 交互の int（ミキサーのスクラッチ）、上書きする
+void FASTCALL OPM_Update(int *buffer, DWORD length)
+{
+	if ( (opm)&&((!juliet_YM2151IsEnable())||(!Config.SoundROMEO)) )
+		opm->Synth.Mix((FM::ISample*)buffer, (int)length);
+	else
+		memset(buffer, 0, length*2*sizeof(int));
+}
+
+
+void FASTCALL OPM_WriteReg(DWORD reg, BYTE data)
 {
-	if ( (!juliet_YM2151IsEnable())||(!Config.SoundROMEO) )
-		if ( opm ) opm->Mix((FM::Sample*)buffer, length, rate, pbsp, pbep);
+	if ( opm ) opm->WriteReg(reg, data);
+}
+
+
+void OPM_SetMixer(int id)
+{
+	Mixer_Sync();
+	OPMMixId = id;
 }
 
 
@@ -183,7 +259,8 @@ void FASTCALL OPM_Timer(DWORD step)
 void OPM_SetVolume(BYTE vol)
 {
 	int v = (vol)?((16-vol)*4):192;		// このくらいかなぁ
-	if ( opm ) opm->SetVolume(-v);
+	Mixer_Sync();
+	if ( opm ) opm->Synth.SetVolume(-v);
 }
 
 
@@ -215,11 +292,15 @@ public:
 	BYTE ReadIO(DWORD adr);
 	void Count2(DWORD clock);
 	void SetInt(int f) { IntrFlag = f; };
+	void SetMixer(int id) { MixId = id; };
+	void WriteReg(DWORD reg, BYTE data);
+	FM::Y288 Synth;
 private:
 	virtual void Intr(bool);
 	int CurReg[2];
 	DWORD CurCount;
 	int IntrFlag;
+	int MixId;
 };
 
 YMF288::YMF288()
@@ -227,12 +308,18 @@ YMF288::YMF288()
 	CurReg[0] = 0;
 	CurReg[1] = 0;
 	IntrFlag = 0;
+	MixId = -1;
 }
 
 void YMF288::WriteIO(DWORD adr, BYTE data)
 {
 	if( adr&1 ) {
-		SetReg(((adr&2)?(CurReg[1]+0x100):CurReg[0]), (int)data);
+		int reg = ((adr&2)?(CurReg[1]+0x100):CurReg[0]);
+		SetReg(reg, (int)data);
+		if ( MixId>=0 )
+			::Mixer_Write(MixId, (DWORD)reg, data);
+		else
+			Synth.SetReg(reg, (int)data);
 	} else {
 		CurReg[(adr>>1)&1] = (int)data;
 	}
@@ -243,7 +330,8 @@ BYTE YMF288::ReadIO(DWORD adr)
 {
 	BYTE ret = 0;
 	if ( adr&1 ) {
-		ret = GetReg(((adr&2)?(CurReg[1]+0x100):CurReg[0]));
+		int reg = ((adr&2)?(CurReg[1]+0x100):CurReg[0]);
+		ret = GetReg(reg);
 	} else {
 		ret = ((adr)?(ReadStatusEx()):(ReadStatus()));
 	}
@@ -251,6 +339,13 @@ BYTE YMF288::ReadIO(DWORD adr)
 }
 
 
+// ミキサーのログから呼ばれる
+void YMF288::WriteReg(DWORD reg, BYTE data)
+{
+	Synth.SetReg(reg, (int)data);
+}
+
+
 void YMF288::Intr(bool f)
 {
 	if ( (f)&&(IntrFlag) ) ::Mcry_Int();
@@ -277,18 +372,22 @@ int M288_Init(int clock, int rate, const char* path)
 		M288_Cleanup();
 		return FALSE;
 	}
-	if ( (!ymf288a->Init(clock, rate, TRUE, path))||(!ymf288b->Init(clock, rate, TRUE, path)) ) {
+	if ( (!ymf288a->Init(clock, rate, TRUE, path))||(!ymf288a->Synth.Init(clock, rate, TRUE, path))
+	   ||(!ymf288b->Init(clock, rate, TRUE, path))||(!ymf288b->Synth.Init(clock, rate, TRUE, path)) ) {
 		M288_Cleanup();
 		return FALSE;
 	}
 	ymf288a->SetInt(1);
 	ymf288b->SetInt(0);
+	ymf288a->SetMixer(M288MixId[0]);
+	ymf288b->SetMixer(M288MixId[1]);
 	return TRUE;
 }
 
 
 void M288_Cleanup(void)
 {
+	Mixer_Sync();
 	delete ymf288a;
 	delete ymf288b;
 	ymf288a = ymf288b = NULL;
@@ -297,15 +396,29 @@ void M288_Cleanup(void)
 
 void M288_SetRate(int clock, int rate)
 {
-	if ( ymf288a ) ymf288a->SetRate(clock, rate, TRUE);
-	if ( ymf288b ) ymf288b->SetRate(clock, rate, TRUE);
+	Mixer_Sync();
+	if ( ymf288a ) {
+		ymf288a->SetRate(clock, rate, TRUE);
+		ymf288a->Synth.SetRate(clock, rate, TRUE);
+	}
+	if ( ymf288b ) {
+		ymf288b->SetRate(clock, rate, TRUE);
+		ymf288b->Synth.SetRate(clock, rate, TRUE);
+	}
 }
 
 
 void M288_Reset(void)
 {
-	if ( ymf288a ) ymf288a->Reset();
-	if ( ymf288b ) ymf288b->Reset();
+	Mixer_Sync();
+	if ( ymf288a ) {
+		ymf288a->Reset();
+		ymf288a->Synth.Reset();
+	}
+	if ( ymf288b ) {
+		ymf288b->Reset();
+		ymf288b->Synth.Reset();
+	}
 }
 
 
@@ -335,10 +448,55 @@ void FASTCALL M288_Write(DWORD adr, BYTE data)
 }
 
 
-void M288_Update(short *buffer, int length)
+// buffer は L,R 交互の int（ミキサーのスクラッチ）、上書きする
+static void M288_Render(YMF288* chip, int *buffer, DWORD length)
+{
+	FM::Sample fmbuf[MIXER_BLOCK*2];
+	DWORD i, n;
+
+	while ( length ) {
+		n = (length>MIXER_BLOCK) ? MIXER_BLOCK : length;
+		memset(fmbuf, 0, n*2*sizeof(FM::Sample));
+		if ( chip ) chip->Synth.Mix(fmbuf, (int)n);
+		for (i=0; i<n*2; i++)
+			buffer[i] = fmbuf[i];
+		buffer += n*2;
+		length -= n;
+	}
+}
+
+
+void FASTCALL M288_UpdateA(int *buffer, DWORD length)
+{
+	M288_Render(ymf288a, buffer, length);
+}
+
+
+void FASTCALL M288_UpdateB(int *buffer, DWORD length)
+{
+	M288_Render(ymf288b, buffer, length);
+}
+
+
+void FASTCALL M288_WriteRegA(DWORD reg, BYTE data)
+{
+	if ( ymf288a ) ymf288a->WriteReg(reg, data);
+}
+
+
+void FASTCALL M288_WriteRegB(DWORD reg, BYTE data)
+{
+	if ( ymf288b ) ymf288b->WriteReg(reg, data);
+}
+
+
+void M288_SetMixer(int ida, int idb)
 {
-	if ( ymf288a ) ymf288a->Mix((FM::Sample*)buffer, length);
-	if ( ymf288b ) ymf288b->Mix((FM::Sample*)buffer, length);
+	Mixer_Sync();
+	M288MixId[0] = ida;
+	M288MixId[1] = idb;
+	if ( ymf288a ) ymf288a->SetMixer(ida);
+	if ( ymf288b ) ymf288b->SetMixer(idb);
 }
 
 
@@ -353,12 +511,13 @@ void M288_SetVolume(BYTE vol)
 {
 	int v1 = (vol)?((16-vol)*4-24):192;		// このくらいかなぁ
 	int v2 = (vol)?((16-vol)*4):192;		// 少し小さめに
+	Mixer_Sync();
 	if ( ymf288a ) {
-		ymf288a->SetVolumeFM(-v1);
-		ymf288a->SetVolumePSG(-v2);
+		ymf288a->Synth.SetVolumeFM(-v1);
+		ymf288a->Synth.SetVolumePSG(-v2);
 	}
 	if ( ymf288b ) {
-		ymf288b->SetVolumeFM(-v1);
-		ymf288b->SetVolumePSG(-v2);
+		ymf288b->Synth.SetVolumeFM(-v1);
+		ymf288b->Synth.SetVolumePSG(-v2);
 	}
 }
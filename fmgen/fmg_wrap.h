@@ -4,7 +4,9 @@
 int OPM_Init(int clock, int rate);
 void OPM_Cleanup(void);
 void OPM_Reset(void);
-void OPM_Update(short *buffer, int length, int rate, BYTE *pbsp, BYTE *pbep);
+void FASTCALL OPM_Update(int *buffer, DWORD length);
+void FASTCALL OPM_WriteReg(DWORD r, BYTE v);
+void OPM_SetMixer(int id);
 void FASTCALL OPM_Write(DWORD r, BYTE v);
 BYTE FASTCALL OPM_Read(WORD a);
 void FASTCALL OPM_Timer(DWORD step);
@@ -15,7 +17,11 @@ void OPM_RomeoOut(unsigned int delay);
 int M288_Init(int clock, int rate, const char* path);
 void M288_Cleanup(void);
 void M288_Reset(void);
-void M288_Update(short *buffer, int length);
+void FASTCALL M288_UpdateA(int *buffer, DWORD length);
+void FASTCALL M288_UpdateB(int *buffer, DWORD length);
+void FASTCALL M288_WriteRegA(DWORD r, BYTE v);
+void FASTCALL M288_WriteRegB(DWORD r, BYTE v);
+void M288_SetMixer(int ida, int idb);
 void FASTCALL M288_Write(DWORD r, BYTE v);
 BYTE FASTCALL M288_Read(WORD a);
 void FASTCALL M288_Timer(DWORD step);
@@ -815,126 +815,150 @@ void Channel4::SetAlgorithm(uint algo)
 	in [2] = &buf[table1[algo][4]];
 	out[2] = &buf[table1[algo][5]];
 
+	static const CalcFunc calctable[8] =
+	{
+		&Channel4::CalcT<0, false>, &Channel4::CalcT<1, false>,
+		&Channel4::CalcT<2, false>, &Channel4::CalcT<3, false>,
+		&Channel4::CalcT<4, false>, &Channel4::CalcT<5, false>,
+		&Channel4::CalcT<6, false>, &Channel4::CalcT<7, false>,
+	};
+	static const CalcFunc calcltable[8] =
+	{
+		&Channel4::CalcT<0, true>, &Channel4::CalcT<1, true>,
+		&Channel4::CalcT<2, true>, &Channel4::CalcT<3, true>,
+		&Channel4::CalcT<4, true>, &Channel4::CalcT<5, true>,
+		&Channel4::CalcT<6, true>, &Channel4::CalcT<7, true>,
+	};
+	static const BlockFunc blocktable[8] =
+	{
+		&Channel4::CalcBlockT<0>, &Channel4::CalcBlockT<1>,
+		&Channel4::CalcBlockT<2>, &Channel4::CalcBlockT<3>,
+		&Channel4::CalcBlockT<4>, &Channel4::CalcBlockT<5>,
+		&Channel4::CalcBlockT<6>, &Channel4::CalcBlockT<7>,
+	};
+	static const BlockLFunc blockltable[8] =
+	{
+		&Channel4::CalcLBlockT<0>, &Channel4::CalcLBlockT<1>,
+		&Channel4::CalcLBlockT<2>, &Channel4::CalcLBlockT<3>,
+		&Channel4::CalcLBlockT<4>, &Channel4::CalcLBlockT<5>,
+		&Channel4::CalcLBlockT<6>, &Channel4::CalcLBlockT<7>,
+	};
+	calc_ = calctable[algo & 7];
+	calcl_ = calcltable[algo & 7];
+	calcblock_ = blocktable[algo & 7];
+	calclblock_ = blockltable[algo & 7];
+
 	op[0].ResetFB();
 	algo_ = algo;
 }
 
-//  合成
-ISample Channel4::Calc()
+//  合成 (アルゴリズム別)
+//	algo, lfo はコンパイル時定数なので switch と分岐は展開時に消える
+#define OPCALC(n, in)	(lfo ? op[n].CalcL(in) : op[n].Calc(in))
+#define OPCALCFB(n)		(lfo ? op[n].CalcFBL(fb) : op[n].CalcFB(fb))
+
+template<int algo, bool lfo>
+inline ISample Channel4::CalcT()
 {
+	if (lfo)
+		chip_->SetPMV(pms[chip_->GetPML()]);
+
 	int r = 0;
-	switch (algo_)
+	switch (algo)
 	{
 	case 0:
-		op[2].Calc(op[1].Out());
-		op[1].Calc(op[0].Out());
-		r = op[3].Calc(op[2].Out());
-		op[0].CalcFB(fb);
+		OPCALC(2, op[1].Out());
+		OPCALC(1, op[0].Out());
+		r = OPCALC(3, op[2].Out());
+		OPCALCFB(0);
 		break;
 	case 1:
-		op[2].Calc(op[0].Out() + op[1].Out());
-		op[1].Calc(0);
-		r = op[3].Calc(op[2].Out());
-		op[0].CalcFB(fb);
+		OPCALC(2, op[0].Out() + op[1].Out());
+		OPCALC(1, 0);
+		r = OPCALC(3, op[2].Out());
+		OPCALCFB(0);
 		break;
 	case 2:
-		op[2].Calc(op[1].Out());
-		op[1].Calc(0);
-		r = op[3].Calc(op[0].Out() + op[2].Out());
-		op[0].CalcFB(fb);
+		OPCALC(2, op[1].Out());
+		OPCALC(1, 0);
+		r = OPCALC(3, op[0].Out() + op[2].Out());
+		OPCALCFB(0);
 		break;
 	case 3:
-		op[2].Calc(0);
-		op[1].Calc(op[0].Out());
-		r = op[3].Calc(op[1].Out() + op[2].Out());
-		op[0].CalcFB(fb);
+		OPCALC(2, 0);
+		OPCALC(1, op[0].Out());
+		r = OPCALC(3, op[1].Out() + op[2].Out());
+		OPCALCFB(0);
 		break;
 	case 4:
-		op[2].Calc(0);
-		r = op[1].Calc(op[0].Out());
-		r += op[3].Calc(op[2].Out());
-		op[0].CalcFB(fb);
+		OPCALC(2, 0);
+		r = OPCALC(1, op[0].Out());
+		r += OPCALC(3, op[2].Out());
+		OPCALCFB(0);
 		break;
 	case 5:
-		r =  op[2].Calc(op[0].Out());
-		r += op[1].Calc(op[0].Out());
-		r += op[3].Calc(op[0].Out());
-		op[0].CalcFB(fb);
+		r =  OPCALC(2, op[0].Out());
+		r += OPCALC(1, op[0].Out());
+		r += OPCALC(3, op[0].Out());
+		OPCALCFB(0);
 		break;
 	case 6:
-		r  = op[2].Calc(0);
-		r += op[1].Calc(op[0].Out());
-		r += op[3].Calc(0);
-		op[0].CalcFB(fb);
+		r  = OPCALC(2, 0);
+		r += OPCALC(1, op[0].Out());
+		r += OPCALC(3, 0);
+		OPCALCFB(0);
 		break;
 	case 7:
-		r  = op[2].Calc(0);
-		r += op[1].Calc(0);
-		r += op[3].Calc(0);
-		r += op[0].CalcFB(fb);
+		r  = OPCALC(2, 0);
+		r += OPCALC(1, 0);
+		r += OPCALC(3, 0);
+		r += OPCALCFB(0);
 		break;
 	}
 	return r;
 }
 
-//  合成
-ISample Channel4::CalcL()
+#undef OPCALC
+#undef OPCALCFB
+
+//	nsamples 分を dest に加算
+template<int algo>
+void Channel4::CalcBlockT(ISample* dest, int nsamples)
 {
-	chip_->SetPMV(pms[chip_->GetPML()]);
+	for (int i=0; i<nsamples; i++)
+		dest[i] += CalcT<algo, false>();
+}
 
-	int r = 0;
-	switch (algo_)
+//	LFO あり: aml/pml はサンプルごとの LFO 値
+template<int algo>
+void Channel4::CalcLBlockT(ISample* dest, int nsamples, const uint* aml, const uint* pml)
+{
+	for (int i=0; i<nsamples; i++)
 	{
-	case 0:
-		op[2].CalcL(op[1].Out());
-		op[1].CalcL(op[0].Out());
-		r = op[3].CalcL(op[2].Out());
-		op[0].CalcFBL(fb);
-		break;
-	case 1:
-		op[2].CalcL(op[0].Out() + op[1].Out());
-		op[1].CalcL(0);
-		r = op[3].CalcL(op[2].Out());
-		op[0].CalcFBL(fb);
-		break;
-	case 2:
-		op[2].CalcL(op[1].Out());
-		op[1].CalcL(0);
-		r = op[3].CalcL(op[0].Out() + op[2].Out());
-		op[0].CalcFBL(fb);
-		break;
-	case 3:
-		op[2].CalcL(0);
-		op[1].CalcL(op[0].Out());
-		r = op[3].CalcL(op[1].Out() + op[2].Out());
-		op[0].CalcFBL(fb);
-		break;
-	case 4:
-		op[2].CalcL(0);
-		r = op[1].CalcL(op[0].Out());
-		r += op[3].CalcL(op[2].Out());
-		op[0].CalcFBL(fb);
-		break;
-	case 5:
-		r =  op[2].CalcL(op[0].Out());
-		r += op[1].CalcL(op[0].Out());
-		r += op[3].CalcL(op[0].Out());
-		op[0].CalcFBL(fb);
-		break;
-	case 6:
-		r  = op[2].CalcL(0);
-		r += op[1].CalcL(op[0].Out());
-		r += op[3].CalcL(0);
-		op[0].CalcFBL(fb);
-		break;
-	case 7:
-		r  = op[2].CalcL(0);
-		r += op[1].CalcL(0);
-		r += op[3].CalcL(0);
-		r += op[0].CalcFBL(fb);
-		break;
+		chip_->SetAML(aml[i]);
+		chip_->SetPML(pml[i]);
+		dest[i] += CalcT<algo, true>();
 	}
-	return r;
+}
+
+ISample Channel4::Calc()
+{
+	return (this->*calc_)();
+}
+
+ISample Channel4::CalcL()
+{
+	return (this->*calcl_)();
+}
+
+void Channel4::CalcBlock(ISample* dest, int nsamples)
+{
+	(this->*calcblock_)(dest, nsamples);
+}
+
+void Channel4::CalcLBlock(ISample* dest, int nsamples, const uint* aml, const uint* pml)
+{
+	(this->*calclblock_)(dest, nsamples, aml, pml);
 }
 
 //  合成
@@ -181,6 +181,7 @@ namespace FM
 
 	//	friends --------------------------------------------------------------
 		friend class Channel4;
+		friend class OPM;
 		friend void __stdcall FM_NextPhase(Operator* op);
 
 	public:
@@ -200,6 +201,8 @@ namespace FM
 		
 		ISample Calc();
 		ISample CalcL();
+		void CalcBlock(ISample* dest, int nsamples);
+		void CalcLBlock(ISample* dest, int nsamples, const uint* aml, const uint* pml);
 		ISample CalcN(uint noise);
 		ISample CalcLN(uint noise);
 		void SetFNum(uint fnum);
@@ -225,11 +228,25 @@ namespace FM
 		int		algo_;
 		Chip*	chip_;
 
+		//	アルゴリズム別に特殊化した合成ルーチン (SetAlgorithm で選択)
+		typedef ISample (Channel4::*CalcFunc)();
+		typedef void (Channel4::*BlockFunc)(ISample*, int);
+		typedef void (Channel4::*BlockLFunc)(ISample*, int, const uint*, const uint*);
+		CalcFunc	calc_;
+		CalcFunc	calcl_;
+		BlockFunc	calcblock_;
+		BlockLFunc	calclblock_;
+
+		template<int algo, bool lfo> ISample CalcT();
+		template<int algo> void CalcBlockT(ISample* dest, int nsamples);
+		template<int algo> void CalcLBlockT(ISample* dest, int nsamples, const uint* aml, const uint* pml);
+
 		static void MakeTable();
 
 		static bool tablehasmade;
 		static int 	kftable[64];
 
+		friend class OPM;
 
 	public:
 		Operator op[4];
@@ -21,6 +21,9 @@ int OPM::pmtable[4][OPM_LFOENTS];
 //
 OPM::OPM()
 {
+	usesimd = false;
+	interpolation = false;
+	rsquality = 2;
 	lfo_count_ = 0;
 	lfo_count_prev_ = ~0;
 	BuildLFOTable();
@@ -49,17 +52,32 @@ bool OPM::Init(uint c, uint rf, bool ip)
 // ---------------------------------------------------------------------------
 //	再設定
 //
-bool OPM::SetRate(uint c, uint r, bool)
+//	ip = true ならチップ本来のレート (clock/64) で合成し，r へ変換して出力する
+//
+bool OPM::SetRate(uint c, uint r, bool ip)
 {
 	clock = c;
 	pcmrate = r;
-	rate = r;
+	interpolation = ip && (c / 64 != r);
+	rate = interpolation ? c / 64 : r;
 
 	RebuildTimeTable();
 	
+	if (interpolation)
+		return resampler.Init(rate, pcmrate, rsquality);
 	return true;
 }
 
+// ---------------------------------------------------------------------------
+//	レート変換の品質 (0: 線形 〜 Resampler::QUALITY_MAX)
+//
+void OPM::SetResampleQuality(int q)
+{
+	rsquality = q;
+	if (interpolation)
+		resampler.Init(rate, pcmrate, rsquality);
+}
+
 // ---------------------------------------------------------------------------
 //	チャンネルマスクの設定
 //
@@ -114,12 +132,16 @@ void OPM::RebuildTimeTable()
 void OPM::TimerA()
 {
 	if (regtc & 0x80)
+		KeyCSM();
+}
+
+//	CSM のキーオン（全チャンネル）
+void OPM::KeyCSM()
+{
+	for (int i=0; i<8; i++)
 	{
-		for (int i=0; i<8; i++)
-		{
-			ch[i].KeyControl(0);
-			ch[i].KeyControl(0xf);
-		}
+		ch[i].KeyControl(0);
+		ch[i].KeyControl(0xf);
 	}
 }
 
@@ -397,7 +419,7 @@ inline void OPM::LFO()
 	}
 }
 
-inline uint OPM::Noise()
+uint OPM::Noise()
 {
 	noisecount += 2 * rateratio;
 	if (noisecount >= (32 << FM_RATIOBITS))
@@ -416,118 +438,217 @@ inline uint OPM::Noise()
 
 // ---------------------------------------------------------------------------
 //	合成の一部
+//	チャンネルごとに nsamples 分をまとめて計算し obuf[pan] に加算する
 //
-inline void OPM::MixSub(int activech, ISample** idest)
+void OPM::MixBlock(uint activech, ISample* obuf, int nsamples)
 {
-	if (activech & 0x4000) (*idest[0]  = ch[0].Calc());
-	if (activech & 0x1000) (*idest[1] += ch[1].Calc());
-	if (activech & 0x0400) (*idest[2] += ch[2].Calc());
-	if (activech & 0x0100) (*idest[3] += ch[3].Calc());
-	if (activech & 0x0040) (*idest[4] += ch[4].Calc());
-	if (activech & 0x0010) (*idest[5] += ch[5].Calc());
-	if (activech & 0x0004) (*idest[6] += ch[6].Calc());
-	if (activech & 0x0001)
+	uint aml[OPM_MIXBLOCK], pml[OPM_MIXBLOCK];
+	bool lfo = (activech & 0xaaaa) != 0;
+	int i;
+
+	// LFO はチャンネル間で共通なので先に 1 ブロック分求めておく
+	for (i=0; i<nsamples; i++)
+	{
+		LFO();
+		aml[i] = chip.GetAML();
+		pml[i] = chip.GetPML();
+	}
+
+	for (int c=0; c<8; c++)
 	{
-		if (noisedelta & 0x80)
-			*idest[7] += ch[7].CalcN(Noise());
+		if (!(activech & (0x4000 >> (c * 2))))
+			continue;
+
+		ISample* dest = obuf + pan[c] * OPM_MIXBLOCK;
+		if (c == 7 && (noisedelta & 0x80))
+		{
+			for (i=0; i<nsamples; i++)
+			{
+				if (lfo)
+				{
+					chip.SetAML(aml[i]);
+					chip.SetPML(pml[i]);
+					dest[i] += ch[7].CalcLN(Noise());
+				}
+				else
+					dest[i] += ch[7].CalcN(Noise());
+			}
+		}
+		else if (lfo)
+			ch[c].CalcLBlock(dest, nsamples, aml, pml);
 		else
-			*idest[7] += ch[7].Calc();
+			ch[c].CalcBlock(dest, nsamples);
 	}
 }
 
-inline void OPM::MixSubL(int activech, ISample** idest)
+
+// ---------------------------------------------------------------------------
+//	発音中のチャンネル
+//	odd bits - active, even bits - lfo
+//
+uint OPM::ActiveChannels()
+{
+	uint activech=0;
+	for (int i=0; i<8; i++)
+		activech = (activech << 2) | ch[i].Prepare();
+
+	// LFO 波形初期化ビット = 1 ならば LFO はかからない?
+	if (reg01 & 0x02)
+		activech &= 0x5555;
+	return activech;
+}
+
+// ---------------------------------------------------------------------------
+//	内部レートで nsamples (<= OPM_MIXBLOCK) 分合成する
+//
+void OPM::MixInternal(uint activech, ISample* l, ISample* r, int nsamples)
 {
-	if (activech & 0x4000) (*idest[0]  = ch[0].CalcL());
-	if (activech & 0x1000) (*idest[1] += ch[1].CalcL());
-	if (activech & 0x0400) (*idest[2] += ch[2].CalcL());
-	if (activech & 0x0100) (*idest[3] += ch[3].CalcL());
-	if (activech & 0x0040) (*idest[4] += ch[4].CalcL());
-	if (activech & 0x0010) (*idest[5] += ch[5].CalcL());
-	if (activech & 0x0004) (*idest[6] += ch[6].CalcL());
-	if (activech & 0x0001)
+	ISample obuf[4 * OPM_MIXBLOCK];
+	ISample* obl = obuf + 1 * OPM_MIXBLOCK;
+	ISample* obr = obuf + 2 * OPM_MIXBLOCK;
+	ISample* obc = obuf + 3 * OPM_MIXBLOCK;
+	int j;
+
+	memset(obuf, 0, sizeof(obuf));
+	if (usesimd)
 	{
-		if (noisedelta & 0x80)
-			*idest[7] += ch[7].CalcLN(Noise());
-		else
-			*idest[7] += ch[7].CalcL();
+		ISample ibuf[4];
+		SIMDLoad(activech);
+		for (j = 0; j < nsamples; j++) {
+			ibuf[1] = ibuf[2] = ibuf[3] = 0;
+			LFO(), SIMDCalc((activech & 0xaaaa) != 0, ibuf);
+			obl[j] = ibuf[1];
+			obr[j] = ibuf[2];
+			obc[j] = ibuf[3];
+		}
+		SIMDStore();
 	}
-}
+	else
+		MixBlock(activech, obuf, nsamples);
 
+	for (j = 0; j < nsamples; j++) {
+		l[j] = obl[j] + obc[j];
+		r[j] = obr[j] + obc[j];
+	}
+}
 
 // ---------------------------------------------------------------------------
-//	合成 (stereo)
+//	出力 nsamples (<= OPM_MIXBLOCK) 分を L/R に求める
+//	内部レート合成時は必要な分だけ合成してレート変換する
 //
-void OPM::Mix(Sample* buffer, int nsamples, int rate, BYTE* pbsp, BYTE* pbep)
+void OPM::Render(uint activech, ISample* l, ISample* r, int nsamples)
 {
+	if (!interpolation)
+	{
+		MixInternal(activech, l, r, nsamples);
+		return;
+	}
+
+	ISample bl[OPM_MIXBLOCK], br[OPM_MIXBLOCK];
+	for (int k = resampler.Needed(nsamples); k > 0; ) {
+		int m = Min(k, OPM_MIXBLOCK);
+		if (activech & 0x5555)
+			MixInternal(activech, bl, br, m);
+		else
+			memset(bl, 0, sizeof(bl)), memset(br, 0, sizeof(br));
+		resampler.Push(bl, br, m);
+		k -= m;
+	}
+	resampler.Pull(l, r, nsamples);
+}
+
 #define IStoSample(s)	((Limit(s, 0xffff, -0x10000) * fmvolume) >> 14)
 //#define IStoSample(s)	((s * fmvolume) >> 14)
 
+// ---------------------------------------------------------------------------
+//	出力バッファへ加算
+//
+Sample* OPM::StoreBlock(Sample* dest, const ISample* l, const ISample* r, int nsamples,
+						int rate, BYTE* pbsp, BYTE* pbep)
+{
 #define CHECK_BUF_END() if ((BYTE *)dest >= pbep) {dest = (Sample *)pbsp;}
 
-	Sample* dest;
 	Sample dval0, dval1;
-	int i;
-	
-	// odd bits - active, even bits - lfo
-	uint activech=0;
-	for (i=0; i<8; i++)
-		activech = (activech << 2) | ch[i].Prepare();
 
-	if (activech & 0x5555)
-	{
-		// LFO 波形初期化ビット = 1 ならば LFO はかからない?
-		if (reg01 & 0x02)
-			activech &= 0x5555;
-
-		// Mix
-		ISample ibuf[8];
-		ISample* idest[8];
-		idest[0] = &ibuf[pan[0]];
-		idest[1] = &ibuf[pan[1]];
-		idest[2] = &ibuf[pan[2]];
-		idest[3] = &ibuf[pan[3]];
-		idest[4] = &ibuf[pan[4]];
-		idest[5] = &ibuf[pan[5]];
-		idest[6] = &ibuf[pan[6]];
-		idest[7] = &ibuf[pan[7]];
-		
-		for (i = 0, dest = buffer; i < nsamples; i++) {
+	for (int j = 0; j < nsamples; j++) {
+		CHECK_BUF_END();
+		StoreSample(dest[0], IStoSample(l[j]));
+		StoreSample(dest[1], IStoSample(r[j]));
+		// PSP以外はrateは0
+		dval0 = dest[0];
+		dval1 = dest[1];
+		switch (rate) {
+		case 11025:
+			dest += 2;
 			CHECK_BUF_END();
-			ibuf[1] = ibuf[2] = ibuf[3] = 0;
-			if (activech & 0xaaaa)
-				LFO(), MixSubL(activech, idest);
-			else
-				LFO(), MixSub(activech, idest);
-
-			StoreSample(dest[0], IStoSample(ibuf[1] + ibuf[3]));
-			StoreSample(dest[1], IStoSample(ibuf[2] + ibuf[3]));
-			// PSP以外はrateは0
-			dval0 = dest[0];
-			dval1 = dest[1];
-			switch (rate) {
-			case 11025:
-				dest += 2;
-				CHECK_BUF_END();
-				dest[0] = dval0;
-				dest[1] = dval1;
-				dest += 2;
-				CHECK_BUF_END();
-				dest[0] = dval0;
-				dest[1] = dval1;
-				// no break...
-			case 22050:
-				dest += 2;
-				CHECK_BUF_END();
-				dest[0] = dval0;
-				dest[1] = dval1;
-			case 44100:
-			case 0:
-				dest += 2;
-			}
+			dest[0] = dval0;
+			dest[1] = dval1;
+			dest += 2;
+			CHECK_BUF_END();
+			dest[0] = dval0;
+			dest[1] = dval1;
+			// no break...
+		case 22050:
+			dest += 2;
+			CHECK_BUF_END();
+			dest[0] = dval0;
+			dest[1] = dval1;
+		case 44100:
+		case 0:
+			dest += 2;
 		}
 	}
-#undef IStoSample
+	return dest;
+#undef CHECK_BUF_END
+}
+
+// ---------------------------------------------------------------------------
+//	合成 (stereo)
+//
+void OPM::Mix(Sample* buffer, int nsamples, int rate, BYTE* pbsp, BYTE* pbep)
+{
+	ISample bl[OPM_MIXBLOCK], br[OPM_MIXBLOCK];
+	Sample* dest = buffer;
+	int i, n;
+
+	uint activech = ActiveChannels();
+	if (!interpolation && !(activech & 0x5555))
+		return;
+
+	for (i = 0; i < nsamples; i += n) {
+		n = Min(nsamples - i, OPM_MIXBLOCK);
+		Render(activech, bl, br, n);
+		dest = StoreBlock(dest, bl, br, n, rate, pbsp, pbep);
+	}
 }
 
+// ---------------------------------------------------------------------------
+//	合成 (stereo, ISample)
+//	buffer は L,R 交互で上書き．飽和は呼び出し側 (ミキサー) で行う
+//
+void OPM::Mix(ISample* buffer, int nsamples)
+{
+	ISample bl[OPM_MIXBLOCK], br[OPM_MIXBLOCK];
+	int i, j, n;
+
+	uint activech = ActiveChannels();
+	if (!interpolation && !(activech & 0x5555))
+	{
+		memset(buffer, 0, nsamples * 2 * sizeof(ISample));
+		return;
+	}
+
+	for (i = 0; i < nsamples; i += n) {
+		n = Min(nsamples - i, OPM_MIXBLOCK);
+		Render(activech, bl, br, n);
+		for (j = 0; j < n; j++) {
+			*buffer++ = IStoSample(bl[j]);
+			*buffer++ = IStoSample(br[j]);
+		}
+	}
+}
+
+#undef IStoSample
+
 }	// namespace FM
 
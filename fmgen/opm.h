@@ -9,6 +9,7 @@
 #include "fmgen.h"
 #include "fmtimer.h"
 #include "psg.h"
+#include "resample.h"
 
 // ---------------------------------------------------------------------------
 //	class OPM
@@ -89,9 +90,19 @@ namespace FM
 		uint	ReadStatus() { return status & 0x03; }
 		
 		void 	Mix(Sample* buffer, int nsamples, int rate, BYTE* pbsp, BYTE* pbep);
+		void	Mix(ISample* buffer, int nsamples);
 		
 		void	SetVolume(int db);
 		void	SetChannelMask(uint mask);
+		void	SetSIMD(bool on) { usesimd = on; }
+		static bool	CheckSIMD(uint c, uint r);
+		void	SetResampleQuality(int q);
+		
+		// CSM のキーオン（タイマー A を別のオブジェクトで回すとき用）
+		void	KeyCSM();
+		
+	protected:
+		void	TimerA();
 		
 	private:
 		virtual void Intr(bool) {}
@@ -100,17 +111,54 @@ namespace FM
 		enum
 		{
 			OPM_LFOENTS = 512,
+			OPM_MIXBLOCK = 64,		// MixBlock で一度に計算するサンプル数
 		};
 		
 		void	SetStatus(uint bit);
 		void	ResetStatus(uint bit);
 		void	SetParameter(uint addr, uint data);
-		void	TimerA();
 		void	RebuildTimeTable();
-		void	MixSub(int activech, ISample**);
-		void	MixSubL(int activech, ISample**);
+		uint	ActiveChannels();
+		void	MixBlock(uint activech, ISample* obuf, int nsamples);
+		void	MixInternal(uint activech, ISample* l, ISample* r, int nsamples);
+		void	Render(uint activech, ISample* l, ISample* r, int nsamples);
+		Sample*	StoreBlock(Sample* dest, const ISample* l, const ISample* r, int nsamples,
+						   int rate, BYTE* pbsp, BYTE* pbep);
 		void	LFO();
 		uint	Noise();
+
+		// SIMD エンジン (opmsimd.cpp)
+		//	8ch x 4op の状態を SoA に展開し，1 サンプル分を全チャンネル同時に計算する
+		struct SIMDState
+		{
+			int32	pg_count[4][8];
+			int32	pg_diff[4][8];
+			int32	pg_diff_lfo[4][8];
+			int32	pg_step[4][8];
+			int32	eg_count[4][8];
+			int32	eg_count_diff[4][8];
+			int32	eg_out[4][8];
+			int32	out[4][8];
+			int32	out2[4][8];
+			const uint* ams[4][8];
+			int32	mod[4][3][8];		// [dst op][src op] 入力マスク
+			int32	carrier[4][8];		// 出力マスク
+			int32	panl[8];
+			int32	panr[8];
+			int32	fb[8];
+			int*	pms[8];
+			uint	active;			// SIMD で計算するチャンネル (bit0 = ch0)
+			bool	noise;			// ch7 をノイズとして別計算
+		};
+		void	SIMDLoad(uint activech);
+		void	SIMDCalc(bool lfo, ISample* ibuf);
+		void	SIMDStore();
+		void	SIMDOp(int k, const int32* in, bool lfo);
+		void	SIMDOpFB(bool lfo);
+		void	SIMDEGFix(int k, uint lanes);
+
+		SIMDState	simd;
+		bool	usesimd;
 		
 		int		fmvolume;
 
@@ -134,7 +182,9 @@ namespace FM
 		int32	noisecount;
 		uint32	noisedelta;
 		
-		bool	interpolation;
+		bool	interpolation;		// 内部レート (clock/64) で合成して変換する
+		int		rsquality;
+		Resampler	resampler;
 		uint8	lfofreq;
 		uint8	status;
 		uint8	reg01;
@@ -0,0 +1,389 @@
+// ---------------------------------------------------------------------------
+//	OPM SIMD engine
+//	8 チャンネル分のオペレータ状態を SoA (structure of arrays) に展開し,
+//	各 OP スロットを 8 レーン同時に計算する．
+//	演算順序・丸めは Channel4::Calc/CalcL と同一で，出力はビット単位で一致する．
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "misc.h"
+#include "opm.h"
+#include "fmgeninl.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+//	Operator::Calc と同じシフト量
+#define OPS_PGSHIFT		(20+FM_PGBITS-FM_OPSINBITS)
+#define OPS_IS2EC		((20 + FM_PGBITS) - 13)
+#define OPS_INSHIFT		(OPS_PGSHIFT-(2+OPS_IS2EC))
+
+namespace FM
+{
+
+// ---------------------------------------------------------------------------
+//	ベクトル補助
+//
+//	cnt -= diff, 0 以下になったレーンのビットを返す
+static inline uint v_egstep(int32* cnt, const int32* diff)
+{
+#if defined(__SSE2__)
+	__m128i z = _mm_set1_epi32(1);
+	__m128i c0 = _mm_sub_epi32(_mm_loadu_si128((__m128i*)cnt), _mm_loadu_si128((const __m128i*)diff));
+	__m128i c1 = _mm_sub_epi32(_mm_loadu_si128((__m128i*)(cnt+4)), _mm_loadu_si128((const __m128i*)(diff+4)));
+	_mm_storeu_si128((__m128i*)cnt, c0);
+	_mm_storeu_si128((__m128i*)(cnt+4), c1);
+	uint m0 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(c0, z)));
+	uint m1 = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(c1, z)));
+	return m0 | (m1 << 4);
+#elif defined(__ARM_NEON)
+	static const uint32 bit[4] = { 1, 2, 4, 8 };
+	uint32x4_t b = vld1q_u32(bit);
+	int32x4_t c0 = vsubq_s32(vld1q_s32(cnt), vld1q_s32(diff));
+	int32x4_t c1 = vsubq_s32(vld1q_s32(cnt+4), vld1q_s32(diff+4));
+	vst1q_s32(cnt, c0);
+	vst1q_s32(cnt+4, c1);
+	uint32x4_t m0 = vandq_u32(vcleq_s32(c0, vdupq_n_s32(0)), b);
+	uint32x4_t m1 = vandq_u32(vcleq_s32(c1, vdupq_n_s32(0)), b);
+	uint32x2_t s = vpadd_u32(vget_low_u32(m0), vget_high_u32(m0));
+	uint32x2_t t = vpadd_u32(vget_low_u32(m1), vget_high_u32(m1));
+	s = vpadd_u32(s, t);
+	return vget_lane_u32(s, 0) | (vget_lane_u32(s, 1) << 4);
+#else
+	uint m = 0;
+	for (int c=0; c<8; c++)
+	{
+		cnt[c] -= diff[c];
+		if (cnt[c] <= 0)
+			m |= 1 << c;
+	}
+	return m;
+#endif
+}
+
+//	pgin = (pg >> PGSHIFT) + (in >> INSHIFT), pg += step
+static inline void v_pgstep(int32* pgin, int32* pg, const int32* step, const int32* in)
+{
+#if defined(__SSE2__)
+	for (int i=0; i<8; i+=4)
+	{
+		__m128i p = _mm_loadu_si128((__m128i*)(pg+i));
+		__m128i x = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(in+i)), OPS_INSHIFT);
+		_mm_storeu_si128((__m128i*)(pgin+i), _mm_add_epi32(_mm_srli_epi32(p, OPS_PGSHIFT), x));
+		_mm_storeu_si128((__m128i*)(pg+i), _mm_add_epi32(p, _mm_loadu_si128((const __m128i*)(step+i))));
+	}
+#elif defined(__ARM_NEON)
+	for (int i=0; i<8; i+=4)
+	{
+		uint32x4_t p = vld1q_u32((uint32*)(pg+i));
+		int32x4_t x = vshrq_n_s32(vld1q_s32(in+i), OPS_INSHIFT);
+		vst1q_s32(pgin+i, vaddq_s32(vreinterpretq_s32_u32(vshrq_n_u32(p, OPS_PGSHIFT)), x));
+		vst1q_u32((uint32*)(pg+i), vaddq_u32(p, vld1q_u32((const uint32*)(step+i))));
+	}
+#else
+	for (int c=0; c<8; c++)
+	{
+		pgin[c] = int(uint32(pg[c]) >> OPS_PGSHIFT) + (in[c] >> OPS_INSHIFT);
+		pg[c] = int32(uint32(pg[c]) + uint32(step[c]));
+	}
+#endif
+}
+
+//	out = LogToLin(eg + SINE(pgin) + am)
+//	テーブル引きはレーンごと (gather はこの規模では逐次ロードより遅い)
+static inline void v_lookup(int32* out, const int32* pgin, const int32* eg, const int32* am,
+							const uint* sinetable, const int32* cltable)
+{
+	for (int c=0; c<8; c++)
+	{
+		uint a = eg[c] + sinetable[pgin[c] & (FM_OPSINENTS-1)] + am[c];
+		out[c] = (a < FM_CLENTS) ? cltable[a] : 0;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	Operator の状態を SoA に読み込む
+//
+void OPM::SIMDLoad(uint activech)
+{
+	// algo ごとの入力元 [op2: op0,op1] [op1: op0] [op3: op0,op1,op2] と出力 OP
+	static const uint8 modtable[8][6] =
+	{
+		{ 0,1, 1, 0,0,1 }, { 1,1, 0, 0,0,1 }, { 0,1, 0, 1,0,1 }, { 0,0, 1, 0,1,1 },
+		{ 0,0, 1, 0,0,1 }, { 1,0, 1, 1,0,0 }, { 0,0, 1, 0,0,0 }, { 0,0, 0, 0,0,0 },
+	};
+	static const uint8 cartable[8] = { 8, 8, 8, 8, 10, 14, 14, 15 };
+
+	simd.active = 0;
+	for (int c=0; c<8; c++)
+	{
+		if (activech & (1 << ((7-c)*2)))
+			simd.active |= 1 << c;
+	}
+	simd.noise = (simd.active & 0x80) && (noisedelta & 0x80);
+	if (simd.noise)
+		simd.active &= 0x7f;
+
+	for (int c=0; c<8; c++)
+	{
+		Channel4& chn = ch[c];
+		const uint8* m = modtable[chn.algo_ & 7];
+		uint car = cartable[chn.algo_ & 7];
+
+		for (int k=0; k<4; k++)
+		{
+			Operator& op = chn.op[k];
+			simd.pg_count[k][c] = op.pg_count_;
+			simd.pg_diff[k][c] = op.pg_diff_;
+			simd.pg_diff_lfo[k][c] = op.pg_diff_lfo_;
+			simd.pg_step[k][c] = op.pg_diff_;
+			simd.eg_count[k][c] = op.eg_count_;
+			simd.eg_count_diff[k][c] = op.eg_count_diff_;
+			simd.eg_out[k][c] = op.eg_out_;
+			simd.out[k][c] = op.out_;
+			simd.out2[k][c] = op.out2_;
+			simd.ams[k][c] = op.ams_;
+			simd.carrier[k][c] = (car & (1 << k)) ? -1 : 0;
+			simd.mod[k][0][c] = simd.mod[k][1][c] = simd.mod[k][2][c] = 0;
+		}
+		simd.mod[2][0][c] = m[0] ? -1 : 0;
+		simd.mod[2][1][c] = m[1] ? -1 : 0;
+		simd.mod[1][0][c] = m[2] ? -1 : 0;
+		simd.mod[3][0][c] = m[3] ? -1 : 0;
+		simd.mod[3][1][c] = m[4] ? -1 : 0;
+		simd.mod[3][2][c] = m[5] ? -1 : 0;
+
+		simd.panl[c] = (pan[c] & 1) ? -1 : 0;
+		simd.panr[c] = (pan[c] & 2) ? -1 : 0;
+		if (!(simd.active & (1 << c)))
+			simd.panl[c] = simd.panr[c] = 0;
+		simd.fb[c] = chn.fb;
+		simd.pms[c] = chn.pms;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	計算したチャンネルの状態を Operator に書き戻す
+//
+void OPM::SIMDStore()
+{
+	for (int c=0; c<8; c++)
+	{
+		if (!(simd.active & (1 << c)))
+			continue;
+		for (int k=0; k<4; k++)
+		{
+			Operator& op = ch[c].op[k];
+			op.pg_count_ = simd.pg_count[k][c];
+			op.eg_count_ = simd.eg_count[k][c];
+			op.out_ = simd.out[k][c];
+			op.out2_ = simd.out2[k][c];
+			op.dbgopout_ = simd.out[k][c];
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	EG カウンタが切れたレーンだけ Operator::EGCalc で処理
+//
+void OPM::SIMDEGFix(int k, uint lanes)
+{
+	lanes &= simd.active;
+	for (int c=0; lanes; c++, lanes >>= 1)
+	{
+		if (!(lanes & 1))
+			continue;
+		Operator& op = ch[c].op[k];
+		op.eg_count_ = simd.eg_count[k][c];
+		op.EGCalc();
+		simd.eg_count[k][c] = op.eg_count_;
+		simd.eg_count_diff[k][c] = op.eg_count_diff_;
+		simd.eg_out[k][c] = op.eg_out_;
+	}
+}
+
+//	Operator::Calc / CalcL 相当
+void OPM::SIMDOp(int k, const int32* in, bool lfo)
+{
+	int32 pgin[8], am[8];
+	int c;
+
+	SIMDEGFix(k, v_egstep(simd.eg_count[k], simd.eg_count_diff[k]));
+
+	if (lfo)
+	{
+		uint aml = chip.GetAML();
+		for (c=0; c<8; c++)
+			am[c] = simd.ams[k][c][aml];
+	}
+	else
+	{
+		for (c=0; c<8; c++)
+			am[c] = 0;
+		memcpy(simd.out2[k], simd.out[k], sizeof(simd.out2[k]));
+	}
+
+	v_pgstep(pgin, simd.pg_count[k], simd.pg_step[k], in);
+	v_lookup(simd.out[k], pgin, simd.eg_out[k], am, Operator::sinetable, Operator::cltable);
+}
+
+//	Operator::CalcFB / CalcFBL 相当 (op0)
+void OPM::SIMDOpFB(bool lfo)
+{
+	int32 pgin[8], am[8], zero[8];
+	int c;
+
+	SIMDEGFix(0, v_egstep(simd.eg_count[0], simd.eg_count_diff[0]));
+
+	if (lfo)
+	{
+		uint aml = chip.GetAML();
+		for (c=0; c<8; c++)
+			am[c] = simd.ams[0][c][aml];
+	}
+	else
+	{
+		for (c=0; c<8; c++)
+			am[c] = 0;
+	}
+
+	for (c=0; c<8; c++)
+		zero[c] = 0;
+	v_pgstep(pgin, simd.pg_count[0], simd.pg_step[0], zero);
+
+	// フィードバック量はチャンネルごとに異なるシフトなので各レーンで
+	for (c=0; c<8; c++)
+	{
+		ISample in = simd.out[0][c] + simd.out2[0][c];
+		simd.out2[0][c] = simd.out[0][c];
+		if (simd.fb[c] < 31)
+			pgin[c] += ((in << (1 + OPS_IS2EC)) >> simd.fb[c]) >> OPS_PGSHIFT;
+	}
+	v_lookup(simd.out[0], pgin, simd.eg_out[0], am, Operator::sinetable, Operator::cltable);
+}
+
+// ---------------------------------------------------------------------------
+//	1 サンプル合成 (ibuf[1] = L, ibuf[2] = R に加算)
+//
+void OPM::SIMDCalc(bool lfo, ISample* ibuf)
+{
+	int32 in[8], ret0[8];
+	int c, k;
+
+	if (lfo)
+	{
+		int pml = chip.GetPML();
+		int32 pmv[8];
+		for (c=0; c<8; c++)
+			pmv[c] = simd.pms[c][pml];
+		for (k=0; k<4; k++)
+		{
+			for (c=0; c<8; c++)
+				simd.pg_step[k][c] = int32(uint32(simd.pg_diff[k][c]) + ((simd.pg_diff_lfo[k][c] * pmv[c]) >> 5));
+		}
+	}
+
+	// Channel4::Calc と同じく op2, op1, op3, op0 の順
+	for (c=0; c<8; c++)
+		in[c] = (simd.mod[2][0][c] & simd.out[0][c]) + (simd.mod[2][1][c] & simd.out[1][c]);
+	SIMDOp(2, in, lfo);
+
+	for (c=0; c<8; c++)
+		in[c] = simd.mod[1][0][c] & simd.out[0][c];
+	SIMDOp(1, in, lfo);
+
+	for (c=0; c<8; c++)
+		in[c] = (simd.mod[3][0][c] & simd.out[0][c]) + (simd.mod[3][1][c] & simd.out[1][c])
+			  + (simd.mod[3][2][c] & simd.out[2][c]);
+	SIMDOp(3, in, lfo);
+
+	// CalcFB は更新前の出力, CalcFBL は更新後の出力を返す
+	memcpy(ret0, simd.out[0], sizeof(ret0));
+	SIMDOpFB(lfo);
+	if (lfo)
+		memcpy(ret0, simd.out[0], sizeof(ret0));
+
+	ISample l = 0, r = 0;
+	for (c=0; c<8; c++)
+	{
+		ISample s = (simd.carrier[0][c] & ret0[c]) + (simd.carrier[1][c] & simd.out[1][c])
+				  + (simd.carrier[2][c] & simd.out[2][c]) + (simd.carrier[3][c] & simd.out[3][c]);
+		l += s & simd.panl[c];
+		r += s & simd.panr[c];
+	}
+	ibuf[1] += l;
+	ibuf[2] += r;
+
+	if (simd.noise)
+	{
+		ISample s = lfo ? ch[7].CalcLN(Noise()) : ch[7].CalcN(Noise());
+		ibuf[pan[7]] += s;
+	}
+}
+
+// ---------------------------------------------------------------------------
+//	SIMD エンジンの照合
+//	同じレジスタ列を SIMD エンジンと Channel4::Calc の両方で合成し，
+//	出力が一致すれば true を返す．SetSIMD(true) の前に呼ぶ
+//
+bool OPM::CheckSIMD(uint c, uint r)
+{
+	// 8ch を con 0-7 に振り，LFO (AM/PM) とノイズ, キーオフ・再キーオンを含める
+	static const uint8 setup[][2] =
+	{
+		{ 0x18, 0xc8 }, { 0x19, 0x7f }, { 0x19, 0xb0 }, { 0x1b, 0x02 },
+		{ 0x0f, 0x8c },
+	};
+	static const int steps = 6, nsamples = 1024;
+	OPM* opm[2];
+	ISample buf[2][2 * nsamples];
+	bool ok = true;
+	int i, k, s;
+
+	opm[0] = new OPM;
+	opm[1] = new OPM;
+	for (i=0; i<2; i++)
+	{
+		opm[i]->Init(c, r, false);
+		opm[i]->SetSIMD(i == 1);
+		for (k=0; k<(int)(sizeof(setup)/sizeof(setup[0])); k++)
+			opm[i]->SetReg(setup[k][0], setup[k][1]);
+		for (k=0; k<8; k++)
+		{
+			opm[i]->SetReg(0x20 + k, 0xc0 | ((k * 3) & 7) << 3 | k);	// RL, FB, CON
+			opm[i]->SetReg(0x28 + k, 0x20 + k * 9);				// KC
+			opm[i]->SetReg(0x30 + k, k * 28);					// KF
+			opm[i]->SetReg(0x38 + k, (k & 7) << 4 | (k & 3));		// PMS, AMS
+			for (s=0; s<4; s++)
+			{
+				int op = 0x08 * s + k;
+				opm[i]->SetReg(0x40 + op, (s * 2 + k) & 0x7f);		// DT1, MUL
+				opm[i]->SetReg(0x60 + op, s == 3 ? 0x04 : 0x18 + k);	// TL
+				opm[i]->SetReg(0x80 + op, 0x1c + (s & 1) * 0x40);	// KS, AR
+				opm[i]->SetReg(0xa0 + op, 0x08 | (s & 1) << 7);		// AMS-EN, D1R
+				opm[i]->SetReg(0xc0 + op, 0x04 | (s & 2) << 5);		// DT2, D2R
+				opm[i]->SetReg(0xe0 + op, 0x47);				// D1L, RR
+			}
+		}
+	}
+	for (s=0; s<steps && ok; s++)
+	{
+		for (i=0; i<2; i++)
+		{
+			for (k=0; k<8; k++)
+				opm[i]->SetReg(0x08, (s & 1) ? k : (0x78 | k));	// 交互にキーオン・オフ
+			opm[i]->SetReg(0x1b, s % 3);	// LFO 波形（3 は rand() を使うので 2 つの間で揃わない）
+			opm[i]->Mix(buf[i], nsamples);
+		}
+		ok = !memcmp(buf[0], buf[1], sizeof(buf[0]));
+	}
+	delete opm[0];
+	delete opm[1];
+	return ok;
+}
+
+}	// namespace FM
@@ -160,10 +160,14 @@ void OPNBase::SetVolumeFM(int db)
 void OPNBase::TimerA()
 {
 	if (regtc & 0x80)
-	{
-		csmch->KeyControl(0x00);
-		csmch->KeyControl(0x0f);
-	}
+		KeyCSM();
+}
+
+//	CSM のキーオン
+void OPNBase::KeyCSM()
+{
+	csmch->KeyControl(0x00);
+	csmch->KeyControl(0x0f);
 }
 
 #endif // defined(BUILD_OPN) || defined(BUILD_OPNA) || defined (BUILD_OPNB)
@@ -93,6 +93,9 @@ namespace FM
 		void	SetVolumeFM(int db);
 		void	SetVolumePSG(int db);
 		void	SetLPFCutoff(uint freq) {}	// obsolete
+		
+		// CSM のキーオン（タイマー A を別のオブジェクトで回すとき用）
+		void	KeyCSM();
 
 	protected:
 		void	SetParameter(Channel4* ch, uint addr, uint data);
@@ -0,0 +1,223 @@
+// ---------------------------------------------------------------------------
+//	Polyphase resampler (stereo)
+// ---------------------------------------------------------------------------
+
+#include "headers.h"
+#include "misc.h"
+#include "resample.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define RS_PI	3.14159265358979323846
+
+typedef unsigned long long uint64;
+
+namespace FM
+{
+
+Resampler::Resampler()
+: coef(0), bufl(0), bufr(0), taps(0), size(0), len(0), pos(0), frac(0), inrate(0), outrate(0)
+{
+}
+
+Resampler::~Resampler()
+{
+	Free();
+}
+
+void Resampler::Free()
+{
+	delete[] coef;
+	delete[] bufl;
+	delete[] bufr;
+	coef = bufl = bufr = 0;
+}
+
+// ---------------------------------------------------------------------------
+//	初期化
+//	各位相の係数は Blackman 窓付き sinc で，合計が 1 になるよう正規化する
+//
+bool Resampler::Init(uint ir, uint orate, int quality)
+{
+	static const int taptable[QUALITY_MAX+1] = { 2, 8, 16, 32 };
+	static const double rolloff[QUALITY_MAX+1] = { 1.0, 0.80, 0.88, 0.92 };
+
+	Free();
+	if (!ir || !orate)
+		return false;
+
+	quality = Limit(quality, QUALITY_MAX, 0);
+	inrate = ir;
+	outrate = orate;
+	taps = taptable[quality];
+
+	// 1 回の Pull で 64 サンプル程度を想定し，余裕を持たせる
+	size = taps + int((uint64(256) * inrate + outrate - 1) / outrate) + 64;
+	coef = new float[PHASES * taps];
+	bufl = new float[size];
+	bufr = new float[size];
+	if (!coef || !bufl || !bufr)
+	{
+		Free();
+		return false;
+	}
+
+	double fc = 0.5 * rolloff[quality] * (outrate < inrate ? double(outrate) / inrate : 1.0);
+	int center = taps / 2 - 1;
+	for (int p=0; p<PHASES; p++)
+	{
+		double ph = double(p) / PHASES;
+		float* c = coef + p * taps;
+		double sum = 0;
+		for (int k=0; k<taps; k++)
+		{
+			double d = k - center - ph;
+			double h;
+			if (taps == 2)
+			{
+				h = 1.0 - fabs(d);
+			}
+			else
+			{
+				double x = d / (taps / 2);
+				double w = 0.42 + 0.5 * cos(RS_PI * x) + 0.08 * cos(2 * RS_PI * x);
+				double s = fabs(d) < 1e-9 ? 1.0 : sin(2 * RS_PI * fc * d) / (2 * RS_PI * fc * d);
+				h = s * w;
+			}
+			c[k] = float(h);
+			sum += h;
+		}
+		for (int k=0; k<taps; k++)
+			c[k] = float(c[k] / sum);
+	}
+
+	// 窓の半分ぶん無音で埋めておく
+	len = taps - 1;
+	pos = 0;
+	frac = 0;
+	for (int i=0; i<size; i++)
+		bufl[i] = bufr[i] = 0.f;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	nout サンプル出力するのに不足している入力サンプル数
+//
+int Resampler::Needed(int nout)
+{
+	if (nout <= 0)
+		return 0;
+	int last = pos + int((uint64(frac) + uint64(nout - 1) * inrate) / outrate);
+	return Max(0, last + taps - len);
+}
+
+// ---------------------------------------------------------------------------
+//	入力を追加
+//
+void Resampler::Push(const ISample* l, const ISample* r, int n)
+{
+	if (len + n > size)
+	{
+		// 消費済みの入力を詰める
+		int keep = len - pos;
+		memmove(bufl, bufl + pos, keep * sizeof(float));
+		memmove(bufr, bufr + pos, keep * sizeof(float));
+		len = keep;
+		pos = 0;
+		n = Min(n, size - len);
+	}
+	for (int i=0; i<n; i++)
+	{
+		bufl[len + i] = float(l[i]);
+		bufr[len + i] = float(r[i]);
+	}
+	len += n;
+}
+
+// ---------------------------------------------------------------------------
+//	1 サンプル分の FIR (L/R 同時)
+//
+static inline void Dot(const float* c, const float* xl, const float* xr, int taps, float& ol, float& or_)
+{
+#if defined(__SSE2__)
+	__m128 al = _mm_setzero_ps(), ar = _mm_setzero_ps();
+	for (int k=0; k<taps; k+=4)
+	{
+		__m128 v = _mm_loadu_ps(c + k);
+		al = _mm_add_ps(al, _mm_mul_ps(v, _mm_loadu_ps(xl + k)));
+		ar = _mm_add_ps(ar, _mm_mul_ps(v, _mm_loadu_ps(xr + k)));
+	}
+	// L/R を並べて横方向に加算
+	__m128 lo = _mm_unpacklo_ps(al, ar), hi = _mm_unpackhi_ps(al, ar);
+	__m128 s = _mm_add_ps(lo, hi);
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	float t[4];
+	_mm_storeu_ps(t, s);
+	ol = t[0];
+	or_ = t[1];
+#elif defined(__ARM_NEON)
+	float32x4_t al = vdupq_n_f32(0.f), ar = vdupq_n_f32(0.f);
+	for (int k=0; k<taps; k+=4)
+	{
+		float32x4_t v = vld1q_f32(c + k);
+		al = vmlaq_f32(al, v, vld1q_f32(xl + k));
+		ar = vmlaq_f32(ar, v, vld1q_f32(xr + k));
+	}
+	float32x2_t sl = vadd_f32(vget_low_f32(al), vget_high_f32(al));
+	float32x2_t sr = vadd_f32(vget_low_f32(ar), vget_high_f32(ar));
+	float32x2_t s = vpadd_f32(sl, sr);
+	ol = vget_lane_f32(s, 0);
+	or_ = vget_lane_f32(s, 1);
+#else
+	float sl = 0.f, sr = 0.f;
+	for (int k=0; k<taps; k++)
+	{
+		sl += c[k] * xl[k];
+		sr += c[k] * xr[k];
+	}
+	ol = sl;
+	or_ = sr;
+#endif
+}
+
+static inline ISample ToSample(float v)
+{
+	return ISample(v >= 0.f ? v + 0.5f : v - 0.5f);
+}
+
+// ---------------------------------------------------------------------------
+//	出力
+//
+void Resampler::Pull(ISample* l, ISample* r, int nout)
+{
+	for (int i=0; i<nout; i++)
+	{
+		float ol, or_;
+		if (pos + taps > len)
+		{
+			// 入力不足 (呼び出し側の誤り) は無音
+			l[i] = r[i] = 0;
+			continue;
+		}
+		const float* c = coef + (frac * PHASES / outrate) * taps;
+		if (taps == 2)
+		{
+			ol = c[0] * bufl[pos] + c[1] * bufl[pos + 1];
+			or_ = c[0] * bufr[pos] + c[1] * bufr[pos + 1];
+		}
+		else
+			Dot(c, bufl + pos, bufr + pos, taps, ol, or_);
+		l[i] = ToSample(ol);
+		r[i] = ToSample(or_);
+
+		frac += inrate;
+		pos += frac / outrate;
+		frac %= outrate;
+	}
+}
+
+}	// namespace FM
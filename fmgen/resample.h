@@ -0,0 +1,58 @@
+// ---------------------------------------------------------------------------
+//	Polyphase resampler (stereo)
+// ---------------------------------------------------------------------------
+
+#ifndef FM_RESAMPLE_H
+#define FM_RESAMPLE_H
+
+#include "fmgen.h"
+
+// ---------------------------------------------------------------------------
+//	class Resampler
+//	音源内部のレートで作ったサンプルを出力レートへ変換する．
+//
+//	bool Init(uint inrate, uint outrate, int quality)
+//		quality: 0 = 線形補間 (2 tap), 1 = 8 tap, 2 = 16 tap, 3 = 32 tap
+//		窓付き sinc．tap 数が多いほど折り返しが少なく重い．
+//
+//	int Needed(int nout)
+//		nout サンプル出力するのに追加で Push すべき入力サンプル数
+//
+//	void Push(const ISample* l, const ISample* r, int n)
+//	void Pull(ISample* l, ISample* r, int nout)
+//		Needed が 0 になるまで Push してから Pull すること
+//
+namespace FM
+{
+	class Resampler
+	{
+	public:
+		enum { QUALITY_MAX = 3 };
+
+		Resampler();
+		~Resampler();
+
+		bool	Init(uint inrate, uint outrate, int quality);
+		int		Needed(int nout);
+		void	Push(const ISample* l, const ISample* r, int n);
+		void	Pull(ISample* l, ISample* r, int nout);
+
+	private:
+		enum { PHASES = 1024 };
+
+		void	Free();
+
+		float*	coef;		// [PHASES][taps]
+		float*	bufl;
+		float*	bufr;
+		int		taps;
+		int		size;		// バッファ容量
+		int		len;		// 溜まっている入力サンプル数
+		int		pos;		// 次の出力の窓の先頭
+		uint	frac;		// 位相 (0 <= frac < outrate)
+		uint	inrate;
+		uint	outrate;
+	};
+}
+
+#endif // FM_RESAMPLE_H
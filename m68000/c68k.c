@@ -229,6 +229,8 @@ void C68k_Set_Reg(c68k_struc *CPU, INT32 regnum, UINT32 val)
 	{
 	case C68K_PC:
 		CPU->BasePC = CPU->Fetch[(val >> C68K_FETCH_SFT) & C68K_FETCH_MASK];
+		if (CPU->FetchHooked[(val >> C68K_FETCH_SFT) & C68K_FETCH_MASK])
+			CPU->Fetch_CallBack(val & 0xffffff);
 		CPU->BasePC -= val & 0xff000000;
 		CPU->PC = val + CPU->BasePC;
 		break;
@@ -280,6 +282,18 @@ void C68k_Set_Fetch(c68k_struc *CPU, UINT32 low_adr, UINT32 high_adr, uintptr_t
 	while (i <= j) CPU->Fetch[i++] = fetch_adr;
 }
 
+// Func is called whenever the PC is set into [low_adr, high_adr]
+// (jumps, exceptions, C68k_Set_Reg), before the first fetch there
+void C68k_Set_FetchHook(c68k_struc *CPU, UINT32 low_adr, UINT32 high_adr, void (*Func)(UINT32 address))
+{
+	UINT32 i, j;
+
+	i = (low_adr >> C68K_FETCH_SFT) & C68K_FETCH_MASK;
+	j = (high_adr >> C68K_FETCH_SFT) & C68K_FETCH_MASK;
+	CPU->Fetch_CallBack = Func;
+	while (i <= j) CPU->FetchHooked[i++] = (Func != NULL);
+}
+
 
 /*--------------------------------------------------------
 	/
@@ -129,6 +129,8 @@ typedef struct c68k_t
 
 	uintptr_t BasePC;
 	uintptr_t Fetch[C68K_FETCH_BANK];
+	UINT8 FetchHooked[C68K_FETCH_BANK];	// PC moved into this bank -> Fetch_CallBack
+	void (*Fetch_CallBack)(UINT32 address);
 
 	UINT8  (*Read_Byte)(UINT32 address);
 	UINT16 (*Read_Word)(UINT32 address);
@@ -164,6 +166,7 @@ UINT32  C68k_Get_Reg(c68k_struc *cpu, INT32 regnum);
 void C68k_Set_Reg(c68k_struc *cpu, INT32 regnum, UINT32 val);
 
 void C68k_Set_Fetch(c68k_struc *cpu, UINT32 low_adr, UINT32 high_adr, uintptr_t fetch_adr);
+void C68k_Set_FetchHook(c68k_struc *cpu, UINT32 low_adr, UINT32 high_adr, void (*Func)(UINT32 address));
 
 void C68k_Set_ReadB(c68k_struc *cpu, UINT8 (*Func)(UINT32 address));
 void C68k_Set_ReadW(c68k_struc *cpu, UINT16 (*Func)(UINT32 address));
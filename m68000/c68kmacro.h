@@ -141,6 +141,8 @@
 {																			\
 	UINT32 _addr = (A) & 0xFFFFFF; /* M68000 24-bit address mask */			\
 	CPU->BasePC = CPU->Fetch[(_addr >> C68K_FETCH_SFT) & C68K_FETCH_MASK];	\
+	if (CPU->FetchHooked[(_addr >> C68K_FETCH_SFT) & C68K_FETCH_MASK])		\
+		CPU->Fetch_CallBack(_addr);											\
 	PC = _addr + CPU->BasePC;												\
 }
 
@@ -9,6 +9,7 @@
 #include "m68000.h"
 #include "c68k.h"
 #include "../x68k/memory.h"
+#include "../x68k/gvram.h"
 
 /******************************************************************************
 	CPS2ROM
@@ -75,6 +76,7 @@ void m68000_init(void)
 	C68k_Set_WriteW(&C68K, Memory_WriteW);
         C68k_Set_Fetch(&C68K, 0x000000, 0xbfffff, (uintptr_t)MEM);
         C68k_Set_Fetch(&C68K, 0xc00000, 0xc7ffff, (uintptr_t)GVRAM);
+        C68k_Set_FetchHook(&C68K, 0xc00000, 0xc7ffff, GVRAM_ResolveFetch);
         C68k_Set_Fetch(&C68K, 0xe00000, 0xe7ffff, (uintptr_t)TVRAM);
         C68k_Set_Fetch(&C68K, 0xea0000, 0xea1fff, (uintptr_t)SCSIIPL);
         C68k_Set_Fetch(&C68K, 0xed0000, 0xed3fff, (uintptr_t)SRAM);
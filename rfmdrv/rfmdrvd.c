@@ -3,8 +3,13 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include "rfmproto.h"
 
 //  レジスタブロックの物理アドレス
 #define PERI_BASE     0x20000000
@@ -232,11 +237,13 @@ unsigned char read_mem(unsigned int *p)
   return d;
 }
 
-void main ()
+static int dry_run = 0;          //  -n: GPIO に触らずログだけ出す
+
+void opm_init(void)
 {
-  int i, sock, fd, rsize, retval;
-  struct sockaddr_in sa;
-  char buf[2];
+  if (dry_run) {
+    return;
+  }
 
   gpio_init();
 
@@ -254,28 +261,169 @@ void main ()
   gpio_set(OPM_WR);
   gpio_set(OPM_RD);
 
-  printf("start\n");
-
   usleep(100000);                 //  0.1秒待ち
   gpio_clear(OPM_IC);
   usleep(100000);                 //  0.1秒待ち
   gpio_set(OPM_IC);
   usleep(100000);                 //  0.1秒待ち
+}
 
-  sock = socket(AF_INET, SOCK_STREAM, 0);
-  if (sock ==  -1) {
-    printf("socket error\n");
-    exit(1);
+//  port: px68k の $e90001/$e90003 の下位 2bit（1: アドレス, 3: データ）
+void opm_write(unsigned char port, unsigned char d, unsigned int t)
+{
+  if (dry_run) {
+    printf("%10u %d 0x%02x\n", t, port, d);
+    return;
   }
-  memset(&sa, 0, sizeof(sa));
-  sa.sin_family = AF_INET;
-  sa.sin_port = htons(2151);
-  sa.sin_addr.s_addr = htonl(INADDR_ANY);
 
-  if (bind(sock, (struct sockaddr *)&sa, sizeof(struct sockaddr_in)) == -1) {
-    printf("bind error\n");
-    close(sock);
-    exit(1);
+  write_data(d);
+  usleep(1);
+
+  if (port == 1) {
+    gpio_clear(OPM_A0);
+  } else {
+    gpio_set(OPM_A0);
+  }
+
+  gpio_clear(OPM_CS);
+  usleep(1);
+  gpio_clear(OPM_WR);
+  usleep(2);
+  gpio_set(OPM_WR);
+  usleep(1);
+  gpio_set(OPM_CS);
+  usleep(1);
+  usleep(256);
+}
+
+int recv_all(int fd, unsigned char *buf, int len)
+{
+  int rsize;
+
+  while (len > 0) {
+    rsize = recv(fd, buf, len, 0);
+    if (rsize <= 0) {
+      return 0;
+    }
+    buf += rsize;
+    len -= rsize;
+  }
+  return 1;
+}
+
+long long now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sleep_until(long long t)
+{
+  struct timespec ts;
+
+  ts.tv_sec = t / 1000000;
+  ts.tv_nsec = (t % 1000000) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+    ;
+}
+
+//  旧プロトコル: 届いた順にそのまま書く
+void serve_legacy(int fd, unsigned char *first)
+{
+  unsigned char buf[2];
+
+  opm_write(first[0], first[1], 0);
+  opm_write(first[2], first[3], 0);
+  while (recv_all(fd, buf, sizeof(buf))) {
+    opm_write(buf[0], buf[1], 0);
+  }
+}
+
+//  新プロトコル: エミュレーション時刻に合わせて latency 遅れで書く
+void serve_timed(int fd, long long latency)
+{
+  static unsigned char buf[RFM_BATCH * RFM_RECSIZE];
+  unsigned char hdr[2];
+  unsigned int base_emu = 0, t;
+  long long base_host = 0, target, now;
+  int synced = 0, n, i;
+
+  while (recv_all(fd, hdr, sizeof(hdr))) {
+    n = hdr[0] | (hdr[1] << 8);
+    if (n > RFM_BATCH || !recv_all(fd, buf, n * RFM_RECSIZE)) {
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      unsigned char *p = buf + i * RFM_RECSIZE;
+
+      t = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+      now = now_us();
+      if (synced) {
+        target = base_host + (int)(t - base_emu);
+        //  ポーズや早送りでずれ過ぎたら基準を取り直す
+        if (target < now - latency || target > now + latency + 1000000) {
+          synced = 0;
+        }
+      }
+      if (!synced) {
+        base_emu = t;
+        base_host = now + latency;
+        target = base_host;
+        synced = 1;
+      }
+      if (target > now) {
+        sleep_until(target);
+      }
+      opm_write(p[4], p[5], t);
+    }
+    if (dry_run) {
+      fflush(stdout);
+    }
+  }
+}
+
+int listen_socket(const char *path, int port)
+{
+  int sock;
+
+  if (path) {
+    struct sockaddr_un su;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+      printf("socket error\n");
+      exit(1);
+    }
+    memset(&su, 0, sizeof(su));
+    su.sun_family = AF_UNIX;
+    strncpy(su.sun_path, path, sizeof(su.sun_path) - 1);
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&su, sizeof(su)) == -1) {
+      printf("bind error\n");
+      close(sock);
+      exit(1);
+    }
+  } else {
+    struct sockaddr_in sa;
+    int one = 1;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
+      printf("socket error\n");
+      exit(1);
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *)&sa, sizeof(struct sockaddr_in)) == -1) {
+      printf("bind error\n");
+      close(sock);
+      exit(1);
+    }
   }
 
   if (listen(sock, 128) == -1) {
@@ -283,47 +431,62 @@ void main ()
     close(sock);
     exit(1);
   }
+  return sock;
+}
 
-  printf("listened\n");
+void usage(const char *prog)
+{
+  printf("usage: %s [-n] [-p port] [-u socket_path] [-l latency_ms]\n", prog);
+  printf("  -n  don't touch GPIO, just log received writes\n");
+}
 
-  fd = accept(sock, NULL, NULL);
-  if (fd == -1) {
-    printf("accept error\n");
-    close(sock);
-    exit(1);
+int main (int argc, char *argv[])
+{
+  int c, sock, fd, port = RFM_PORT, latency = 20;
+  const char *path = NULL;
+  unsigned char first[4];
+
+  while ((c = getopt(argc, argv, "np:u:l:h")) != -1) {
+    switch (c) {
+    case 'n': dry_run = 1; break;
+    case 'p': port = atoi(optarg); break;
+    case 'u': path = optarg; break;
+    case 'l': latency = atoi(optarg); break;
+    default: usage(argv[0]); exit(1);
+    }
   }
 
-  printf("accepted\n");
+  signal(SIGPIPE, SIG_IGN);
+  opm_init();
 
+  printf("start\n");
+
+  sock = listen_socket(path, port);
+
+  printf("listened\n");
+
+  //  px68k を再起動しても続けて使えるように、切断されたら次を待つ
   while (1) {
-    memset(buf, 0, sizeof(buf));
-    rsize = recv(fd, buf, sizeof(buf), 0);
-    if (rsize > 0) {
-      //printf("%d 0x%x\n", buf[0], buf[1]);
+    fd = accept(sock, NULL, NULL);
+    if (fd == -1) {
+      printf("accept error\n");
+      close(sock);
+      exit(1);
+    }
 
-      write_data(buf[1]);
-      usleep(1);
+    printf("accepted\n");
+    fflush(stdout);
 
-      if (buf[0] == 1) {
-	gpio_clear(OPM_A0);
+    if (recv_all(fd, first, sizeof(first))) {
+      if (memcmp(first, RFM_MAGIC, 4) == 0) {
+        serve_timed(fd, (long long)latency * 1000);
       } else {
-	gpio_set(OPM_A0);
+        serve_legacy(fd, first);
       }
-
-      gpio_clear(OPM_CS);
-      usleep(1);
-      gpio_clear(OPM_WR);
-      usleep(2);
-      gpio_set(OPM_WR);
-      usleep(1);
-      gpio_set(OPM_CS);
-      usleep(1);
-      usleep(256);
     }
+    close(fd);
   }
 
-  close(fd);
   close(sock);
   exit(0);
 }
-
@@ -0,0 +1,17 @@
+#ifndef rfmdrv_rfmproto_h
+#define rfmdrv_rfmproto_h
+
+//  RFMDRV 通信プロトコル（px68k <-> rfmdrvd 共通）
+//
+//  旧プロトコル: [ポート(1) データ(1)] を 1 書き込みごとに送る
+//  新プロトコル: 接続直後に RFM_MAGIC を送り、以降はパケット単位
+//      パケット   = 件数(2, LE) + レコード x 件数
+//      レコード   = 時刻(4, LE) + ポート(1) + データ(1)
+//      時刻はエミュレーション上の経過時間（μs、32bit で一周する）
+
+#define RFM_MAGIC	"RFM2"
+#define RFM_PORT	2151
+#define RFM_RECSIZE	6
+#define RFM_BATCH	512		//  1 パケットの最大レコード数
+
+#endif //rfmdrv_rfmproto_h
@@ -0,0 +1,175 @@
+// -----------------------------------------------------------------------
+//   Disk image I/O worker (host I/O on a thread, completion on emulated time)
+// -----------------------------------------------------------------------
+#include <stdlib.h>
+#include "common.h"
+#include <SDL.h>
+#include "diskio.h"
+
+typedef struct {
+	DISKIO_PROC proc;
+	DISKIO_DONE done;
+	void *param;
+	int used;
+	int remain;		// 完了を返すまでのクロック
+	int result;
+	SDL_atomic_t finished;
+} DISKIO_JOB;
+
+// ジョブの空き枠探し・完了の受け取りはエミュレーションスレッドのみ
+static DISKIO_JOB Jobs[DISKIO_MAX_JOBS];
+
+// 投入順（ワーカーはこの順に処理する）。書くのはエミュレーション側、読むのはワーカー
+static int Queue[DISKIO_MAX_JOBS];
+static int QueueWr = 0, QueueRd = 0;
+
+static SDL_Thread *IOThread = NULL;
+static SDL_sem *IOStart = NULL;
+static SDL_sem *IODone = NULL;
+static volatile int IOQuit = 0;
+
+static int diskio_thread(void *arg)
+{
+	DISKIO_JOB *job;
+
+	(void)arg;
+
+	for (;;) {
+		SDL_SemWait(IOStart);
+		if (IOQuit)
+			break;
+		job = &Jobs[Queue[QueueRd]];
+		QueueRd = (QueueRd + 1) % DISKIO_MAX_JOBS;
+		job->result = job->proc(job->param);
+		SDL_AtomicSet(&job->finished, 1);
+		SDL_SemPost(IODone);
+	}
+	return 0;
+}
+
+int DiskIO_Init(void)
+{
+	DiskIO_Cleanup();
+
+	QueueWr = QueueRd = 0;
+	IOQuit = 0;
+	IOStart = SDL_CreateSemaphore(0);
+	IODone = SDL_CreateSemaphore(0);
+	if (IOStart && IODone)
+		IOThread = SDL_CreateThread(diskio_thread, "diskio", NULL);
+	if (IOThread == NULL) {
+		// スレッド無しでも submit 時にその場で実行するので動作は同じ
+		fprintf(stderr, "DiskIO: can't start I/O thread, using synchronous I/O\n");
+		DiskIO_Cleanup();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void DiskIO_Cleanup(void)
+{
+	DiskIO_Wait(NULL);
+
+	if (IOThread) {
+		IOQuit = 1;
+		SDL_SemPost(IOStart);
+		SDL_WaitThread(IOThread, NULL);
+		IOThread = NULL;
+	}
+	if (IOStart) {
+		SDL_DestroySemaphore(IOStart);
+		IOStart = NULL;
+	}
+	if (IODone) {
+		SDL_DestroySemaphore(IODone);
+		IODone = NULL;
+	}
+}
+
+// -----------------------------------------------------------------------
+//   delay: 完了を返すまでのエミュレーション上のクロック数
+//   枠が無い時は FALSE（呼んだ側でその場で処理する）
+// -----------------------------------------------------------------------
+int DiskIO_Submit(DISKIO_PROC proc, DISKIO_DONE done, void *param, DWORD delay)
+{
+	DISKIO_JOB *job;
+	int i;
+
+	for (i = 0; i < DISKIO_MAX_JOBS; i++) {
+		if (!Jobs[i].used)
+			break;
+	}
+	if (i == DISKIO_MAX_JOBS)
+		return FALSE;
+
+	job = &Jobs[i];
+	job->proc = proc;
+	job->done = done;
+	job->param = param;
+	job->used = 1;
+	job->remain = (delay > 0) ? (int)delay : 1;
+	job->result = 0;
+	SDL_AtomicSet(&job->finished, 0);
+
+	if (IOThread) {
+		Queue[QueueWr] = i;
+		QueueWr = (QueueWr + 1) % DISKIO_MAX_JOBS;
+		SDL_SemPost(IOStart);
+	} else {
+		job->result = proc(param);
+		SDL_AtomicSet(&job->finished, 1);
+	}
+	return TRUE;
+}
+
+static void diskio_complete(DISKIO_JOB *job)
+{
+	DISKIO_DONE done = job->done;
+	void *param = job->param;
+	int result;
+
+	// ホスト側が間に合っていなければ待つ（エミュレーション上の時刻は変えない）
+	while (!SDL_AtomicGet(&job->finished))
+		SDL_SemWait(IODone);
+	result = job->result;
+	job->used = 0;
+	done(param, result);
+}
+
+// -----------------------------------------------------------------------
+//   ラスタ毎に呼ぶ。時間が来たジョブの完了を返す
+// -----------------------------------------------------------------------
+void DiskIO_Advance(DWORD clock)
+{
+	int i, due = 0;
+
+	for (i = 0; i < DISKIO_MAX_JOBS; i++) {
+		if (Jobs[i].used) {
+			Jobs[i].remain -= (int)clock;
+			if (Jobs[i].remain <= 0)
+				due = 1;
+		}
+	}
+	if (!due)
+		return;
+
+	// 完了処理の中で次のジョブが積まれても、それは今回は数えない
+	for (i = 0; i < DISKIO_MAX_JOBS; i++) {
+		if (Jobs[i].used && Jobs[i].remain <= 0)
+			diskio_complete(&Jobs[i]);
+	}
+}
+
+// -----------------------------------------------------------------------
+//   param のジョブ（NULL なら全部）を今すぐ終わらせる
+//   リセットや取り出しなど、デバイスの外から状態を触る前に呼ぶ
+// -----------------------------------------------------------------------
+void DiskIO_Wait(void *param)
+{
+	int i;
+
+	for (i = 0; i < DISKIO_MAX_JOBS; i++) {
+		if (Jobs[i].used && (param == NULL || Jobs[i].param == param))
+			diskio_complete(&Jobs[i]);
+	}
+}
@@ -0,0 +1,30 @@
+#ifndef winx68k_diskio_h
+#define winx68k_diskio_h
+
+#include "common.h"
+
+/*
+ * Disk image I/O worker.  A device that has to touch the image file hands
+ * the work to DiskIO_Submit() and keeps its bus busy; the job runs on the
+ * I/O thread and its completion is handed back on the emulation thread by
+ * DiskIO_Advance() once the given number of emulated clocks has passed.
+ * If the host hasn't finished by then the emulation waits for it, so what
+ * the guest sees never depends on how fast the host disk is.  Without the
+ * thread the job runs at submit time and completes at the same point.
+ *
+ * While a job is in flight the device must leave everything the job uses
+ * alone; out-of-band paths (reset, eject, exit) call DiskIO_Wait() first.
+ */
+
+typedef int (*DISKIO_PROC)(void *param);		/* I/O thread */
+typedef void (*DISKIO_DONE)(void *param, int result);	/* emulation thread */
+
+#define DISKIO_MAX_JOBS		32
+
+int DiskIO_Init(void);
+void DiskIO_Cleanup(void);
+int DiskIO_Submit(DISKIO_PROC proc, DISKIO_DONE done, void *param, DWORD delay);
+void DiskIO_Advance(DWORD clock);
+void DiskIO_Wait(void *param);
+
+#endif //winx68k_diskio_h
@@ -30,18 +30,16 @@
 #include	"adpcm.h"
 #include	"mercury.h"
 #include	"fmg_wrap.h"
+#include	"recorder.h"
+#include	"mixer.h"
+#include	"winx68k.h"
 
 short	playing = FALSE;
 
-#define PCMBUF_SIZE 2*2*48000
+#define PCMBUF_SIZE (2*2*48000)
 BYTE pcmbuffer[PCMBUF_SIZE];
-BYTE *pcmbufp = pcmbuffer;
-BYTE *pbsp = pcmbuffer;
-BYTE *pbrp = pcmbuffer, *pbwp = pcmbuffer;
-BYTE *pbep = &pcmbuffer[PCMBUF_SIZE];
 DWORD ratebase = 22050;
 long DSound_PreCounter = 0;
-BYTE sdlsndbuf[PCMBUF_SIZE];
 
 static void sdlaudio_callback(void *userdata, unsigned char *stream, int len);
 
@@ -51,12 +49,211 @@ static void sdlaudio_callback(void *userdata, unsigned char *stream, int len);
 
 static SDL_AudioDeviceID audio_device_id = 0;
 
+// pcmbuffer はエミュレーション側だけが書き、コールバックは読むだけのリング
+// 位置はバイトオフセット、書き込み側が pcm_wr、読み出し側が pcm_rd を進める
+static SDL_atomic_t pcm_rd, pcm_wr;
+static DWORD pcm_limit = PCMBUF_SIZE - 4;	// これ以上は先行して溜めない
+static SDL_atomic_t pcm_prime;			// 再生開始（再開）に必要な量
+static int pcm_primed = 0;
+static DWORD pcm_drop = 0, pcm_underrun = 0;
+
+typedef struct {
+	DWORD rate;
+	DWORD samples;			// デバイスのバッファ (frames)
+	DWORD target_ms;		// リングに溜める量
+	DWORD callbacks;
+	DWORD underruns;
+	DWORD drops;			// bytes
+	DWORD interval_avg_us;		// 直近約 1 秒のコールバック間隔
+	DWORD interval_max_us;
+	DWORD ring_min_ms;		// 直近約 1 秒のコールバック時のリング残量
+	DWORD ring_max_ms;
+	DWORD reopens;
+} DSOUND_STATS;
+
+// バッファの自動調整: デバイスのバッファ (samples) とリングの目標量 (pcm_prime)
+// を BufferMin..BufferSize の範囲で、アンダーランが出ない一番小さい所に寄せる
+static SDL_AudioSpec pcm_spec;
+static DWORD pcm_samples = 0, pcm_min_samples = 0, pcm_max_samples = 0;
+static DWORD pcm_floor = 0;			// これより小さくすると途切れた
+static DWORD pcm_target = 0;			// リングの目標量 (bytes)
+static int pcm_adaptive = 0, pcm_stable = 0;
+static int pcm_hold = 3;			// 詰めるまでに待つ回数（途切れる度に倍）
+static DSOUND_STATS pcm_stats;		// 終了時にログへ出す
+
+// コールバックが書き、エミュレーション側が約 1 秒毎に読んで戻す
+static SDL_atomic_t pcm_win_cb, pcm_win_underrun, pcm_win_ivsum, pcm_win_ivmax, pcm_win_ringmin, pcm_win_ringmax;
+static long long pcm_last_cb = -1;		// コールバックのみ
+
+// 外部 MIDI を音と揃えるための対応表（フレームは PSP の複製後のデバイス単位）
+//   エミュレーション側: sink に来たフレーム数とリングに書けたフレーム数の差
+//   コールバック側  : 取り出したフレーム数と、その時のホスト時刻
+static SDL_SpinLock pcm_lock = 0;
+static unsigned long long pcm_ticks = 0;	// DSound_Send0 に渡った 10MHz クロック
+static long long pcm_sunk = 0, pcm_written = 0;
+static long long pcm_anchor_ticks = 0, pcm_offset = 0;
+static long long pcm_consumed = 0;
+static long long pcm_cb_frame = 0, pcm_cb_time = -1;
+static DWORD pcm_rate = 0;
+static long long pcm_latency = 0;		// デバイス側のバッファ (usec)
+
+#define PCM_USED(rd, wr)	(((wr) + PCMBUF_SIZE - (rd)) % PCMBUF_SIZE)
+
+static void pcm_sink(const short *buf, DWORD length);
+static void pcm_anchor(void);
+static DWORD pcm_clock(void);
+
+static DWORD pcm_frames_pow2(DWORD frames)
+{
+	DWORD samples = 256;
+
+	while (samples < 4096 && samples < frames)
+		samples <<= 1;
+	return samples;
+}
+
+// リングの目標量を決める（1 回のコールバック分 .. 4 回分）
+static void pcm_set_target(DWORD target)
+{
+	DWORD cb = pcm_samples * 4;
+
+	if (target < cb)
+		target = cb;
+	if (target > cb * 4)
+		target = cb * 4;
+	pcm_target = target & ~3;
+	// 初期値 (1.5 回分) の時に上限が 4 回分になるよう、目標 + 2.5 回分まで溜める
+	pcm_limit = pcm_target + cb * 5 / 2;
+	if (pcm_limit > PCMBUF_SIZE - 4)
+		pcm_limit = PCMBUF_SIZE - 4;
+	SDL_AtomicSet(&pcm_prime, (int)pcm_target);
+}
+
+// -----------------------------------------------------------------------
+//   デバイスを開く（実行中の開き直しでもリングの中身はそのまま）
+// -----------------------------------------------------------------------
+static int pcm_open(DWORD samples)
+{
+	SDL_AudioSpec obtained;
+
+	pcm_spec.samples = samples;
+	audio_device_id = SDL_OpenAudioDevice(NULL, 0, &pcm_spec, &obtained, 0);
+	if (audio_device_id == 0) {
+		fprintf(stderr, "SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
+		return FALSE;
+	}
+
+	pcm_rate = obtained.freq;
+	pcm_samples = obtained.samples;
+	SDL_AtomicLock(&pcm_lock);
+	pcm_latency = (long long)obtained.samples * 1000000 / obtained.freq;
+	pcm_cb_time = -1;
+	SDL_AtomicUnlock(&pcm_lock);
+	pcm_last_cb = -1;
+	pcm_primed = 0;
+
+	// 初回は 1 回のコールバック分 + 半分溜まってから鳴らし始める
+	pcm_set_target((pcm_target) ? pcm_target : pcm_samples * 4 * 3 / 2);
+
+	SDL_AtomicSet(&pcm_win_cb, 0);
+	SDL_AtomicSet(&pcm_win_underrun, 0);
+	SDL_AtomicSet(&pcm_win_ivsum, 0);
+	SDL_AtomicSet(&pcm_win_ivmax, 0);
+	SDL_AtomicSet(&pcm_win_ringmin, PCMBUF_SIZE);
+	SDL_AtomicSet(&pcm_win_ringmax, 0);
+
+	pcm_stats.rate = pcm_rate;
+	pcm_stats.samples = pcm_samples;
+	return TRUE;
+}
+
+// 開けなかった時は元の大きさで開き直し、その大きさはもう試さない
+static void pcm_reopen(DWORD samples)
+{
+	DWORD prev = pcm_samples;
+
+	SDL_CloseAudioDevice(audio_device_id);
+	audio_device_id = 0;
+	if (pcm_open(samples)) {
+		pcm_stats.reopens++;
+	} else {
+		p6logd("DSound: can't reopen with %u samples, back to %u\n",
+		    (unsigned int)samples, (unsigned int)prev);
+		if (samples > prev)
+			pcm_max_samples = prev;
+		else
+			pcm_floor = prev;
+		if (!pcm_open(prev)) {
+			p6logd("DSound: audio device lost\n");
+			return;
+		}
+	}
+	if (playing)
+		SDL_PauseAudioDevice(audio_device_id, 0);
+}
+
+// -----------------------------------------------------------------------
+//   約 1 秒毎に統計を締めて、バッファを詰めるか広げるか決める
+// -----------------------------------------------------------------------
+static void pcm_adapt(void)
+{
+	DWORD cbs, under, ivsum, ivmax, ringmin, ringmax, cb, ms;
+
+	cbs = SDL_AtomicGet(&pcm_win_cb);
+	if (cbs == 0 || cbs < pcm_rate / pcm_samples)
+		return;
+	SDL_AtomicSet(&pcm_win_cb, 0);
+	under = SDL_AtomicSet(&pcm_win_underrun, 0);
+	ivsum = SDL_AtomicSet(&pcm_win_ivsum, 0);
+	ivmax = SDL_AtomicSet(&pcm_win_ivmax, 0);
+	ringmin = SDL_AtomicSet(&pcm_win_ringmin, PCMBUF_SIZE);
+	ringmax = SDL_AtomicSet(&pcm_win_ringmax, 0);
+
+	cb = pcm_samples * 4;
+	ms = pcm_rate * 4 / 1000;
+	pcm_stats.callbacks += cbs;
+	pcm_stats.underruns += under;
+	pcm_stats.drops = pcm_drop;
+	pcm_stats.interval_avg_us = ivsum / cbs;
+	pcm_stats.interval_max_us = ivmax;
+	pcm_stats.ring_min_ms = (ringmin < PCMBUF_SIZE) ? ringmin / ms : 0;
+	pcm_stats.ring_max_ms = ringmax / ms;
+	pcm_stats.target_ms = pcm_target / ms;
+
+	if (!pcm_adaptive)
+		return;
+
+	if (under) {
+		// 途切れた: まずリングを、それでも駄目ならデバイスのバッファを広げる
+		pcm_stable = 0;
+		if (pcm_hold < 60)
+			pcm_hold *= 2;
+		if (pcm_target < cb * 4) {
+			pcm_set_target(pcm_target + cb / 2);
+		} else if (pcm_samples < pcm_max_samples) {
+			pcm_floor = pcm_samples * 2;
+			pcm_reopen(pcm_samples * 2);
+		} else {
+			return;
+		}
+	} else if (++pcm_stable >= pcm_hold && ringmin < PCMBUF_SIZE && ringmin > cb + cb / 2 && pcm_target > cb) {
+		// 一番少ない時でもコールバック半回分以上余っていれば詰める
+		pcm_set_target(pcm_target - cb / 4);
+		pcm_stable = 0;
+	} else if (pcm_stable >= 10 && pcm_target <= cb && pcm_samples > pcm_floor) {
+		pcm_reopen(pcm_samples / 2);
+		pcm_stable = 0;
+	} else {
+		return;
+	}
+	p6logd("DSound: device %u samples, ring %u ms (%u underruns, min ring %u ms)\n",
+	    (unsigned int)pcm_samples, (unsigned int)(pcm_target / ms),
+	    (unsigned int)under, (unsigned int)pcm_stats.ring_min_ms);
+}
+
 int
 DSound_Init(unsigned long rate, unsigned long buflen)
 {
-	SDL_AudioSpec fmt, obtained;
-	DWORD samples;
-
 	if (playing) {
 		return FALSE;
 	}
@@ -68,34 +265,58 @@ DSound_Init(unsigned long rate, unsigned long buflen)
 
 	ratebase = rate;
 
-	// この値を小さくした方が音の遅延は少なくなるが負荷があがる
-	samples = 2048;
+	// コールバックは生成をしないので、buflen (ms) に合わせて小さくできる
+	// BufferMin が buflen より小さければ、その間で自動調整する
+	pcm_max_samples = pcm_frames_pow2(rate * buflen / 1000);
+	pcm_min_samples = pcm_frames_pow2(rate * Config.BufferMin / 1000);
+	if (pcm_min_samples > pcm_max_samples)
+		pcm_min_samples = pcm_max_samples;
+	pcm_adaptive = (pcm_min_samples < pcm_max_samples);
+	pcm_floor = pcm_min_samples;
 
-	memset(&fmt, 0, sizeof(fmt));
+	memset(&pcm_spec, 0, sizeof(pcm_spec));
 #ifdef PSP
 	// PSPは常に44kを要求するので、rateが22Kの場合はデータを2倍にする
 	// r0, l0, r1, l1, ... -> r0, l0, r0, l0, r1, l1, r1, l1, ...
-	fmt.freq = 44100;
+	pcm_spec.freq = 44100;
 #else
-	fmt.freq = rate;
+	pcm_spec.freq = rate;
 #endif
-	fmt.format = AUDIO_S16SYS;
-	fmt.channels = 2;
-	fmt.samples = samples;
-	fmt.callback = sdlaudio_callback;
-#ifdef PSP
-	fmt.userdata = (void *)(uintptr_t)rate;
-#else
-	fmt.userdata = NULL;
+	pcm_spec.format = AUDIO_S16SYS;
+	pcm_spec.channels = 2;
+	pcm_spec.callback = sdlaudio_callback;
+	pcm_spec.userdata = NULL;
+
+	SDL_AtomicSet(&pcm_rd, 0);
+	SDL_AtomicSet(&pcm_wr, 0);
+	pcm_primed = 0;
+	pcm_drop = pcm_underrun = 0;
+	pcm_written = pcm_consumed = 0;
+	pcm_cb_time = -1;
+	memset(&pcm_stats, 0, sizeof(pcm_stats));
+	pcm_stable = 0;
+	pcm_hold = 3;
+	pcm_target = 0;
+
+	// 最初は今まで通り buflen の大きさで開き、小さい方へ詰めていく
+	pcm_open(pcm_max_samples);
+
+	// 途中で開き直しても、sink のフレーム番号はエミュレーション時刻に合わせる
+	pcm_sunk = (long long)(pcm_ticks * pcm_rate / 10000000);
+	pcm_anchor();
+
+	// 音源はミキサーに int32 で描かせ、合算後に一度だけクリップする
+	// DMA を読む ADPCM/Mercury はその場で、FM チップはワーカーで描く
+	Mixer_Init(pcm_sink, Config.SoundThreads);
+	Mixer_SetClock(pcm_clock);
+	Mixer_AddSource(ADPCM_Update, MIXER_UNITY);
+	OPM_SetMixer(Mixer_AddChip(OPM_Update, OPM_WriteReg, MIXER_UNITY));
+#ifndef	NO_MERCURY
+	Mixer_AddSource(Mcry_Update, MIXER_UNITY);
+	M288_SetMixer(Mixer_AddChip(M288_UpdateA, M288_WriteRegA, MIXER_UNITY),
+		      Mixer_AddChip(M288_UpdateB, M288_WriteRegB, MIXER_UNITY));
 #endif
 
-	// Use SDL2 modern audio device API
-	audio_device_id = SDL_OpenAudioDevice(NULL, 0, &fmt, &obtained, 0);
-	if (audio_device_id == 0) {
-		fprintf(stderr, "SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
-		return FALSE;
-	}
-
 	playing = TRUE;
 	return TRUE;
 }
@@ -117,48 +338,123 @@ DSound_Stop(void)
 int
 DSound_Cleanup(void)
 {
+	Mixer_Cleanup();
+	OPM_SetMixer(-1);
+#ifndef	NO_MERCURY
+	M288_SetMixer(-1, -1);
+#endif
 	playing = FALSE;
 	if (audio_device_id > 0) {
 		SDL_CloseAudioDevice(audio_device_id);
 		audio_device_id = 0;
 	}
+	if (pcm_stats.callbacks)
+		p6logd("DSound: %u samples + %u ms ring, %u callbacks (avg %u us, max %u us), %u underruns, %u bytes dropped, %u reopens\n",
+		    (unsigned int)pcm_stats.samples, (unsigned int)pcm_stats.target_ms,
+		    (unsigned int)pcm_stats.callbacks, (unsigned int)pcm_stats.interval_avg_us,
+		    (unsigned int)pcm_stats.interval_max_us, (unsigned int)pcm_underrun,
+		    (unsigned int)pcm_drop, (unsigned int)pcm_stats.reopens);
 	return TRUE;
 }
 
-static void sound_send(int length)
+// -----------------------------------------------------------------------
+//   エミュレーションスレッドからのみ呼ばれる（リングの唯一の書き手）
+// -----------------------------------------------------------------------
+static void pcm_sink(const short *buf, DWORD length)
 {
-	int rate;
+	DWORD rd, wr, bytes, first;
+	int rep = 1;
 
 #ifdef PSP
-	rate = Config.SampleRate;
-#else
-	rate = 0;
-#endif
-	SDL_LockAudioDevice(audio_device_id);
-	ADPCM_Update((short *)pbwp, length, rate, pbsp, pbep);
-	OPM_Update((short *)pbwp, length, rate, pbsp, pbep);
-#ifndef	NO_MERCURY
-	//Mcry_Update((short *)pcmbufp, length);
+	// 44.1kHz に合わせて各フレームを 2/4 回書く
+	if (Config.SampleRate == 22050) rep = 2;
+	else if (Config.SampleRate == 11025) rep = 4;
 #endif
-#ifdef PSP
-	pbwp += length * sizeof(WORD) * 2 * (44100 / rate);
-	if (pbwp >= pbep) {
-		pbwp = pbsp + (pbwp - pbep);
+	bytes = length * sizeof(WORD) * 2 * rep;
+	if (bytes > PCMBUF_SIZE - 4)
+		return;
+
+	// 録音は捨てる分も含めて、複製前のフレームで
+	Recorder_Audio((const BYTE *)buf, length * sizeof(WORD) * 2);
+
+	rd = SDL_AtomicGet(&pcm_rd);
+	wr = SDL_AtomicGet(&pcm_wr);
+	pcm_sunk += length * rep;
+	if (PCM_USED(rd, wr) + bytes > pcm_limit) {
+		// 溜まりすぎ: 音源の状態は進めたので捨てる
+		pcm_drop += bytes;
+		pcm_anchor();
+		return;
 	}
-#else
-	pbwp += length * sizeof(WORD) * 2;
-	if (pbwp >= pbep) {
-		pbwp = pbsp + (pbwp - pbep);
+
+	if (rep == 1) {
+		first = PCMBUF_SIZE - wr;
+		if (first > bytes)
+			first = bytes;
+		memcpy(pcmbuffer + wr, buf, first);
+		if (bytes > first)
+			memcpy(pcmbuffer, (const BYTE *)buf + first, bytes - first);
+	} else {
+		DWORD i, w = wr;
+		int k;
+		for (i = 0; i < length; i++) {
+			for (k = 0; k < rep; k++) {
+				memcpy(pcmbuffer + w, buf + i * 2, sizeof(WORD) * 2);
+				w = (w + sizeof(WORD) * 2) % PCMBUF_SIZE;
+			}
+		}
 	}
-#endif
-	SDL_UnlockAudioDevice(audio_device_id);
+	SDL_AtomicSet(&pcm_wr, (wr + bytes) % PCMBUF_SIZE);
+	pcm_written += length * rep;
+	pcm_anchor();
+}
+
+static void pcm_anchor(void)
+{
+	SDL_AtomicLock(&pcm_lock);
+	pcm_anchor_ticks = (long long)pcm_ticks;
+	pcm_offset = pcm_sunk - pcm_written;
+	SDL_AtomicUnlock(&pcm_lock);
+}
+
+// -----------------------------------------------------------------------
+//   エミュレーション上の時刻 usec（32bit で一周）の音が実際に鳴るホスト時刻
+//   (SDL_GetPerformanceCounter 基準の usec)。まだ鳴っていなければ -1
+// -----------------------------------------------------------------------
+long long DSound_HostTime(DWORD usec)
+{
+	long long ticks, offset, cb_frame, cb_time, emu, frame;
+
+	if (audio_device_id == 0)
+		return -1;
+	SDL_AtomicLock(&pcm_lock);
+	ticks = pcm_anchor_ticks;
+	offset = pcm_offset;
+	cb_frame = pcm_cb_frame;
+	cb_time = pcm_cb_time;
+	SDL_AtomicUnlock(&pcm_lock);
+	if (cb_time < 0)
+		return -1;
+
+	// 近くの基準から一周分を補って、リング上のフレーム位置へ
+	emu = ticks / 10 + (int)(usec - (DWORD)(ticks / 10));
+	frame = emu * (long long)pcm_rate / 1000000 - offset;
+	return cb_time + (frame - cb_frame) * 1000000 / pcm_rate + pcm_latency;
+}
+
+// -----------------------------------------------------------------------
+//   ライン途中の書き込み位置: 今 DSound_Send0 を呼んだら出るフレーム数
+// -----------------------------------------------------------------------
+static DWORD pcm_clock(void)
+{
+	return (DWORD)((DSound_PreCounter + ratebase * WinX68k_GetLineClock()) / 10000000L);
 }
 
 void FASTCALL DSound_Send0(long clock)
 {
 	int length = 0;
-	int rate;
 
+	pcm_ticks += clock;
 	if (audio_device_id == 0) {
 		return;
 	}
@@ -171,107 +467,83 @@ void FASTCALL DSound_Send0(long clock)
 	if (length == 0) {
 		return;
 	}
-	sound_send(length);
+	Mixer_Mix(length);
 }
 
-static void FASTCALL DSound_Send(int length)
+// -----------------------------------------------------------------------
+//   フレームの終わりに呼ぶ: 溜めたチップの描画をワーカーに渡す
+// -----------------------------------------------------------------------
+void DSound_Flush(void)
 {
 	if (audio_device_id == 0) {
 		return;
 	}
-	sound_send(length);
+	Mixer_Flush();
+	pcm_adapt();
 }
 
+// -----------------------------------------------------------------------
+//   オーディオスレッド: リングから取り出すだけ（エミュレーションは呼ばない）
+// -----------------------------------------------------------------------
 static void
 sdlaudio_callback(void *userdata, unsigned char *stream, int len)
 {
-	int lena, lenb, datalen, rate;
-	BYTE *buf;
-	static DWORD bef;
-	DWORD now;
+	DWORD rd, wr, used, n, first;
+	long long now = (long long)(SDL_GetPerformanceCounter() * 1000000.0 / SDL_GetPerformanceFrequency());
 
-	now = timeGetTime();
+	// SDL2.0ではstream bufferのクリアが必要
+	memset(stream, 0, len);
 
-#ifdef PSP
-	rate = (int)userdata;
-#endif
+	// このバッファの先頭がこれから鳴る位置
+	SDL_AtomicLock(&pcm_lock);
+	pcm_cb_frame = pcm_consumed;
+	pcm_cb_time = now;
+	SDL_AtomicUnlock(&pcm_lock);
+
+	// 呼ばれる間隔
+	if (pcm_last_cb >= 0) {
+		DWORD iv = (DWORD)(now - pcm_last_cb);
+		SDL_AtomicAdd(&pcm_win_ivsum, (int)iv);
+		if (iv > (DWORD)SDL_AtomicGet(&pcm_win_ivmax))
+			SDL_AtomicSet(&pcm_win_ivmax, (int)iv);
+	}
+	pcm_last_cb = now;
+	SDL_AtomicAdd(&pcm_win_cb, 1);
 
-cb_start:
-	if (pbrp <= pbwp) {
-		// pcmbuffer
-		// +---------+-------------+----------+
-		// |         |/////////////|          |
-		// +---------+-------------+----------+
-		// A         A<--datalen-->A          A
-		// |         |             |          |
-		// pbsp     pbrp          pbwp       pbep
-
-		datalen = pbwp - pbrp;
-		if (datalen < len) {
-			// needs more data
-#ifdef PSP
-			DSound_Send((len - datalen) / 4 / (44100 / rate));
-#else
-			DSound_Send((len - datalen) / 4);
-#endif
-		}
-#if 0
-		datalen = pbwp - pbrp;
-		if (datalen < len) {
-			printf("xxxxx not enough sound data xxxxx\n");
-		}
-#endif
-		if (pbrp > pbwp) {
-			// chage to TYPEC or TYPED
-			goto cb_start;
-		}
+	rd = SDL_AtomicGet(&pcm_rd);
+	wr = SDL_AtomicGet(&pcm_wr);
+	used = PCM_USED(rd, wr);
 
-		buf = pbrp;
-		pbrp += len;
-		//printf("TYPEA: ");
+	if (!pcm_primed) {
+		if (used < (DWORD)SDL_AtomicGet(&pcm_prime))
+			return;
+		pcm_primed = 1;
+	}
 
-	} else {
-		// pcmbuffer
-		// +---------+-------------+----------+
-		// |/////////|             |//////////|
-		// +------+--+-------------+----------+
-		// <-lenb->  A             <---lena--->
-		// A         |             A          A
-		// |         |             |          |
-		// pbsp     pbwp          pbrp       pbep
-
-		lena = pbep - pbrp;
-		if (lena >= len) {
-			buf = pbrp;
-			pbrp += len;
-			//printf("TYPEC: ");
-		} else {
-			lenb = len - lena;
-			if (pbwp - pbsp < lenb) {
-#ifdef PSP
-				DSound_Send((lenb - (pbwp - pbsp)) / 4 / (44100 / rate));
-#else
-				DSound_Send((lenb - (pbwp - pbsp)) / 4);
-#endif
-			}
-#if 0
-			if (pbwp - pbsp < lenb) {
-				printf("xxxxx not enough sound data xxxxx\n");
-			}
-#endif
-			memcpy(sdlsndbuf, pbrp, lena);
-			memcpy(&sdlsndbuf[lena], pbsp, lenb);
-			buf = sdlsndbuf;
-			pbrp = pbsp + lenb;
-			//printf("TYPED: ");
-		}
+	// 鳴らしている間の残量の最小値（詰められるかの目安）
+	if (used < (DWORD)SDL_AtomicGet(&pcm_win_ringmin))
+		SDL_AtomicSet(&pcm_win_ringmin, (int)used);
+	if (used > (DWORD)SDL_AtomicGet(&pcm_win_ringmax))
+		SDL_AtomicSet(&pcm_win_ringmax, (int)used);
+
+	n = (used < (DWORD)len) ? used : (DWORD)len;
+	n &= ~3;
+	if (n < (DWORD)len) {
+		// 足りない分は無音、次は溜まるまで待つ
+		pcm_underrun++;
+		SDL_AtomicAdd(&pcm_win_underrun, 1);
+		pcm_primed = 0;
 	}
 
-	// SDL2.0ではstream bufferのクリアが必要
-	memset(stream, 0, len);
-	SDL_MixAudioFormat(stream, buf, AUDIO_S16SYS, len, SDL_MIX_MAXVOLUME);
+	first = PCMBUF_SIZE - rd;
+	if (first > n)
+		first = n;
+	memcpy(stream, pcmbuffer + rd, first);
+	if (n > first)
+		memcpy(stream + first, pcmbuffer, n - first);
 
-	bef = now;
+	SDL_AtomicSet(&pcm_rd, (rd + n) % PCMBUF_SIZE);
+	pcm_consumed += n / 4;
 }
 
 #else	/* NOSOUND */
@@ -301,4 +573,15 @@ void FASTCALL
 DSound_Send0(long clock)
 {
 }
+
+void
+DSound_Flush(void)
+{
+}
+
+long long
+DSound_HostTime(DWORD usec)
+{
+	return -1;
+}
 #endif	/* !NOSOUND */
@@ -9,6 +9,8 @@ int DSound_Cleanup(void);
 void DSound_Play(void);
 void DSound_Stop(void);
 void FASTCALL DSound_Send0(long clock);
+void DSound_Flush(void);
+long long DSound_HostTime(DWORD usec);
 
 void DS_SetVolumeOPM(long vol);
 void DS_SetVolumeADPCM(long vol);
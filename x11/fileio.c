@@ -0,0 +1,595 @@
+// -----------------------------------------------------------------------
+//   File_* (dosio の上に、ディスクイメージ用のオーバーレイを被せる)
+// -----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include "common.h"
+#include "fileio.h"
+#include "packimg.h"
+
+// オーバーレイファイル:
+//   0x000  "X68KOVL1"
+//   0x008  ブロックサイズ
+//   0x00c  元のイメージのサイズ（違うイメージに被せないよう、開く時に照合する）
+//   0x010  イメージのサイズ（元より後ろに書けば伸びる）
+//   0x014  ビットマップのブロック数
+//   0x200  割り当てビットマップ（1 = このブロックはオーバーレイ側にある）
+//   その後ろ、ブロックサイズ境界から各ブロックの置き場（ブロック b は data+b*bs、疎ファイル）
+#define OVL_MAGIC	"X68KOVL1"
+#define OVL_BLOCK	4096
+#define OVL_BITMAP	0x200
+#define OVL_MAX		32		// 同時に開けるオーバーレイ（ハンドルも同じ数まで）
+
+// ビットマップのブロック数（元より少し大きくなるイメージ（D88 の再フォーマット等）の分も取っておく）
+#define OVL_BASEBLOCKS(sz)	(((sz) + OVL_BLOCK - 1) / OVL_BLOCK)
+#define OVL_MAXBLOCKS(sz)	(OVL_BASEBLOCKS(sz) + OVL_BASEBLOCKS(sz) / 4 + 16)
+
+// 圧縮イメージ（packimg.h）もここで開く。オーバーレイを使わない時は fd = -1 で読むだけ
+// 同じイメージを複数開いた時は 1 つを参照数で共有し、位置だけハンドル毎に持つ
+typedef struct {
+	int	base;			// 元のイメージ（読み出し専用）
+	PACK_IMAGE *pack;		// 元のイメージが圧縮イメージの時はこちら
+	int	fd;			// オーバーレイ
+	char	path[MAX_PATH];		// 元のイメージ
+	int	refs;
+	DWORD	size;
+	DWORD	basesize;
+	DWORD	blocks;
+	DWORD	data;			// ブロック置き場の先頭
+	BYTE	*bitmap;
+	BYTE	*tmp;			// ブロック 1 つ分の作業用
+} FILE_OVERLAY;
+
+typedef struct {
+	FILE_OVERLAY *ovl;
+	DWORD	pos;
+} OVL_HANDLE;
+
+static FILE_OVERLAY *Overlays[OVL_MAX];
+static OVL_HANDLE *Handles[OVL_MAX];
+static char OverlayDir[MAX_PATH] = "";
+
+
+static void put32(BYTE *p, DWORD v)
+{
+	p[0] = (BYTE)v;
+	p[1] = (BYTE)(v >> 8);
+	p[2] = (BYTE)(v >> 16);
+	p[3] = (BYTE)(v >> 24);
+}
+
+static DWORD get32(const BYTE *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static OVL_HANDLE* ovl_find(FILEH h)
+{
+	int i;
+
+	for (i = 0; i < OVL_MAX; i++) {
+		if (Handles[i] && (FILEH)Handles[i] == h)
+			return Handles[i];
+	}
+	return NULL;
+}
+
+static FILE_OVERLAY* ovl_find_path(const char *path)
+{
+	int i;
+
+	for (i = 0; i < OVL_MAX; i++) {
+		if (Overlays[i] && !strcmp(Overlays[i]->path, path))
+			return Overlays[i];
+	}
+	return NULL;
+}
+
+// <dir>/<イメージのファイル名>.<フルパスのハッシュ>.ovl（MAX_PATH に収まらなければ FALSE）
+// 別のディレクトリにある同じ名前・同じサイズのイメージが 1 つのオーバーレイを共有しないように
+static int ovl_name(const char *path, char *buf)
+{
+	char full[PATH_MAX];
+	const char *p = strrchr(path, '/');
+	const BYTE *s;
+	DWORD hash = 2166136261U;	// FNV-1a
+
+	s = (const BYTE*)(realpath(path, full) ? full : path);
+	while (*s)
+		hash = (hash ^ *s++) * 16777619U;
+	if (snprintf(buf, MAX_PATH, "%s/%s.%08x.ovl", OverlayDir, p ? p + 1 : path, (unsigned int)hash) >= MAX_PATH) {
+		fprintf(stderr, "Overlay: path too long for %s\n", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int ovl_write_header(FILE_OVERLAY *o)
+{
+	BYTE hdr[24];
+
+	memcpy(hdr, OVL_MAGIC, 8);
+	put32(hdr + 8, OVL_BLOCK);
+	put32(hdr + 12, o->basesize);
+	put32(hdr + 16, o->size);
+	put32(hdr + 20, o->blocks);
+	return (pwrite(o->fd, hdr, sizeof(hdr), 0) == sizeof(hdr));
+}
+
+static int ovl_allocated(FILE_OVERLAY *o, DWORD b)
+{
+	if (b >= o->blocks)
+		return 0;
+	return (o->bitmap[b >> 3] >> (b & 7)) & 1;
+}
+
+// 元のイメージ側のブロックの中身（元より後ろは 0）
+static int ovl_read_base(FILE_OVERLAY *o, DWORD b, BYTE *buf)
+{
+	DWORD ofs = b * OVL_BLOCK, len = 0;
+
+	memset(buf, 0, OVL_BLOCK);
+	if (ofs < o->basesize) {
+		len = o->basesize - ofs;
+		if (len > OVL_BLOCK)
+			len = OVL_BLOCK;
+		if (o->pack) {
+			if (PackImg_Read(o->pack, ofs, buf, len) != len)
+				return FALSE;
+		} else if (pread(o->base, buf, len, ofs) != (ssize_t)len) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// 空のオーバーレイにする（ファイルはヘッダとビットマップだけに切り詰める）
+static int ovl_reset(FILE_OVERLAY *o)
+{
+	memset(o->bitmap, 0, (o->blocks + 7) / 8);
+	o->size = o->basesize;
+	if (ftruncate(o->fd, 0) < 0)
+		return FALSE;
+	if (!ovl_write_header(o))
+		return FALSE;
+	return (pwrite(o->fd, o->bitmap, (o->blocks + 7) / 8, OVL_BITMAP) == (ssize_t)((o->blocks + 7) / 8));
+}
+
+static void ovl_free(FILE_OVERLAY *o)
+{
+	int i;
+
+	for (i = 0; i < OVL_MAX; i++) {
+		if (Overlays[i] == o)
+			Overlays[i] = NULL;
+	}
+	if (o->base >= 0)
+		close(o->base);
+	PackImg_Close(o->pack);
+	if (o->fd >= 0)
+		close(o->fd);
+	free(o->bitmap);
+	free(o->tmp);
+	free(o);
+}
+
+// 参照を 1 つ外し、最後なら閉じる
+static void ovl_release(FILE_OVERLAY *o)
+{
+	if (--o->refs <= 0)
+		ovl_free(o);
+}
+
+// 既に開いているイメージならそれを共有する（別々に開くとオーバーレイを壊し合うので）
+static FILE_OVERLAY* ovl_open(const char *path)
+{
+	FILE_OVERLAY *o;
+	char name[MAX_PATH];
+	BYTE hdr[24];
+	off_t len;
+	DWORD bmsize;
+	int i, fresh = 0;
+
+	o = ovl_find_path(path);
+	if (o) {
+		o->refs++;
+		return o;
+	}
+	if (strlen(path) >= MAX_PATH)
+		return NULL;
+	for (i = 0; i < OVL_MAX; i++) {
+		if (!Overlays[i])
+			break;
+	}
+	if (i == OVL_MAX)
+		return NULL;
+
+	o = (FILE_OVERLAY*)calloc(1, sizeof(FILE_OVERLAY));
+	if (!o)
+		return NULL;
+	o->fd = -1;
+	o->base = -1;
+	o->refs = 1;
+	strncpy(o->path, path, MAX_PATH - 1);
+	if (PackImg_IsPacked(path)) {
+		o->pack = PackImg_Open(path);
+		if (!o->pack)
+			goto ovl_error;
+		o->basesize = PackImg_Size(o->pack);
+	} else {
+		o->base = open(path, O_RDONLY);
+		if (o->base < 0)
+			goto ovl_error;
+		len = lseek(o->base, 0, SEEK_END);
+		if (len < 0)
+			goto ovl_error;
+		o->basesize = (DWORD)len;
+	}
+	o->size = o->basesize;
+	o->tmp = (BYTE*)malloc(OVL_BLOCK);
+	if (!o->tmp)
+		goto ovl_error;
+	if (!OverlayDir[0]) {
+		// 圧縮イメージをそのまま開く（書き込みはできない）
+		Overlays[i] = o;
+		return o;
+	}
+
+	if (!ovl_name(path, name))
+		goto ovl_error;
+	o->fd = open(name, O_RDWR | O_CREAT, 0644);
+	if (o->fd < 0) {
+		fprintf(stderr, "Overlay: can't open %s (%s)\n", name, strerror(errno));
+		goto ovl_error;
+	}
+	if (pread(o->fd, hdr, sizeof(hdr), 0) == sizeof(hdr)) {
+		if (memcmp(hdr, OVL_MAGIC, 8) || get32(hdr + 8) != OVL_BLOCK ||
+		    get32(hdr + 12) != o->basesize) {
+			fprintf(stderr, "Overlay: %s doesn't belong to %s\n", name, path);
+			goto ovl_error;
+		}
+		o->size = get32(hdr + 16);
+		o->blocks = get32(hdr + 20);
+		// ビットマップはイメージの全体を覆い、新規に作る時の予備（元の 1/4 + 16）より大きくはならない
+		if (o->blocks < OVL_BASEBLOCKS(o->size) ||
+		    o->blocks > OVL_MAXBLOCKS(o->basesize)) {
+			fprintf(stderr, "Overlay: %s has a broken header\n", name);
+			goto ovl_error;
+		}
+	} else {
+		// 新規（または切り詰めて空にしたもの）
+		o->blocks = OVL_MAXBLOCKS(o->basesize);
+		fresh = 1;
+	}
+	bmsize = (o->blocks + 7) / 8;
+	o->data = (OVL_BITMAP + bmsize + OVL_BLOCK - 1) & ~(OVL_BLOCK - 1);
+	o->bitmap = (BYTE*)calloc(1, bmsize);
+	if (!o->bitmap)
+		goto ovl_error;
+
+	if (fresh) {
+		if (!ovl_reset(o))
+			goto ovl_error;
+	} else if (pread(o->fd, o->bitmap, bmsize, OVL_BITMAP) < 0) {
+		goto ovl_error;
+	}
+
+	Overlays[i] = o;
+	return o;
+
+ovl_error:
+	ovl_free(o);
+	return NULL;
+}
+
+// pos から length バイト
+static DWORD ovl_pread(FILE_OVERLAY *o, DWORD pos, BYTE *buf, DWORD length)
+{
+	DWORD done = 0, b, ofs, n;
+
+	if (pos >= o->size)
+		return 0;
+	if (length > o->size - pos)
+		length = o->size - pos;
+
+	while (done < length) {
+		b = pos / OVL_BLOCK;
+		ofs = pos % OVL_BLOCK;
+		n = OVL_BLOCK - ofs;
+		if (n > length - done)
+			n = length - done;
+		if (ovl_allocated(o, b)) {
+			if (pread(o->fd, buf, n, o->data + b * OVL_BLOCK + ofs) != (ssize_t)n)
+				break;
+		} else {
+			if (!ovl_read_base(o, b, o->tmp))
+				break;
+			memcpy(buf, o->tmp + ofs, n);
+		}
+		buf += n;
+		done += n;
+		pos += n;
+	}
+	return done;
+}
+
+static DWORD ovl_pwrite(FILE_OVERLAY *o, DWORD pos, const BYTE *buf, DWORD length)
+{
+	DWORD done = 0, b, ofs, n;
+
+	if (o->fd < 0)
+		return 0;
+	while (done < length) {
+		b = pos / OVL_BLOCK;
+		ofs = pos % OVL_BLOCK;
+		n = OVL_BLOCK - ofs;
+		if (n > length - done)
+			n = length - done;
+		if (b >= o->blocks) {
+			fprintf(stderr, "Overlay: write past the end of %s's overlay (offset %u), dropped\n", o->path, (unsigned int)pos);
+			break;
+		}
+		if (ovl_allocated(o, b)) {
+			if (pwrite(o->fd, buf, n, o->data + b * OVL_BLOCK + ofs) != (ssize_t)n)
+				break;
+		} else {
+			// 初めて書くブロックは元の中身と合わせて丸ごと置く
+			// （中身が変わらない書き込みなら割り当てない。FDD は取り出し時に全部書き直すので）
+			if (!ovl_read_base(o, b, o->tmp))
+				break;
+			if (memcmp(o->tmp + ofs, buf, n)) {
+				memcpy(o->tmp + ofs, buf, n);
+				if (pwrite(o->fd, o->tmp, OVL_BLOCK, o->data + b * OVL_BLOCK) != OVL_BLOCK)
+					break;
+				o->bitmap[b >> 3] |= 1 << (b & 7);
+				if (pwrite(o->fd, &o->bitmap[b >> 3], 1, OVL_BITMAP + (b >> 3)) != 1)
+					break;
+			}
+		}
+		buf += n;
+		done += n;
+		pos += n;
+	}
+	if (pos > o->size) {
+		o->size = pos;
+		ovl_write_header(o);
+	}
+	return done;
+}
+
+static DWORD ovl_source(void *param, DWORD ofs, BYTE *buf, DWORD len)
+{
+	return ovl_pread((FILE_OVERLAY*)param, ofs, buf, len);
+}
+
+// 圧縮イメージへの確定は、オーバーレイ越しに見た中身で作り直して置き換える
+static int ovl_commit_pack(FILE_OVERLAY *o)
+{
+	char tmp[MAX_PATH + 4];
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", o->path);
+	if (!PackImg_Write(tmp, o->size, PackImg_BlockSize(o->pack), ovl_source, o)) {
+		unlink(tmp);
+		fprintf(stderr, "Overlay: commit to %s failed, overlay kept\n", o->path);
+		return FALSE;
+	}
+	if (rename(tmp, o->path) < 0) {
+		fprintf(stderr, "Overlay: can't replace %s (%s), overlay kept\n", o->path, strerror(errno));
+		unlink(tmp);
+		return FALSE;
+	}
+	PackImg_Close(o->pack);
+	o->pack = PackImg_Open(o->path);
+	if (!o->pack)
+		return FALSE;
+	o->basesize = o->size;
+	return ovl_reset(o);
+}
+
+// 割り当て済みのブロックを元のイメージに書き戻して、空のオーバーレイに戻す
+static int ovl_commit(FILE_OVERLAY *o)
+{
+	DWORD b, len;
+	int fd, ret = TRUE;
+
+	if (o->pack)
+		return ovl_commit_pack(o);
+	fd = open(o->path, O_WRONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Overlay: can't write %s (%s)\n", o->path, strerror(errno));
+		return FALSE;
+	}
+	for (b = 0; b < o->blocks; b++) {
+		if (!ovl_allocated(o, b) || b * OVL_BLOCK >= o->size)
+			continue;
+		len = o->size - b * OVL_BLOCK;
+		if (len > OVL_BLOCK)
+			len = OVL_BLOCK;
+		if (pread(o->fd, o->tmp, len, o->data + b * OVL_BLOCK) != (ssize_t)len ||
+		    pwrite(fd, o->tmp, len, b * OVL_BLOCK) != (ssize_t)len) {
+			ret = FALSE;
+			break;
+		}
+	}
+	if (ret && o->size > o->basesize) {
+		// 伸びた分で 0 のままのところ
+		if (ftruncate(fd, o->size) < 0)
+			ret = FALSE;
+	}
+	if (close(fd) < 0)
+		ret = FALSE;
+	if (!ret) {
+		fprintf(stderr, "Overlay: commit to %s failed, overlay kept\n", o->path);
+		return FALSE;
+	}
+	o->basesize = o->size;
+	return ovl_reset(o);
+}
+
+
+// -----------------------------------------------------------------------
+//   File_*
+// -----------------------------------------------------------------------
+FILEH File_Open(const char *filename)
+{
+	return file_open((LPSTR)filename);
+}
+
+FILEH File_OpenImage(const char *filename)
+{
+	OVL_HANDLE *h;
+	int i;
+
+	if (!OverlayDir[0] && !PackImg_IsPacked(filename))
+		return File_Open(filename);
+	for (i = 0; i < OVL_MAX; i++) {
+		if (!Handles[i])
+			break;
+	}
+	if (i == OVL_MAX)
+		return NULL;
+	h = (OVL_HANDLE*)calloc(1, sizeof(OVL_HANDLE));
+	if (!h)
+		return NULL;
+	h->ovl = ovl_open(filename);
+	if (!h->ovl) {
+		free(h);
+		return NULL;
+	}
+	Handles[i] = h;
+	return (FILEH)h;
+}
+
+DWORD File_Seek(FILEH handle, long pointer, short mode)
+{
+	OVL_HANDLE *h = ovl_find(handle);
+
+	if (!h)
+		return file_seek(handle, pointer, mode);
+	switch (mode) {
+	case FSEEK_SET:
+		h->pos = pointer;
+		break;
+	case FSEEK_CUR:
+		h->pos += pointer;
+		break;
+	case FSEEK_END:
+		h->pos = h->ovl->size + pointer;
+		break;
+	}
+	return h->pos;
+}
+
+DWORD File_Read(FILEH handle, void *data, DWORD length)
+{
+	OVL_HANDLE *h = ovl_find(handle);
+	DWORD done;
+
+	if (!h)
+		return file_lread(handle, data, length);
+	done = ovl_pread(h->ovl, h->pos, (BYTE*)data, length);
+	h->pos += done;
+	return done;
+}
+
+DWORD File_Write(FILEH handle, void *data, DWORD length)
+{
+	OVL_HANDLE *h = ovl_find(handle);
+	DWORD done;
+
+	if (!h)
+		return file_lwrite(handle, data, length);
+	done = ovl_pwrite(h->ovl, h->pos, (const BYTE*)data, length);
+	h->pos += done;
+	return done;
+}
+
+// 書き込めないイメージ（オーバーレイ無しで開いた圧縮イメージ）なら TRUE
+int File_IsReadOnly(FILEH handle)
+{
+	OVL_HANDLE *h = ovl_find(handle);
+
+	return (h && h->ovl->fd < 0);
+}
+
+short File_Close(FILEH handle)
+{
+	OVL_HANDLE *h = ovl_find(handle);
+	int i;
+
+	if (!h)
+		return file_close(handle);
+	for (i = 0; i < OVL_MAX; i++) {
+		if (Handles[i] == h)
+			Handles[i] = NULL;
+	}
+	ovl_release(h->ovl);
+	free(h);
+	return 0;
+}
+
+
+// -----------------------------------------------------------------------
+//   オーバーレイの設定・確定・破棄
+// -----------------------------------------------------------------------
+// dir: オーバーレイを置くディレクトリ（NULL か "" でオーバーレイを使わない）
+void File_SetOverlayDir(const char *dir)
+{
+	size_t len;
+
+	OverlayDir[0] = 0;
+	if (!dir)
+		return;
+	strncpy(OverlayDir, dir, MAX_PATH - 1);
+	OverlayDir[MAX_PATH - 1] = 0;
+	len = strlen(OverlayDir);
+	while (len > 1 && OverlayDir[len - 1] == '/')
+		OverlayDir[--len] = 0;
+}
+
+// filename のオーバーレイを元のイメージに書き込む（開いていればそのまま続けて使える）
+int File_OverlayCommit(const char *filename)
+{
+	FILE_OVERLAY *o;
+	char name[MAX_PATH];
+	int ret;
+
+	if (!OverlayDir[0] || !filename[0])
+		return FALSE;
+	o = ovl_find_path(filename);
+	if (o)
+		return ovl_commit(o);
+	if (!ovl_name(filename, name))
+		return FALSE;
+	if (access(name, F_OK) < 0)
+		return TRUE;
+	o = ovl_open(filename);
+	if (!o)
+		return FALSE;
+	ret = ovl_commit(o);
+	ovl_release(o);
+	return ret;
+}
+
+// filename のオーバーレイを捨てる（開いていなければ切り詰めるだけ）
+int File_OverlayDiscard(const char *filename)
+{
+	FILE_OVERLAY *o;
+	char name[MAX_PATH];
+
+	if (!OverlayDir[0] || !filename[0])
+		return FALSE;
+	o = ovl_find_path(filename);
+	if (o)
+		return ovl_reset(o);
+	if (!ovl_name(filename, name))
+		return FALSE;
+	if (truncate(name, 0) < 0 && errno != ENOENT)
+		return FALSE;
+	return TRUE;
+}
@@ -13,21 +13,33 @@
 LPSTR getFileName(LPSTR filename);
 //#define	getFileName	GetFileName
 
-FILEH	File_Open(BYTE *filename);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FILEH	File_Open(const char *filename);
 FILEH	File_Create(BYTE *filename);
 DWORD	File_Seek(FILEH handle, long pointer, short mode);
 DWORD	File_Read(FILEH handle, void *data, DWORD length);
 DWORD	File_Write(FILEH handle, void *data, DWORD length);
 short	File_Close(FILEH handle);
 short	File_Attr(BYTE *filename);
-#define	File_Open	file_open
 #define	File_Create	file_create
-#define	File_Seek	file_seek
-#define	File_Read	file_lread
-#define	File_Write	file_lwrite
-#define	File_Close	file_close
 #define	File_Attr	file_attr
 
+// ディスクイメージ用。オーバーレイを使う時は元のイメージは読むだけにして、
+// 書き込みは <dir>/<イメージ名>.<パスのハッシュ>.ovl に差分としてブロック単位で溜める
+FILEH	File_OpenImage(const char *filename);
+void	File_SetOverlayDir(const char *dir);
+int	File_OverlayCommit(const char *filename);
+int	File_OverlayDiscard(const char *filename);
+// 圧縮イメージ（packimg.h）も File_OpenImage で開ける。オーバーレイが無い時は書けない
+int	File_IsReadOnly(FILEH handle);
+
+#ifdef __cplusplus
+}
+#endif
+
 void	File_SetCurDir(BYTE *exename);
 FILEH	File_OpenCurDir(BYTE *filename);
 FILEH	File_CreateCurDir(BYTE *filename);
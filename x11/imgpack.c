@@ -0,0 +1,114 @@
+// -----------------------------------------------------------------------
+//   px68k-imgpack: ディスクイメージ <-> 圧縮イメージ（packimg.h）の変換
+//     本体は中身で圧縮イメージかどうかを見るので、拡張子（.hdf/.xdf 等）はそのままでよい
+// -----------------------------------------------------------------------
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "packimg.h"
+
+static DWORD read_raw(void *param, DWORD ofs, BYTE *buf, DWORD len)
+{
+	ssize_t n = pread(*(int*)param, buf, len, ofs);
+
+	return (n < 0) ? 0 : (DWORD)n;
+}
+
+static int pack(const char *in, const char *out, DWORD blocksize)
+{
+	struct stat st;
+	int fd, ret;
+
+	fd = open(in, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", in, strerror(errno));
+		return FALSE;
+	}
+	if (st.st_size > 0xffffffffLL) {
+		fprintf(stderr, "%s: too large\n", in);
+		close(fd);
+		return FALSE;
+	}
+	if (PackImg_IsPacked(in)) {
+		fprintf(stderr, "%s: already packed\n", in);
+		close(fd);
+		return FALSE;
+	}
+	ret = PackImg_Write(out, (DWORD)st.st_size, blocksize, read_raw, &fd);
+	close(fd);
+	if (ret && stat(out, &st) == 0)
+		printf("%s -> %s: %ld bytes\n", in, out, (long)st.st_size);
+	return ret;
+}
+
+static int unpack(const char *in, const char *out)
+{
+	PACK_IMAGE *p;
+	BYTE *buf;
+	DWORD ofs, n, size;
+	int fd, ret = TRUE;
+
+	p = PackImg_Open(in);
+	if (!p) {
+		fprintf(stderr, "%s: not a packed image\n", in);
+		return FALSE;
+	}
+	fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	buf = (BYTE*)malloc(PACK_BLOCK);
+	if (fd < 0 || !buf) {
+		fprintf(stderr, "%s: %s\n", out, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		free(buf);
+		PackImg_Close(p);
+		return FALSE;
+	}
+	size = PackImg_Size(p);
+	for (ofs = 0; ofs < size; ofs += n) {
+		n = PackImg_Read(p, ofs, buf, PACK_BLOCK);
+		if (n == 0 || write(fd, buf, n) != (ssize_t)n) {
+			fprintf(stderr, "%s: unpacking failed\n", in);
+			ret = FALSE;
+			break;
+		}
+	}
+	if (close(fd) < 0)
+		ret = FALSE;
+	free(buf);
+	PackImg_Close(p);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-b blocksize] <image> <packed>\n"
+		"       %s -d <packed> <image>\n"
+		"  -b  block size in bytes (default %d)\n"
+		"  -d  unpack\n", prog, prog, PACK_BLOCK);
+}
+
+int main(int argc, char *argv[])
+{
+	DWORD blocksize = PACK_BLOCK;
+	int c, decode = 0;
+
+	while ((c = getopt(argc, argv, "b:dh")) != -1) {
+		switch (c) {
+		case 'b': blocksize = strtoul(optarg, NULL, 0); break;
+		case 'd': decode = 1; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if (argc - optind != 2 || blocksize < 512 || blocksize > (1 << 20)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (decode)
+		return unpack(argv[optind], argv[optind + 1]) ? 0 : 1;
+	return pack(argv[optind], argv[optind + 1], blocksize) ? 0 : 1;
+}
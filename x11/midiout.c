@@ -0,0 +1,311 @@
+// -----------------------------------------------------------------------
+//   MIDI output backend (raw MIDI / ALSA rawmidi / file, sender thread)
+// -----------------------------------------------------------------------
+#include <stdlib.h>
+#include "common.h"
+#include <SDL.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include "midiout.h"
+
+#define MIDIOUT_HDR	6		// 時刻(4) + 長さ(2)
+#define MIDIOUT_MAXMSG	4096
+#define MIDIOUT_RETRY	1000000		// 読み手のいない FIFO を開き直す間隔 (usec)
+
+static int MidiFd = -1;			// 開けるまでは -1（sender が開き直す）
+static char MidiPath[MAX_PATH];
+static int MidiFlags;
+static long long MidiRetry = 0;
+static SDL_Thread *MidiThread = NULL;
+static SDL_sem *MidiSem = NULL;
+static volatile int MidiQuit = 0;
+// 捨てたメッセージの数はスレッド毎に数え、sender を止めてから足す
+static DWORD MidiDropFull = 0;		// エミュレーションスレッド: リングが一杯
+static DWORD MidiDropNoReader = 0;	// sender: 読み手がいない
+
+// 書き込み側はエミュレーションスレッド、読み出し側は sender のみ
+static BYTE MidiRing[MIDIOUT_RING];
+static SDL_atomic_t MidiRd, MidiWr;
+
+// エミュレーション時刻 -> ホスト時刻の対応（sender スレッドのみが触る）
+static long long MidiLatency = 0;	// usec
+static long long MidiBaseHost = 0;
+static DWORD MidiBaseEmu = 0;
+static int MidiSynced = 0;
+
+// 音の出力と揃える時は、その時刻の音が鳴るホスト時刻を返す関数（-1: 不明）
+static long long (*MidiSync)(DWORD time) = NULL;
+
+static long long now_us(void)
+{
+	return (long long)(SDL_GetPerformanceCounter() * 1000000.0 / SDL_GetPerformanceFrequency());
+}
+
+static void ring_put(DWORD pos, const BYTE *src, DWORD len)
+{
+	DWORD ofs = pos & (MIDIOUT_RING - 1);
+	DWORD first = (len < MIDIOUT_RING - ofs) ? len : MIDIOUT_RING - ofs;
+
+	memcpy(MidiRing + ofs, src, first);
+	if (len > first)
+		memcpy(MidiRing, src + first, len - first);
+}
+
+static void ring_get(DWORD pos, BYTE *dst, DWORD len)
+{
+	DWORD ofs = pos & (MIDIOUT_RING - 1);
+	DWORD first = (len < MIDIOUT_RING - ofs) ? len : MIDIOUT_RING - ofs;
+
+	memcpy(dst, MidiRing + ofs, first);
+	if (len > first)
+		memcpy(dst + first, MidiRing, len - first);
+}
+
+// 読み手が居なくなったら（EPIPE）閉じて、後で開き直す
+static void write_all(const BYTE *buf, int len)
+{
+	while (len > 0) {
+		ssize_t r = write(MidiFd, buf, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && errno == EPIPE) {
+			fprintf(stderr, "MIDI: reader of %s went away\n", MidiPath);
+			close(MidiFd);
+			MidiFd = -1;
+			MidiRetry = 0;
+			return;
+		}
+		if (r <= 0)
+			return;
+		buf += r;
+		len -= (int)r;
+	}
+}
+
+// -----------------------------------------------------------------------
+//   送出時刻を決める（ポーズや早送りでずれ過ぎたら基準を取り直す）
+// -----------------------------------------------------------------------
+static long long midi_target(DWORD time)
+{
+	long long now = now_us(), target = 0;
+
+	if (MidiSync) {
+		target = MidiSync(time);
+		if (target >= 0) {
+			MidiSynced = 0;
+			return target;
+		}
+	}
+	if (MidiSynced) {
+		target = MidiBaseHost + (int)(time - MidiBaseEmu);
+		if (target < now - MidiLatency || target > now + MidiLatency + 1000000)
+			MidiSynced = 0;
+	}
+	if (!MidiSynced) {
+		MidiBaseEmu = time;
+		MidiBaseHost = now + MidiLatency;
+		MidiSynced = 1;
+		target = MidiBaseHost;
+	}
+	return target;
+}
+
+// 待っている間も音の進み具合で目標が動くので、その都度取り直す
+static void wait_until(DWORD time)
+{
+	long long d;
+
+	while (!MidiQuit && (d = midi_target(time) - now_us()) > 0) {
+		if (d > 10000)
+			SDL_SemWaitTimeout(MidiSem, 9);
+		else if (d > 2000)
+			SDL_SemWaitTimeout(MidiSem, (Uint32)((d - 1000) / 1000));
+		else
+			SDL_Delay(1);
+	}
+}
+
+// -----------------------------------------------------------------------
+//   dev: "hw:C,D" (ALSA rawmidi), /dev/midi* 等のデバイス、またはファイル
+// -----------------------------------------------------------------------
+static void midi_set_dev(const char *dev)
+{
+	int card, device = 0;
+
+	MidiFlags = O_WRONLY | O_NONBLOCK;
+	if (sscanf(dev, "hw:%d,%d", &card, &device) >= 1) {
+		snprintf(MidiPath, sizeof(MidiPath), "/dev/snd/midiC%dD%d", card, device);
+	} else {
+		snprintf(MidiPath, sizeof(MidiPath), "%s", dev);
+		if (strncmp(MidiPath, "/dev/", 5) != 0)
+			MidiFlags |= O_CREAT | O_TRUNC;
+	}
+}
+
+// FIFO に読み手がいない時に固まらないよう O_NONBLOCK で開く
+// 読み手がいなければ ENXIO で失敗する（errno はそのまま返す）
+static int midi_open_dev(void)
+{
+	int fd = open(MidiPath, MidiFlags, 0644);
+
+	if (fd < 0)
+		return -1;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	return fd;
+}
+
+// sender スレッドから: 読み手の付いていない FIFO を一定間隔で開き直す
+static int midi_reopen(void)
+{
+	long long now = now_us();
+
+	if (MidiRetry && now < MidiRetry)
+		return FALSE;
+	MidiRetry = now + MIDIOUT_RETRY;
+	MidiFd = midi_open_dev();
+	if (MidiFd < 0)
+		return FALSE;
+	fprintf(stderr, "MIDI: reader attached to %s\n", MidiPath);
+	return TRUE;
+}
+
+static int midi_thread(void *arg)
+{
+	static BYTE msg[MIDIOUT_MAXMSG];
+	BYTE hdr[MIDIOUT_HDR];
+	DWORD rd, time;
+	int len;
+	sigset_t set;
+
+	(void)arg;
+
+	// FIFO の読み手が居なくなった時は SIGPIPE ではなく EPIPE で受ける
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (;;) {
+		rd = SDL_AtomicGet(&MidiRd);
+		if (rd == (DWORD)SDL_AtomicGet(&MidiWr)) {
+			if (MidiQuit)
+				break;
+			SDL_SemWaitTimeout(MidiSem, 20);
+			continue;
+		}
+		ring_get(rd, hdr, MIDIOUT_HDR);
+		time = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((DWORD)hdr[3] << 24);
+		len = hdr[4] | (hdr[5] << 8);
+		ring_get(rd + MIDIOUT_HDR, msg, len);
+		SDL_AtomicSet(&MidiRd, (int)(rd + MIDIOUT_HDR + len));
+
+		// 終了時は残りを待たずに吐き出す
+		if (!MidiQuit)
+			wait_until(time);
+		if (MidiFd < 0 && !midi_reopen()) {
+			MidiDropNoReader++;
+			continue;
+		}
+		write_all(msg, len);
+	}
+	return 0;
+}
+
+int MIDIOut_Open(const char *dev, DWORD latency)
+{
+	MIDIOut_Close();
+
+	if (dev == NULL || dev[0] == '\0')
+		return FALSE;
+	midi_set_dev(dev);
+	MidiFd = midi_open_dev();
+	MidiRetry = 0;
+	if (MidiFd < 0) {
+		if (errno != ENXIO) {
+			fprintf(stderr, "MIDI: can't open %s (%s)\n", MidiPath, strerror(errno));
+			return FALSE;
+		}
+		// 読み手のいない FIFO: 送る時に開き直す（それまでのメッセージは捨てる）
+		fprintf(stderr, "MIDI: no reader on %s yet (%s), will retry\n", MidiPath, strerror(errno));
+		MidiRetry = now_us() + MIDIOUT_RETRY;
+	}
+
+	SDL_AtomicSet(&MidiRd, 0);
+	SDL_AtomicSet(&MidiWr, 0);
+	MidiLatency = (long long)latency * 1000;
+	MidiSynced = 0;
+	MidiDropFull = MidiDropNoReader = 0;
+	MidiQuit = 0;
+	MidiSem = SDL_CreateSemaphore(0);
+	MidiThread = SDL_CreateThread(midi_thread, "midiout", NULL);
+	if (MidiSem == NULL || MidiThread == NULL) {
+		fprintf(stderr, "MIDI: can't start sender thread\n");
+		MIDIOut_Close();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void MIDIOut_Close(void)
+{
+	if (MidiThread) {
+		MidiQuit = 1;
+		SDL_SemPost(MidiSem);
+		SDL_WaitThread(MidiThread, NULL);
+		MidiThread = NULL;
+	}
+	if (MidiSem) {
+		SDL_DestroySemaphore(MidiSem);
+		MidiSem = NULL;
+	}
+	if (MidiFd >= 0) {
+		close(MidiFd);
+		MidiFd = -1;
+	}
+	if (MidiDropFull || MidiDropNoReader)
+		fprintf(stderr, "MIDI: %u messages dropped (%u ring full, %u no reader)\n",
+		    (unsigned int)(MidiDropFull + MidiDropNoReader),
+		    (unsigned int)MidiDropFull, (unsigned int)MidiDropNoReader);
+	MidiDropFull = MidiDropNoReader = 0;
+}
+
+int MIDIOut_IsOpen(void)
+{
+	return (MidiThread != NULL);
+}
+
+// 送出時刻の基準を音の出力にする（NULL で壁時計 + 固定遅延に戻す）
+void MIDIOut_SetSync(long long (*fn)(DWORD time))
+{
+	MidiSync = fn;
+}
+
+// time: エミュレーション上の経過時間 (usec)
+void MIDIOut_Send(DWORD time, const BYTE *msg, int len)
+{
+	BYTE hdr[MIDIOUT_HDR];
+	DWORD wr, used;
+
+	if (MidiThread == NULL || len <= 0)
+		return;
+	wr = SDL_AtomicGet(&MidiWr);
+	used = wr - (DWORD)SDL_AtomicGet(&MidiRd);
+	if (len > MIDIOUT_MAXMSG || used + MIDIOUT_HDR + len > MIDIOUT_RING) {
+		// 相手が詰まっている間はエミュレーションを止めずに捨てる
+		MidiDropFull++;
+		return;
+	}
+	hdr[0] = (BYTE)time;
+	hdr[1] = (BYTE)(time >> 8);
+	hdr[2] = (BYTE)(time >> 16);
+	hdr[3] = (BYTE)(time >> 24);
+	hdr[4] = (BYTE)len;
+	hdr[5] = (BYTE)(len >> 8);
+	ring_put(wr, hdr, MIDIOUT_HDR);
+	ring_put(wr + MIDIOUT_HDR, msg, len);
+	SDL_AtomicSet(&MidiWr, (int)(wr + MIDIOUT_HDR + len));
+	if (used == 0)
+		SDL_SemPost(MidiSem);
+}
@@ -0,0 +1,21 @@
+#ifndef winx68k_midiout_h
+#define winx68k_midiout_h
+
+#include "common.h"
+
+/*
+ * MIDI output backend: complete messages are stamped with the emulated
+ * time (usec) and queued in a lock-free byte ring; a sender thread writes
+ * them to a raw MIDI device, an ALSA rawmidi port ("hw:C,D") or any
+ * file/FIFO at the right moment, so the emulation thread never blocks.
+ */
+
+#define MIDIOUT_RING	65536		// bytes, power of 2
+
+int MIDIOut_Open(const char *dev, DWORD latency);
+void MIDIOut_Close(void);
+int MIDIOut_IsOpen(void);
+void MIDIOut_SetSync(long long (*fn)(DWORD time));
+void MIDIOut_Send(DWORD time, const BYTE *msg, int len);
+
+#endif //winx68k_midiout_h
@@ -0,0 +1,450 @@
+// -----------------------------------------------------------------------
+//   Sound mixing bus (int32 sources -> gain -> sum -> S16 sink)
+// -----------------------------------------------------------------------
+#include <stdlib.h>
+#include "common.h"
+#include <SDL.h>
+#include "mixer.h"
+
+#if defined(__SSE2__)
+#include	<emmintrin.h>
+#elif defined(__ARM_NEON)
+#include	<arm_neon.h>
+#endif
+
+typedef struct {
+	DWORD pos;		// ジョブ先頭からのフレーム位置
+	WORD reg;
+	BYTE data;
+} MIXER_LOG;
+
+typedef struct {
+	MIXER_RENDER render;
+	MIXER_WRITE write;	// NULL ならプレーンなソース
+	float gain;
+	int *buf[2];		// ジョブごとの出力 (MIXER_BATCH フレーム)
+	MIXER_LOG *log[2];	// ジョブごとのレジスタ書き込み
+	int logn[2];
+} MIXER_SOURCE;
+
+typedef struct {
+	SDL_Thread *thread;
+	SDL_sem *start;
+	int index;
+} MIXER_WORKER;
+
+static MIXER_SOURCE Sources[MIXER_MAX_SOURCES];
+static int SourceNum = 0;
+static int ChipIdx[MIXER_MAX_SOURCES];
+static int ChipNum = 0;
+static MIXER_SINK Sink = NULL;
+static MIXER_CLOCK Clock = NULL;
+
+static MIXER_WORKER Workers[MIXER_MAX_THREADS];
+static int WorkerNum = 0;
+static SDL_sem *WorkerDone = NULL;
+static volatile int WorkerQuit = 0;
+
+// Cur: エミュレーション側が溜めているジョブ、JobBatch: ワーカーに渡したジョブ
+static int Cur = 0;
+static DWORD Pend = 0;
+static int JobBatch, JobPosted = 0;
+static DWORD JobLen;
+
+static int MixSrc[MIXER_BLOCK*2];
+static float MixAcc[MIXER_BLOCK*2];
+static short MixOut[MIXER_BLOCK*2];
+
+// -----------------------------------------------------------------------
+//   acc (+)= src * gain
+// -----------------------------------------------------------------------
+static void mix_accum(float *acc, const int *src, int n, float gain, int first)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 g = _mm_set1_ps(gain);
+	if (first) {
+		for (; i + 4 <= n; i += 4)
+			_mm_storeu_ps(acc + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i))), g));
+	} else {
+		for (; i + 4 <= n; i += 4) {
+			__m128 v = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i))), g);
+			_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), v));
+		}
+	}
+#elif defined(__ARM_NEON)
+	if (first) {
+		for (; i + 4 <= n; i += 4)
+			vst1q_f32(acc + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)), gain));
+	} else {
+		for (; i + 4 <= n; i += 4)
+			vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), vcvtq_f32_s32(vld1q_s32(src + i)), gain));
+	}
+#endif
+	if (first) {
+		for (; i < n; i++)
+			acc[i] = (float)src[i] * gain;
+	} else {
+		for (; i < n; i++)
+			acc[i] += (float)src[i] * gain;
+	}
+}
+
+// -----------------------------------------------------------------------
+//   一度だけ ±32767 に丸めて S16 に
+// -----------------------------------------------------------------------
+static void mix_store(short *dst, const float *acc, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128 hi = _mm_set1_ps(32767.0f), lo = _mm_set1_ps(-32767.0f);
+	__m128 half = _mm_set1_ps(0.5f), sign = _mm_set1_ps(-0.0f);
+	for (; i + 8 <= n; i += 8) {
+		__m128 fa = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(acc + i), hi), lo);
+		__m128 fb = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(acc + i + 4), hi), lo);
+		// 他の経路と同じく 0 から遠い方へ丸める（cvtps は偶数丸めなので使わない）
+		fa = _mm_add_ps(fa, _mm_or_ps(half, _mm_and_ps(fa, sign)));
+		fb = _mm_add_ps(fb, _mm_or_ps(half, _mm_and_ps(fb, sign)));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(_mm_cvttps_epi32(fa), _mm_cvttps_epi32(fb)));
+	}
+#elif defined(__ARM_NEON)
+	float32x4_t hi = vdupq_n_f32(32767.0f), lo = vdupq_n_f32(-32767.0f);
+	float32x4_t half = vdupq_n_f32(0.5f);
+	for (; i + 8 <= n; i += 8) {
+		float32x4_t a = vmaxq_f32(vminq_f32(vld1q_f32(acc + i), hi), lo);
+		float32x4_t b = vmaxq_f32(vminq_f32(vld1q_f32(acc + i + 4), hi), lo);
+		// vcvtq は 0 方向に切り捨てるので、符号に合わせて 0.5 を足しておく
+		a = vaddq_f32(a, vbslq_f32(vcltq_f32(a, vdupq_n_f32(0.0f)), vnegq_f32(half), half));
+		b = vaddq_f32(b, vbslq_f32(vcltq_f32(b, vdupq_n_f32(0.0f)), vnegq_f32(half), half));
+		vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b))));
+	}
+#endif
+	for (; i < n; i++) {
+		float v = acc[i];
+		if (v > 32767.0f) v = 32767.0f;
+		else if (v < -32767.0f) v = -32767.0f;
+		dst[i] = (short)((v < 0.0f) ? (v - 0.5f) : (v + 0.5f));
+	}
+}
+
+// -----------------------------------------------------------------------
+//   ジョブ b の先頭 len フレームをミックスしてシンクへ
+// -----------------------------------------------------------------------
+static void mix_output(int b, DWORD len)
+{
+	DWORD off, n;
+	int i;
+
+	for (off = 0; off < len; off += n) {
+		n = (len - off > MIXER_BLOCK) ? MIXER_BLOCK : len - off;
+		if (SourceNum == 0)
+			memset(MixAcc, 0, n * 2 * sizeof(float));
+		for (i = 0; i < SourceNum; i++)
+			mix_accum(MixAcc, Sources[i].buf[b] + off * 2, (int)n * 2, Sources[i].gain, i == 0);
+		mix_store(MixOut, MixAcc, (int)n * 2);
+		if (Sink)
+			Sink(MixOut, n);
+	}
+}
+
+// -----------------------------------------------------------------------
+//   ログを書き込み位置で区切りながらチップに n フレーム描かせる
+// -----------------------------------------------------------------------
+static void render_chip(MIXER_SOURCE *s, int b, DWORD n)
+{
+	MIXER_LOG *l = s->log[b];
+	int *out = s->buf[b];
+	DWORD done = 0;
+	int i;
+
+	for (i = 0; i < s->logn[b]; i++) {
+		// ログ溢れで途中で切ったジョブでは、位置がジョブの外に出ることがある
+		DWORD pos = (l[i].pos < n) ? l[i].pos : n;
+		if (pos > done) {
+			s->render(out + done * 2, pos - done);
+			done = pos;
+		}
+		s->write(l[i].reg, l[i].data);
+	}
+	if (n > done)
+		s->render(out + done * 2, n - done);
+	s->logn[b] = 0;
+}
+
+static int mixer_thread(void *arg)
+{
+	MIXER_WORKER *wk = (MIXER_WORKER *)arg;
+	int i;
+
+	for (;;) {
+		SDL_SemWait(wk->start);
+		if (WorkerQuit)
+			break;
+		for (i = wk->index; i < ChipNum; i += WorkerNum)
+			render_chip(&Sources[ChipIdx[i]], JobBatch, JobLen);
+		SDL_SemPost(WorkerDone);
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+//   ワーカーに渡したジョブの完了を待って出力
+// -----------------------------------------------------------------------
+static void mixer_join(void)
+{
+	if (JobPosted == 0)
+		return;
+	while (JobPosted) {
+		SDL_SemWait(WorkerDone);
+		JobPosted--;
+	}
+	mix_output(JobBatch, JobLen);
+}
+
+static void mixer_stop_workers(void)
+{
+	int i;
+
+	WorkerQuit = 1;
+	for (i = 0; i < WorkerNum; i++) {
+		SDL_SemPost(Workers[i].start);
+		SDL_WaitThread(Workers[i].thread, NULL);
+		SDL_DestroySemaphore(Workers[i].start);
+	}
+	WorkerNum = 0;
+	WorkerQuit = 0;
+	if (WorkerDone) {
+		SDL_DestroySemaphore(WorkerDone);
+		WorkerDone = NULL;
+	}
+}
+
+static void mixer_free_source(MIXER_SOURCE *s)
+{
+	int b;
+
+	for (b = 0; b < 2; b++) {
+		free(s->buf[b]);
+		free(s->log[b]);
+		s->buf[b] = NULL;
+		s->log[b] = NULL;
+		s->logn[b] = 0;
+	}
+}
+
+// -----------------------------------------------------------------------
+//   threads: 0 なら CPU 数に合わせる、1 ならエミュレーションスレッドで逐次描く
+// -----------------------------------------------------------------------
+int Mixer_Init(MIXER_SINK sink, int threads)
+{
+	int i;
+
+	Mixer_Cleanup();
+	SourceNum = ChipNum = 0;
+	Sink = sink;
+	Clock = NULL;
+	Cur = 0;
+	Pend = 0;
+
+	if (threads <= 0)
+		threads = SDL_GetCPUCount();
+	threads--;
+	if (threads > MIXER_MAX_THREADS)
+		threads = MIXER_MAX_THREADS;
+	if (threads <= 0)
+		return TRUE;
+
+	WorkerDone = SDL_CreateSemaphore(0);
+	if (WorkerDone == NULL)
+		return TRUE;
+	for (i = 0; i < threads; i++) {
+		MIXER_WORKER *wk = &Workers[WorkerNum];
+		wk->index = WorkerNum;
+		wk->start = SDL_CreateSemaphore(0);
+		if (wk->start == NULL)
+			break;
+		wk->thread = SDL_CreateThread(mixer_thread, "mixer", wk);
+		if (wk->thread == NULL) {
+			SDL_DestroySemaphore(wk->start);
+			break;
+		}
+		WorkerNum++;
+	}
+	return TRUE;
+}
+
+void Mixer_SetClock(MIXER_CLOCK clock)
+{
+	Clock = clock;
+}
+
+// 登録は残すので、以後の Mixer_Write はその場で書き込む
+void Mixer_Cleanup(void)
+{
+	int i;
+
+	Mixer_Sync();
+	mixer_stop_workers();
+	for (i = 0; i < SourceNum; i++)
+		mixer_free_source(&Sources[i]);
+	Pend = 0;
+}
+
+static int mixer_add(MIXER_RENDER render, MIXER_WRITE write, int gain)
+{
+	MIXER_SOURCE *s;
+	int b;
+
+	if (SourceNum >= MIXER_MAX_SOURCES || !render)
+		return -1;
+	s = &Sources[SourceNum];
+	memset(s, 0, sizeof(*s));
+	s->render = render;
+	s->write = write;
+	s->gain = (float)gain / MIXER_UNITY;
+
+	for (b = 0; b < 2; b++) {
+		s->buf[b] = (int *)malloc(MIXER_BATCH * 2 * sizeof(int));
+		if (write)
+			s->log[b] = (MIXER_LOG *)malloc(MIXER_LOG_SIZE * sizeof(MIXER_LOG));
+		if (!s->buf[b] || (write && !s->log[b])) {
+			fprintf(stderr, "Mixer: can't allocate source buffer\n");
+			mixer_free_source(s);
+			return -1;
+		}
+	}
+	if (write)
+		ChipIdx[ChipNum++] = SourceNum;
+	return SourceNum++;
+}
+
+int Mixer_AddSource(MIXER_RENDER render, int gain)
+{
+	return mixer_add(render, NULL, gain);
+}
+
+int Mixer_AddChip(MIXER_RENDER render, MIXER_WRITE write, int gain)
+{
+	if (!write)
+		return -1;
+	return mixer_add(render, write, gain);
+}
+
+void Mixer_SetGain(int id, int gain)
+{
+	if (id >= 0 && id < SourceNum)
+		Sources[id].gain = (float)gain / MIXER_UNITY;
+}
+
+// -----------------------------------------------------------------------
+//   チップのレジスタ書き込みを、今の位置（ジョブ先頭からのフレーム数）で記録
+// -----------------------------------------------------------------------
+void FASTCALL Mixer_Write(int id, DWORD reg, BYTE data)
+{
+	MIXER_SOURCE *s = &Sources[id];
+	MIXER_LOG *l;
+	DWORD pos;
+
+	if (!s->log[Cur]) {
+		s->write(reg, data);
+		return;
+	}
+	if (s->logn[Cur] >= MIXER_LOG_SIZE)
+		Mixer_Flush();
+	pos = Pend + (Clock ? Clock() : 0);
+	if (pos > MIXER_BATCH)
+		pos = MIXER_BATCH;
+	if (s->logn[Cur] && pos < s->log[Cur][s->logn[Cur] - 1].pos)
+		pos = s->log[Cur][s->logn[Cur] - 1].pos;
+	l = &s->log[Cur][s->logn[Cur]++];
+	l->pos = pos;
+	l->reg = (WORD)reg;
+	l->data = data;
+}
+
+// -----------------------------------------------------------------------
+//   length フレーム分を進める
+//     チップが無ければすぐにミックスしてシンクへ。あればプレーンな
+//     ソースだけ描いておき、チップは Mixer_Flush でまとめて描く
+// -----------------------------------------------------------------------
+void Mixer_Mix(DWORD length)
+{
+	DWORD n;
+	int i;
+
+	if (!ChipNum) {
+		while (length) {
+			n = (length > MIXER_BLOCK) ? MIXER_BLOCK : length;
+			if (SourceNum == 0)
+				memset(MixAcc, 0, n * 2 * sizeof(float));
+			for (i = 0; i < SourceNum; i++) {
+				Sources[i].render(MixSrc, n);
+				mix_accum(MixAcc, MixSrc, (int)n * 2, Sources[i].gain, i == 0);
+			}
+			mix_store(MixOut, MixAcc, (int)n * 2);
+			if (Sink)
+				Sink(MixOut, n);
+			length -= n;
+		}
+		return;
+	}
+
+	while (length) {
+		n = MIXER_BATCH - Pend;
+		if (n > length)
+			n = length;
+		for (i = 0; i < SourceNum; i++) {
+			if (!Sources[i].write)
+				Sources[i].render(Sources[i].buf[Cur] + Pend * 2, n);
+		}
+		Pend += n;
+		length -= n;
+		if (Pend >= MIXER_BATCH)
+			Mixer_Flush();
+	}
+}
+
+// -----------------------------------------------------------------------
+//   溜めたジョブを描く。ワーカーがあれば渡すだけ（前のジョブは待って出力）、
+//   無ければここで描いて出力する。フレームの終わりにエミュレーションスレッドから呼ぶ
+// -----------------------------------------------------------------------
+void Mixer_Flush(void)
+{
+	int i, logged = 0;
+
+	mixer_join();
+	if (!ChipNum)
+		return;
+	for (i = 0; i < ChipNum; i++)
+		logged |= Sources[ChipIdx[i]].logn[Cur];
+	if (Pend == 0 && !logged)
+		return;
+
+	if (!WorkerNum) {
+		for (i = 0; i < ChipNum; i++)
+			render_chip(&Sources[ChipIdx[i]], Cur, Pend);
+		mix_output(Cur, Pend);
+		Pend = 0;
+		return;
+	}
+
+	JobBatch = Cur;
+	JobLen = Pend;
+	Cur ^= 1;
+	Pend = 0;
+
+	JobPosted = (ChipNum < WorkerNum) ? ChipNum : WorkerNum;
+	for (i = 0; i < JobPosted; i++)
+		SDL_SemPost(Workers[i].start);
+}
+
+// -----------------------------------------------------------------------
+//   溜めた分も含めてすべて描き終える（チップを直接触る前に呼ぶ）
+// -----------------------------------------------------------------------
+void Mixer_Sync(void)
+{
+	Mixer_Flush();
+	mixer_join();
+}
@@ -0,0 +1,44 @@
+#ifndef winx68k_mixer_h
+#define winx68k_mixer_h
+
+#include "common.h"
+
+/*
+ * Common mixing bus: every sound source renders unclamped stereo int32
+ * (two ints per frame) into its own linear scratch, the bus applies a
+ * per-source gain, sums, clamps once and hands S16 frames to the sink.
+ *
+ * Sources come in two kinds.  Plain sources (ADPCM, Mercury PCM) pull
+ * their data through DMA and are rendered on the emulation thread as the
+ * samples are due.  Chips (OPM, YMF288) only depend on their registers:
+ * their writes are logged with the sample position they landed on (from
+ * the clock hook, so writes inside a scanline keep their place) and the
+ * whole frame is rendered in one pass that splits at each write.  With
+ * worker threads that pass runs on a worker and is joined and mixed at
+ * the next frame; without, it runs at the end of the frame.
+ */
+
+typedef void (FASTCALL *MIXER_RENDER)(int *buf, DWORD length);
+typedef void (FASTCALL *MIXER_WRITE)(DWORD reg, BYTE data);
+typedef void (*MIXER_SINK)(const short *buf, DWORD length);
+typedef DWORD (*MIXER_CLOCK)(void);	/* frames due since the last Mixer_Mix */
+
+#define MIXER_MAX_SOURCES	4
+#define MIXER_MAX_THREADS	4
+#define MIXER_BLOCK		512
+#define MIXER_BATCH		4096	/* max frames deferred per job */
+#define MIXER_LOG_SIZE		4096	/* max register writes per job and chip */
+#define MIXER_UNITY		256	/* gain 1.0 */
+
+int Mixer_Init(MIXER_SINK sink, int threads);
+void Mixer_SetClock(MIXER_CLOCK clock);
+void Mixer_Cleanup(void);
+int Mixer_AddSource(MIXER_RENDER render, int gain);
+int Mixer_AddChip(MIXER_RENDER render, MIXER_WRITE write, int gain);
+void Mixer_SetGain(int id, int gain);
+void FASTCALL Mixer_Write(int id, DWORD reg, BYTE data);
+void Mixer_Mix(DWORD length);
+void Mixer_Flush(void);
+void Mixer_Sync(void);
+
+#endif //winx68k_mixer_h
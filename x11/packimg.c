@@ -0,0 +1,446 @@
+// -----------------------------------------------------------------------
+//   圧縮イメージ（ブロック単位で圧縮、インデックスで任意の位置から読める）
+// -----------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "common.h"
+#include "packimg.h"
+
+#define PACK_NONE	0xffffffff
+
+typedef struct {
+	DWORD	block;
+	DWORD	last_use;
+	BYTE	*data;
+} PACK_CACHE_ENTRY;
+
+struct PACK_IMAGE {
+	int	fd;
+	DWORD	size;
+	DWORD	blocksize;
+	DWORD	blocks;
+	DWORD	*index;
+	BYTE	*cbuf;			// 圧縮されたブロック 1 つ分
+	BYTE	*cache_mem;
+	DWORD	cache_clock;
+	PACK_CACHE_ENTRY cache[PACK_CACHE];
+};
+
+
+static void put32(BYTE *p, DWORD v)
+{
+	p[0] = (BYTE)v;
+	p[1] = (BYTE)(v >> 8);
+	p[2] = (BYTE)(v >> 16);
+	p[3] = (BYTE)(v >> 24);
+}
+
+static DWORD get32(const BYTE *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+
+// -----------------------------------------------------------------------
+//   LZ 圧縮（LZ4 のブロック形式）
+//     トークン: 上位 4bit リテラル長 / 下位 4bit 一致長-4（15 なら 255 単位で続く）
+//     リテラル、一致位置（2 バイト、LE）の順。最後はリテラルだけで終わる
+// -----------------------------------------------------------------------
+#define LZ_MINMATCH	4
+#define LZ_LASTLITS	5		// 最後のこれだけは必ずリテラルにする
+#define LZ_MFLIMIT	12		// 一致を探すのは終わりからこれより手前まで
+#define LZ_HASHBITS	12
+#define LZ_MAXOFFSET	65535
+
+static DWORD lz_read32(const BYTE *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static int lz_hash(DWORD v)
+{
+	return (int)((v * 2654435761U) >> (32 - LZ_HASHBITS));
+}
+
+// 長さの続き（15 を超えた分）
+static int lz_put_length(BYTE *dst, int op, int cap, int n)
+{
+	while (n >= 255) {
+		if (op >= cap)
+			return -1;
+		dst[op++] = 255;
+		n -= 255;
+	}
+	if (op >= cap)
+		return -1;
+	dst[op++] = (BYTE)n;
+	return op;
+}
+
+static int lz_put_sequence(BYTE *dst, int op, int cap, const BYTE *lit, int litlen, int offset, int mlen)
+{
+	int token = ((litlen < 15) ? litlen : 15) << 4;
+
+	if (offset)
+		token |= (mlen - LZ_MINMATCH < 15) ? (mlen - LZ_MINMATCH) : 15;
+	if (op >= cap)
+		return -1;
+	dst[op++] = (BYTE)token;
+	if (litlen >= 15) {
+		op = lz_put_length(dst, op, cap, litlen - 15);
+		if (op < 0)
+			return -1;
+	}
+	if (op + litlen > cap)
+		return -1;
+	memcpy(dst + op, lit, litlen);
+	op += litlen;
+	if (!offset)
+		return op;
+
+	if (op + 2 > cap)
+		return -1;
+	dst[op++] = (BYTE)offset;
+	dst[op++] = (BYTE)(offset >> 8);
+	if (mlen - LZ_MINMATCH >= 15)
+		op = lz_put_length(dst, op, cap, mlen - LZ_MINMATCH - 15);
+	return op;
+}
+
+// 返り値は圧縮後の長さ、cap に収まらなければ 0
+int Pack_Compress(const BYTE *src, int len, BYTE *dst, int cap)
+{
+	int table[1 << LZ_HASHBITS];
+	int ip = 0, anchor = 0, op = 0;
+	int limit = len - LZ_MFLIMIT;
+	int h, ref, mlen;
+
+	memset(table, 0xff, sizeof(table));
+
+	while (ip < limit) {
+		h = lz_hash(lz_read32(src + ip));
+		ref = table[h];
+		table[h] = ip;
+		if (ref < 0 || ip - ref > LZ_MAXOFFSET || lz_read32(src + ref) != lz_read32(src + ip)) {
+			ip++;
+			continue;
+		}
+		mlen = LZ_MINMATCH;
+		while (ip + mlen < len - LZ_LASTLITS && src[ref + mlen] == src[ip + mlen])
+			mlen++;
+		op = lz_put_sequence(dst, op, cap, src + anchor, ip - anchor, ip - ref, mlen);
+		if (op < 0)
+			return 0;
+		ip += mlen;
+		anchor = ip;
+	}
+	op = lz_put_sequence(dst, op, cap, src + anchor, len - anchor, 0, 0);
+	return (op < 0) ? 0 : op;
+}
+
+// 返り値は展開後の長さ、壊れていれば -1
+int Pack_Decompress(const BYTE *src, int len, BYTE *dst, int cap)
+{
+	int ip = 0, op = 0;
+	int token, litlen, mlen, offset, b;
+
+	while (ip < len) {
+		token = src[ip++];
+		litlen = token >> 4;
+		if (litlen == 15) {
+			do {
+				if (ip >= len)
+					return -1;
+				b = src[ip++];
+				litlen += b;
+			} while (b == 255);
+		}
+		if (litlen > len - ip || litlen > cap - op)
+			return -1;
+		memcpy(dst + op, src + ip, litlen);
+		ip += litlen;
+		op += litlen;
+		if (ip >= len)
+			break;
+
+		if (ip + 2 > len)
+			return -1;
+		offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op)
+			return -1;
+		mlen = token & 15;
+		if (mlen == 15) {
+			do {
+				if (ip >= len)
+					return -1;
+				b = src[ip++];
+				mlen += b;
+			} while (b == 255);
+		}
+		mlen += LZ_MINMATCH;
+		if (mlen > cap - op)
+			return -1;
+		if (offset >= mlen) {
+			memcpy(dst + op, dst + op - offset, mlen);
+			op += mlen;
+		} else {
+			// 重なっている（同じ並びの繰り返し）
+			while (mlen--) {
+				dst[op] = dst[op - offset];
+				op++;
+			}
+		}
+	}
+	return op;
+}
+
+
+// -----------------------------------------------------------------------
+//   読み出し
+// -----------------------------------------------------------------------
+static DWORD pack_block_bytes(DWORD size, DWORD blocksize, DWORD b)
+{
+	DWORD ofs = b * blocksize;
+
+	if (ofs >= size)
+		return 0;
+	return (size - ofs < blocksize) ? (size - ofs) : blocksize;
+}
+
+// 先頭が PACK_MAGIC なら TRUE
+int PackImg_IsPacked(const char *path)
+{
+	BYTE magic[8];
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return FALSE;
+	ret = (read(fd, magic, 8) == 8 && !memcmp(magic, PACK_MAGIC, 8));
+	close(fd);
+	return ret;
+}
+
+PACK_IMAGE* PackImg_Open(const char *path)
+{
+	PACK_IMAGE *p;
+	BYTE hdr[PACK_HEADER], *idx = NULL;
+	off_t filesize;
+	DWORD b, n;
+	int i;
+
+	p = (PACK_IMAGE*)calloc(1, sizeof(PACK_IMAGE));
+	if (!p)
+		return NULL;
+	p->fd = open(path, O_RDONLY);
+	if (p->fd < 0)
+		goto pack_error;
+	filesize = lseek(p->fd, 0, SEEK_END);
+	if (pread(p->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) || memcmp(hdr, PACK_MAGIC, 8))
+		goto pack_error;
+	p->blocksize = get32(hdr + 8);
+	p->size = get32(hdr + 12);
+	p->blocks = get32(hdr + 16);
+	if (p->blocksize < 512 || p->blocksize > (1 << 20) ||
+	    p->blocks != (DWORD)(((uint64_t)p->size + p->blocksize - 1) / p->blocksize))
+		goto pack_error;
+
+	n = (p->blocks + 1) * 4;
+	idx = (BYTE*)malloc(n);
+	p->index = (DWORD*)malloc(n);
+	p->cbuf = (BYTE*)malloc(p->blocksize);
+	p->cache_mem = (BYTE*)malloc(p->blocksize * PACK_CACHE);
+	if (!idx || !p->index || !p->cbuf || !p->cache_mem)
+		goto pack_error;
+	if (pread(p->fd, idx, n, PACK_HEADER) != (ssize_t)n)
+		goto pack_error;
+	for (b = 0; b <= p->blocks; b++)
+		p->index[b] = get32(idx + b * 4);
+	free(idx);
+	idx = NULL;
+
+	// 壊れたインデックスで範囲外を読まないように
+	if (p->index[0] < PACK_HEADER + n || p->index[p->blocks] > filesize)
+		goto pack_error;
+	for (b = 0; b < p->blocks; b++) {
+		if (p->index[b + 1] < p->index[b] ||
+		    p->index[b + 1] - p->index[b] > pack_block_bytes(p->size, p->blocksize, b))
+			goto pack_error;
+	}
+
+	for (i = 0; i < PACK_CACHE; i++) {
+		p->cache[i].block = PACK_NONE;
+		p->cache[i].last_use = 0;
+		p->cache[i].data = p->cache_mem + i * p->blocksize;
+	}
+	p->cache_clock = 0;
+	return p;
+
+pack_error:
+	if (p->fd >= 0)
+		fprintf(stderr, "PackImg: %s is broken\n", path);
+	free(idx);
+	PackImg_Close(p);
+	return NULL;
+}
+
+void PackImg_Close(PACK_IMAGE *p)
+{
+	if (!p)
+		return;
+	if (p->fd >= 0)
+		close(p->fd);
+	free(p->index);
+	free(p->cbuf);
+	free(p->cache_mem);
+	free(p);
+}
+
+DWORD PackImg_Size(PACK_IMAGE *p)
+{
+	return p->size;
+}
+
+DWORD PackImg_BlockSize(PACK_IMAGE *p)
+{
+	return p->blocksize;
+}
+
+// ブロック b を展開したもの（キャッシュに無ければ一番古いのと入れ替える）
+static BYTE* pack_block(PACK_IMAGE *p, DWORD b)
+{
+	PACK_CACHE_ENTRY *e = &p->cache[0];
+	DWORD clen, len;
+	int i;
+
+	for (i = 0; i < PACK_CACHE; i++) {
+		if (p->cache[i].block == b) {
+			p->cache[i].last_use = ++p->cache_clock;
+			return p->cache[i].data;
+		}
+		if (p->cache[i].last_use < e->last_use)
+			e = &p->cache[i];
+	}
+
+	e->block = PACK_NONE;
+	clen = p->index[b + 1] - p->index[b];
+	len = pack_block_bytes(p->size, p->blocksize, b);
+	if (clen == 0) {
+		memset(e->data, 0, len);
+	} else if (clen == len) {
+		if (pread(p->fd, e->data, len, p->index[b]) != (ssize_t)len)
+			return NULL;
+	} else {
+		if (pread(p->fd, p->cbuf, clen, p->index[b]) != (ssize_t)clen)
+			return NULL;
+		if (Pack_Decompress(p->cbuf, clen, e->data, len) != (int)len)
+			return NULL;
+	}
+	e->block = b;
+	e->last_use = ++p->cache_clock;
+	return e->data;
+}
+
+// ofs から len バイト。返り値は読めたバイト数（イメージの終わりで止まる）
+DWORD PackImg_Read(PACK_IMAGE *p, DWORD ofs, BYTE *buf, DWORD len)
+{
+	DWORD done = 0, b, pos, n;
+	BYTE *data;
+
+	if (ofs >= p->size)
+		return 0;
+	if (len > p->size - ofs)
+		len = p->size - ofs;
+
+	while (done < len) {
+		b = ofs / p->blocksize;
+		pos = ofs % p->blocksize;
+		n = p->blocksize - pos;
+		if (n > len - done)
+			n = len - done;
+		data = pack_block(p, b);
+		if (!data)
+			break;
+		memcpy(buf, data + pos, n);
+		buf += n;
+		done += n;
+		ofs += n;
+	}
+	return done;
+}
+
+
+// -----------------------------------------------------------------------
+//   作成（src から size バイト読んで path に書く）
+// -----------------------------------------------------------------------
+int PackImg_Write(const char *path, DWORD size, DWORD blocksize, PACK_SOURCE src, void *param)
+{
+	BYTE hdr[PACK_HEADER], *raw = NULL, *comp = NULL, *idx = NULL;
+	DWORD blocks, b, len, ofs, k;
+	int fd, clen, ret = FALSE;
+
+	if (blocksize < 512 || blocksize > (1 << 20))
+		return FALSE;
+	blocks = (DWORD)(((uint64_t)size + blocksize - 1) / blocksize);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "PackImg: can't create %s (%s)\n", path, strerror(errno));
+		return FALSE;
+	}
+	raw = (BYTE*)malloc(blocksize);
+	comp = (BYTE*)malloc(blocksize);
+	idx = (BYTE*)malloc((blocks + 1) * 4);
+	if (!raw || !comp || !idx)
+		goto write_end;
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, PACK_MAGIC, 8);
+	put32(hdr + 8, blocksize);
+	put32(hdr + 12, size);
+	put32(hdr + 16, blocks);
+	if (write(fd, hdr, sizeof(hdr)) != sizeof(hdr))
+		goto write_end;
+
+	ofs = PACK_HEADER + (blocks + 1) * 4;
+	for (b = 0; b < blocks; b++) {
+		len = pack_block_bytes(size, blocksize, b);
+		if (src(param, b * blocksize, raw, len) != len)
+			goto write_end;
+		put32(idx + b * 4, ofs);
+
+		for (k = 0; k < len && !raw[k]; k++)
+			;
+		if (k == len)
+			continue;
+		clen = Pack_Compress(raw, len, comp, len - 1);
+		if (clen > 0) {
+			if (pwrite(fd, comp, clen, ofs) != clen)
+				goto write_end;
+			ofs += clen;
+		} else {
+			if (pwrite(fd, raw, len, ofs) != (ssize_t)len)
+				goto write_end;
+			ofs += len;
+		}
+	}
+	put32(idx + blocks * 4, ofs);
+	if (pwrite(fd, idx, (blocks + 1) * 4, PACK_HEADER) != (ssize_t)((blocks + 1) * 4))
+		goto write_end;
+	ret = TRUE;
+
+write_end:
+	if (close(fd) < 0)
+		ret = FALSE;
+	if (!ret)
+		fprintf(stderr, "PackImg: writing %s failed\n", path);
+	free(raw);
+	free(comp);
+	free(idx);
+	return ret;
+}
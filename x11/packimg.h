@@ -0,0 +1,46 @@
+#ifndef winx68k_packimg_h
+#define winx68k_packimg_h
+
+#include "common.h"
+
+// 圧縮イメージ（固定長ブロック毎に圧縮、ブロックの位置はインデックスで引く）
+//   0x000  "X68KPAK1"
+//   0x008  ブロックサイズ
+//   0x00c  イメージのサイズ
+//   0x010  ブロック数
+//   0x014  予約
+//   0x020  インデックス（ブロック数 + 1 個。ブロック b は [idx[b], idx[b+1])）
+//   その後ろに各ブロックのデータ
+//     長さ 0          : 全部 0 のブロック
+//     長さ = 元の長さ : 圧縮していない
+//     それ以外        : LZ 圧縮（LZ4 のブロック形式と同じ並び）
+#define PACK_MAGIC		"X68KPAK1"
+#define PACK_HEADER		0x20
+#define PACK_BLOCK		65536
+#define PACK_CACHE		16		// 展開済みブロックを 1 イメージあたりいくつ持つか
+
+typedef struct PACK_IMAGE PACK_IMAGE;
+
+// 読み出し元（PackImg_Write 用）。ofs から len バイトを buf に、返り値は読めたバイト数
+typedef DWORD (*PACK_SOURCE)(void *param, DWORD ofs, BYTE *buf, DWORD len);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int		Pack_Compress(const BYTE *src, int len, BYTE *dst, int cap);
+int		Pack_Decompress(const BYTE *src, int len, BYTE *dst, int cap);
+
+int		PackImg_IsPacked(const char *path);
+PACK_IMAGE*	PackImg_Open(const char *path);
+void		PackImg_Close(PACK_IMAGE *p);
+DWORD		PackImg_Size(PACK_IMAGE *p);
+DWORD		PackImg_BlockSize(PACK_IMAGE *p);
+DWORD		PackImg_Read(PACK_IMAGE *p, DWORD ofs, BYTE *buf, DWORD len);
+int		PackImg_Write(const char *path, DWORD size, DWORD blocksize, PACK_SOURCE src, void *param);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //winx68k_packimg_h
@@ -249,6 +249,7 @@ void LoadConfig(void)
 	Config.SampleRate = GetPrivateProfileInt(ini_title, "SampleRate", 22050, winx68k_ini);
 #endif
 	Config.BufferSize = GetPrivateProfileInt(ini_title, "BufferSize", 50, winx68k_ini);
+	Config.BufferMin = GetPrivateProfileInt(ini_title, "BufferMin", 10, winx68k_ini);
 
 	Config.MouseSpeed = GetPrivateProfileInt(ini_title, "MouseSpeed", 10, winx68k_ini);
 
@@ -263,6 +264,12 @@ void LoadConfig(void)
 	Config.Sound_LPF = solveBOOL(buf);
 	GetPrivateProfileString(ini_title, "UseRomeo", "0", buf, CFGLEN, winx68k_ini);
 	Config.SoundROMEO = solveBOOL(buf);
+	GetPrivateProfileString(ini_title, "OPMNativeRate", "0", buf, CFGLEN, winx68k_ini);
+	Config.OPMNativeRate = solveBOOL(buf);
+	Config.OPMResampleQuality = GetPrivateProfileInt(ini_title, "OPMResampleQuality", 2, winx68k_ini);
+	GetPrivateProfileString(ini_title, "OPMSimd", "0", buf, CFGLEN, winx68k_ini);
+	Config.OPMSimd = solveBOOL(buf);
+	Config.SoundThreads = GetPrivateProfileInt(ini_title, "SoundThreads", 0, winx68k_ini);
 	GetPrivateProfileString(ini_title, "MIDI_SW", "1", buf, CFGLEN, winx68k_ini);
 	Config.MIDI_SW = solveBOOL(buf);
 	GetPrivateProfileString(ini_title, "MIDI_Reset", "0", buf, CFGLEN, winx68k_ini);
@@ -288,6 +295,10 @@ void LoadConfig(void)
 
 	Config.WinStrech = GetPrivateProfileInt(ini_title, "WinStretch", 1, winx68k_ini);
 
+	Config.ScaleFilter = GetPrivateProfileInt(ini_title, "ScaleFilter", 0, winx68k_ini);
+	Config.ScaleFactor = GetPrivateProfileInt(ini_title, "ScaleFactor", 2, winx68k_ini);
+	Config.ScaleThreads = GetPrivateProfileInt(ini_title, "ScaleThreads", 0, winx68k_ini);
+
 	GetPrivateProfileString(ini_title, "DSMixing", "0", buf, CFGLEN, winx68k_ini);
 	Config.DSMixing = solveBOOL(buf);
 
@@ -315,6 +326,8 @@ void LoadConfig(void)
 
 	Config.MIDIDelay = GetPrivateProfileInt(ini_title, "MIDIDelay", Config.BufferSize*5, winx68k_ini);
 	Config.MIDIAutoDelay = GetPrivateProfileInt(ini_title, "MIDIAutoDelay", 1, winx68k_ini);
+	GetPrivateProfileString(ini_title, "MIDIDevice", "", buf, MAX_PATH, winx68k_ini);
+	strcpy(Config.MIDIDevice, buf);
 
 	Config.VkeyScale = GetPrivateProfileInt(ini_title, "VkeyScale", 4, winx68k_ini);
 
@@ -361,6 +374,10 @@ void LoadConfig(void)
 	GetPrivateProfileString(ini_title, "ScsiExtRomPath", "", Config.ScsiExtRomPath, MAX_PATH, winx68k_ini);
 	GetPrivateProfileString(ini_title, "ScsiIntRomPath", "", Config.ScsiIntRomPath, MAX_PATH, winx68k_ini);
 
+	GetPrivateProfileString(ini_title, "FrameHashLog", "", Config.FrameHashLog, MAX_PATH, winx68k_ini);
+	GetPrivateProfileString(ini_title, "SkipDupFrame", "0", buf, CFGLEN, winx68k_ini);
+	Config.SkipDupFrame = solveBOOL(buf);
+
 #if 0
 	fp = File_OpenCurDir(KEYCONFFILE);
 	if (fp)
@@ -396,6 +413,8 @@ void SaveConfig(void)
 	WritePrivateProfileString(ini_title, "SampleRate", buf, winx68k_ini);
 	wsprintf(buf, "%d", Config.BufferSize);
 	WritePrivateProfileString(ini_title, "BufferSize", buf, winx68k_ini);
+	wsprintf(buf, "%d", Config.BufferMin);
+	WritePrivateProfileString(ini_title, "BufferMin", buf, winx68k_ini);
 
 	wsprintf(buf, "%d", Config.MouseSpeed);
 	WritePrivateProfileString(ini_title, "MouseSpeed", buf, winx68k_ini);
@@ -406,6 +425,12 @@ void SaveConfig(void)
 	WritePrivateProfileString(ini_title, "DSAlert", makeBOOL((BYTE)Config.DSAlert), winx68k_ini);
 	WritePrivateProfileString(ini_title, "SoundLPF", makeBOOL((BYTE)Config.Sound_LPF), winx68k_ini);
 	WritePrivateProfileString(ini_title, "UseRomeo", makeBOOL((BYTE)Config.SoundROMEO), winx68k_ini);
+	WritePrivateProfileString(ini_title, "OPMNativeRate", makeBOOL((BYTE)Config.OPMNativeRate), winx68k_ini);
+	wsprintf(buf, "%d", Config.OPMResampleQuality);
+	WritePrivateProfileString(ini_title, "OPMResampleQuality", buf, winx68k_ini);
+	WritePrivateProfileString(ini_title, "OPMSimd", makeBOOL((BYTE)Config.OPMSimd), winx68k_ini);
+	wsprintf(buf, "%d", Config.SoundThreads);
+	WritePrivateProfileString(ini_title, "SoundThreads", buf, winx68k_ini);
 	WritePrivateProfileString(ini_title, "MIDI_SW", makeBOOL((BYTE)Config.MIDI_SW), winx68k_ini);
 	WritePrivateProfileString(ini_title, "MIDI_Reset", makeBOOL((BYTE)Config.MIDI_Reset), winx68k_ini);
 	wsprintf(buf, "%d", Config.MIDI_Type);
@@ -448,6 +473,7 @@ void SaveConfig(void)
 	wsprintf(buf, "%d", Config.MIDIDelay);
 	WritePrivateProfileString(ini_title, "MIDIDelay", buf, winx68k_ini);
 	WritePrivateProfileString(ini_title, "MIDIAutoDelay", makeBOOL((BYTE)Config.MIDIAutoDelay), winx68k_ini);
+	WritePrivateProfileString(ini_title, "MIDIDevice", Config.MIDIDevice, winx68k_ini);
 
 	wsprintf(buf, "%d", Config.VkeyScale);
 	WritePrivateProfileString(ini_title, "VkeyScale", buf, winx68k_ini);
@@ -476,6 +502,13 @@ void SaveConfig(void)
 	wsprintf(buf, "%d", Config.NoWaitMode);
 	WritePrivateProfileString(ini_title, "NoWaitMode", buf, winx68k_ini);
 
+	wsprintf(buf, "%d", Config.ScaleFilter);
+	WritePrivateProfileString(ini_title, "ScaleFilter", buf, winx68k_ini);
+	wsprintf(buf, "%d", Config.ScaleFactor);
+	WritePrivateProfileString(ini_title, "ScaleFactor", buf, winx68k_ini);
+	wsprintf(buf, "%d", Config.ScaleThreads);
+	WritePrivateProfileString(ini_title, "ScaleThreads", buf, winx68k_ini);
+
 	for (i=0; i<2; i++)
 	{
 		for (j=0; j<8; j++)
@@ -504,6 +537,9 @@ void SaveConfig(void)
 	WritePrivateProfileString(ini_title, "ScsiExtRomPath", Config.ScsiExtRomPath, winx68k_ini);
 	WritePrivateProfileString(ini_title, "ScsiIntRomPath", Config.ScsiIntRomPath, winx68k_ini);
 
+	WritePrivateProfileString(ini_title, "FrameHashLog", Config.FrameHashLog, winx68k_ini);
+	WritePrivateProfileString(ini_title, "SkipDupFrame", makeBOOL((BYTE)Config.SkipDupFrame), winx68k_ini);
+
 #if 0
 	fp = File_OpenCurDir(KEYCONFFILE);
 	if (!fp)
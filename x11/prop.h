@@ -7,6 +7,7 @@ typedef struct
 {
 	DWORD SampleRate;
 	DWORD BufferSize;
+	DWORD BufferMin;		// BufferSize との間で自動調整する (ms)
 	int WinPosX;
 	int WinPosY;
 	int OPM_VOL;
@@ -42,8 +43,13 @@ typedef struct
 	int SSTP_Port;
 	int Sound_LPF;
 	int SoundROMEO;
+	int OPMNativeRate;
+	int OPMResampleQuality;
+	int OPMSimd;
+	int SoundThreads;
 	int MIDIDelay;
 	int MIDIAutoDelay;
+	char MIDIDevice[MAX_PATH];
 	char FDDImage[2][MAX_PATH];
 	char IplromPath[MAX_PATH];
 	char CgromPath[MAX_PATH];
@@ -57,6 +63,11 @@ typedef struct
 	int HwJoyBtn[8];
 	int NoWaitMode;
 	BYTE FrameRate;
+	int ScaleFilter;
+	int ScaleFactor;
+	int ScaleThreads;
+	char FrameHashLog[MAX_PATH];
+	int SkipDupFrame;
 } Win68Conf;
 
 extern Win68Conf Config;
@@ -0,0 +1,415 @@
+// -----------------------------------------------------------------------
+//   A/V recorder (Y4M + WAV, background writer thread)
+// -----------------------------------------------------------------------
+#include <stdlib.h>
+#include "common.h"
+#include <SDL.h>
+#include "recorder.h"
+
+#define REC_FRAMES	16		// フレームリングのスロット数
+#define REC_AUDIO_SEC	2		// 音声リングの長さ（秒）
+#define REC_MAX_W	800
+#define REC_MAX_H	600
+
+typedef struct {
+	int w, h;		// 元画面の表示サイズ（重複判定用）
+	DWORD count;		// このフレームを書き出す回数
+	WORD *pix;		// RecW x RecH にクロップ済み
+} REC_FRAME;
+
+static SDL_atomic_t RecActive;
+static SDL_Thread *RecThread = NULL;
+static SDL_sem *RecSem = NULL;
+static volatile int RecQuit = 0;
+
+static FILE *RecVideo = NULL;
+static FILE *RecWave = NULL;
+static int RecW = 0, RecH = 0;		// 出力サイズ（最初のフレームで決定）
+static DWORD RecVSync = 0;		// 出力の 1 フレーム時間（開始時の CRTC_GetVSyncClock()）
+static DWORD RecFrameClk = 0;		// 今のエミュレーション上のフレームの長さ
+static DWORD RecClock = 0;		// 出力フレームに満たない端数
+static DWORD RecLeadIn = 0;		// 最初の描画までに過ぎた出力フレーム数
+static DWORD RecRate = 0;
+static DWORD RecWaveBytes = 0;
+static BYTE *RecYUV = NULL;
+
+// フレームリング（書き込み側: エミュレーションスレッド、読み出し側: writer）
+static REC_FRAME RecFrame[REC_FRAMES];
+static SDL_atomic_t RecFrameRd, RecFrameWr;
+static int RecFramePending = 0;
+static DWORD RecFrameDrop = 0;
+
+// 音声リング（sound_send() はエミュレーションスレッドのみなので書き込み側は 1 つ）
+static BYTE *RecAudio = NULL;
+static DWORD RecAudioSize = 0;
+static SDL_atomic_t RecAudioRd, RecAudioWr;
+static DWORD RecAudioDrop = 0;
+
+static void put_le(BYTE *p, DWORD v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++, v >>= 8)
+		p[i] = (BYTE)v;
+}
+
+static void wave_header(FILE *fp, DWORD rate, DWORD bytes)
+{
+	BYTE h[44];
+
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, bytes + 36, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);
+	put_le(h + 20, 1, 2);			// PCM
+	put_le(h + 22, 2, 2);			// stereo
+	put_le(h + 24, rate, 4);
+	put_le(h + 28, rate * 4, 4);
+	put_le(h + 32, 4, 2);
+	put_le(h + 34, 16, 2);
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, bytes, 4);
+	fseek(fp, 0, SEEK_SET);
+	fwrite(h, 1, sizeof(h), fp);
+	fseek(fp, 0, SEEK_END);
+}
+
+// -----------------------------------------------------------------------
+//   RGB565 -> YUV 4:2:0 (BT.601 full range, C420jpeg)
+// -----------------------------------------------------------------------
+#define R8(p)	((((p) >> 8) & 0xf8) | (((p) >> 13) & 7))
+#define G8(p)	((((p) >> 3) & 0xfc) | (((p) >> 9) & 3))
+#define B8(p)	((((p) << 3) & 0xf8) | (((p) >> 2) & 7))
+
+static void frame_to_yuv(BYTE *dst, const WORD *src, int w, int h)
+{
+	BYTE *py = dst, *pu = dst + w * h, *pv = pu + (w / 2) * (h / 2);
+	int x, y;
+
+	for (y = 0; y < h; y++) {
+		const WORD *s = src + y * w;
+		for (x = 0; x < w; x++) {
+			int r = R8(s[x]), g = G8(s[x]), b = B8(s[x]);
+			*py++ = (BYTE)((77 * r + 150 * g + 29 * b + 128) >> 8);
+		}
+	}
+	for (y = 0; y < h; y += 2) {
+		const WORD *s0 = src + y * w, *s1 = s0 + w;
+		for (x = 0; x < w; x += 2) {
+			int r = R8(s0[x]) + R8(s0[x + 1]) + R8(s1[x]) + R8(s1[x + 1]);
+			int g = G8(s0[x]) + G8(s0[x + 1]) + G8(s1[x]) + G8(s1[x + 1]);
+			int b = B8(s0[x]) + B8(s0[x + 1]) + B8(s1[x]) + B8(s1[x + 1]);
+			*pu++ = (BYTE)(128 + ((-43 * r - 85 * g + 128 * b) >> 10));
+			*pv++ = (BYTE)(128 + ((128 * r - 107 * g - 21 * b) >> 10));
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+//   writer スレッド: リングに溜まった分をファイルへ
+// -----------------------------------------------------------------------
+static int rec_drain(void)
+{
+	int work = 0;
+	DWORD ard = SDL_AtomicGet(&RecAudioRd);
+	DWORD awr = SDL_AtomicGet(&RecAudioWr);
+	int frd = SDL_AtomicGet(&RecFrameRd);
+	int fwr = SDL_AtomicGet(&RecFrameWr);
+
+	if (ard != awr) {
+		DWORD len = awr - ard;
+		DWORD ofs = ard & (RecAudioSize - 1);
+		DWORD first = (len < RecAudioSize - ofs) ? len : RecAudioSize - ofs;
+
+		if (RecWave) {
+			fwrite(RecAudio + ofs, 1, first, RecWave);
+			if (len > first)
+				fwrite(RecAudio, 1, len - first, RecWave);
+			RecWaveBytes += len;
+		}
+		SDL_AtomicSet(&RecAudioRd, (int)awr);
+		work = 1;
+	}
+
+	while (frd != fwr) {
+		REC_FRAME *f = &RecFrame[frd % REC_FRAMES];
+		DWORD i;
+
+		if (RecVideo) {
+			frame_to_yuv(RecYUV, f->pix, RecW, RecH);
+			for (i = 0; i < f->count; i++) {
+				fputs("FRAME\n", RecVideo);
+				fwrite(RecYUV, 1, RecW * RecH * 3 / 2, RecVideo);
+			}
+		}
+		frd++;
+		SDL_AtomicSet(&RecFrameRd, frd);
+		work = 1;
+	}
+	return work;
+}
+
+static int rec_thread(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		int quit = RecQuit;
+		if (!rec_drain()) {
+			if (quit)
+				break;
+			SDL_SemWaitTimeout(RecSem, 20);
+		}
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+//   エミュレーション側
+// -----------------------------------------------------------------------
+static void rec_publish(void)
+{
+	int wr = SDL_AtomicGet(&RecFrameWr);
+
+	SDL_AtomicSet(&RecFrameWr, wr + 1);
+	RecFramePending = 0;
+	SDL_SemPost(RecSem);
+}
+
+static int rec_same(const REC_FRAME *f, const WORD *src, int pitch, int w, int h)
+{
+	int y, cw = (w < RecW) ? w : RecW, ch = (h < RecH) ? h : RecH;
+
+	if (f->w != w || f->h != h)
+		return 0;
+	for (y = 0; y < ch; y++) {
+		if (memcmp(f->pix + y * RecW, src + y * pitch, cw * sizeof(WORD)))
+			return 0;
+	}
+	return 1;
+}
+
+// -----------------------------------------------------------------------
+//   これから始まるフレームの長さ（CRTC_GetVSyncClock() と同じ 0.1us 単位）
+//   15kHz/31kHz の切り替えでフレーム時間が変わっても、出力は開始時の
+//   フレームレートのまま、経過時間に合わせてフレームを繰り返す／間引く
+// -----------------------------------------------------------------------
+void Recorder_FrameClock(DWORD clk)
+{
+	RecFrameClk = clk;
+}
+
+// -----------------------------------------------------------------------
+//   1 フレーム分を記録（src == NULL ならフレームスキップで描画なし）
+// -----------------------------------------------------------------------
+void Recorder_Frame(const WORD *src, int pitch, int w, int h)
+{
+	REC_FRAME *f;
+	DWORD n;
+	int wr, y, cw, ch;
+
+	if (!SDL_AtomicGet(&RecActive))
+		return;
+
+	// このフレームの間に出力側で過ぎたフレーム数（0 なら間引き、2 以上なら繰り返し）
+	RecClock += RecFrameClk ? RecFrameClk : RecVSync;
+	n = RecClock / RecVSync;
+	RecClock -= n * RecVSync;
+
+	if (src == NULL && !RecFramePending) {
+		RecLeadIn += n;
+		return;
+	}
+	if (w > REC_MAX_W) w = REC_MAX_W;
+	if (h > REC_MAX_H) h = REC_MAX_H;
+
+	wr = SDL_AtomicGet(&RecFrameWr);
+	f = &RecFrame[wr % REC_FRAMES];
+
+	if (RecFramePending) {
+		// 描画されなかった／変化のないフレームは直前のものを繰り返す
+		if (src == NULL || rec_same(f, src, pitch, w, h)) {
+			f->count += n;
+			return;
+		}
+		if (f->count != 0) {
+			// 空きスロットがなければ映像だけ落として尺は維持
+			if (wr + 2 - SDL_AtomicGet(&RecFrameRd) > REC_FRAMES) {
+				f->count += n;
+				RecFrameDrop++;
+				return;
+			}
+			rec_publish();
+			f = &RecFrame[(wr + 1) % REC_FRAMES];
+		}
+		// count == 0 のものは一度も出力されないので、そのまま上書き
+	}
+
+	// 最初のフレームの表示領域で出力サイズを決める（4:2:0 なので偶数に）
+	if (RecW == 0) {
+		RecW = (w + 1) & ~1;
+		RecH = (h + 1) & ~1;
+		fprintf(RecVideo, "YUV4MPEG2 W%d H%d F10000000:%u Ip A1:1 C420jpeg\n",
+			RecW, RecH, (unsigned int)RecVSync);
+	}
+
+	cw = (w < RecW) ? w : RecW;
+	ch = (h < RecH) ? h : RecH;
+	for (y = 0; y < ch; y++) {
+		memcpy(f->pix + y * RecW, src + y * pitch, cw * sizeof(WORD));
+		if (cw < RecW)
+			memset(f->pix + y * RecW + cw, 0, (RecW - cw) * sizeof(WORD));
+	}
+	if (ch < RecH)
+		memset(f->pix + ch * RecW, 0, (RecH - ch) * RecW * sizeof(WORD));
+	f->w = w;
+	f->h = h;
+	f->count = n + RecLeadIn;
+	RecLeadIn = 0;
+	RecFramePending = 1;
+}
+
+void Recorder_Audio(const BYTE *buf, int len)
+{
+	DWORD wr, ofs, first;
+
+	if (!SDL_AtomicGet(&RecActive) || len <= 0)
+		return;
+
+	wr = (DWORD)SDL_AtomicGet(&RecAudioWr);
+	if (wr + len - (DWORD)SDL_AtomicGet(&RecAudioRd) > RecAudioSize) {
+		RecAudioDrop += len;
+		return;
+	}
+	ofs = wr & (RecAudioSize - 1);
+	first = ((DWORD)len < RecAudioSize - ofs) ? (DWORD)len : RecAudioSize - ofs;
+	memcpy(RecAudio + ofs, buf, first);
+	if ((DWORD)len > first)
+		memcpy(RecAudio, buf + first, len - first);
+	SDL_AtomicSet(&RecAudioWr, (int)(wr + len));
+}
+
+// -----------------------------------------------------------------------
+//   base.y4m / base.wav を開いて writer を起動
+//     rate: PCM サンプリングレート（0 なら音声なし）
+//     vsync: 出力のフレーム時間（0.1us 単位、CRTC_GetVSyncClock() の値）
+// -----------------------------------------------------------------------
+int Recorder_Start(const char *base, DWORD rate, DWORD vsync)
+{
+	char path[MAX_PATH];
+	int i;
+
+	if (SDL_AtomicGet(&RecActive))
+		return FALSE;
+
+	RecW = 0;
+	RecH = 0;
+	RecVSync = vsync ? vsync : 180310;
+	RecFrameClk = 0;
+	RecClock = 0;
+	RecLeadIn = 0;
+	RecRate = rate;
+	RecWaveBytes = 0;
+	RecFramePending = 0;
+	RecFrameDrop = 0;
+	RecAudioDrop = 0;
+	RecQuit = 0;
+	SDL_AtomicSet(&RecFrameRd, 0);
+	SDL_AtomicSet(&RecFrameWr, 0);
+	SDL_AtomicSet(&RecAudioRd, 0);
+	SDL_AtomicSet(&RecAudioWr, 0);
+
+	snprintf(path, sizeof(path), "%s.y4m", base);
+	RecVideo = fopen(path, "wb");
+	if (RecVideo == NULL) {
+		fprintf(stderr, "Recorder: can't open %s\n", path);
+		return FALSE;
+	}
+	if (rate) {
+		snprintf(path, sizeof(path), "%s.wav", base);
+		RecWave = fopen(path, "wb");
+		if (RecWave == NULL)
+			fprintf(stderr, "Recorder: can't open %s\n", path);
+		else
+			wave_header(RecWave, rate, 0);
+	}
+
+	// 位置カウンタの桁あふれでずれないよう 2 のべき乗に
+	RecAudioSize = 4096;
+	while (RecAudioSize < rate * 4 * REC_AUDIO_SEC)
+		RecAudioSize <<= 1;
+	RecAudio = (BYTE *)malloc(RecAudioSize);
+	RecYUV = (BYTE *)malloc(REC_MAX_W * REC_MAX_H * 3 / 2);
+	RecSem = SDL_CreateSemaphore(0);
+	for (i = 0; i < REC_FRAMES; i++) {
+		RecFrame[i].pix = (WORD *)malloc(REC_MAX_W * REC_MAX_H * sizeof(WORD));
+		if (RecFrame[i].pix == NULL)
+			break;
+	}
+	if (i < REC_FRAMES || RecAudio == NULL || RecYUV == NULL || RecSem == NULL) {
+		fprintf(stderr, "Recorder: out of memory\n");
+		Recorder_Stop();
+		return FALSE;
+	}
+
+	RecThread = SDL_CreateThread(rec_thread, "recorder", NULL);
+	if (RecThread == NULL) {
+		fprintf(stderr, "Recorder: can't create writer thread\n");
+		Recorder_Stop();
+		return FALSE;
+	}
+	SDL_AtomicSet(&RecActive, 1);
+	return TRUE;
+}
+
+// -----------------------------------------------------------------------
+//   音声デバイスを閉じた後に呼ぶこと（Recorder_Audio と競合しないように）
+// -----------------------------------------------------------------------
+void Recorder_Stop(void)
+{
+	int i;
+
+	SDL_AtomicSet(&RecActive, 0);
+
+	if (RecThread) {
+		if (RecFramePending) {
+			while (SDL_AtomicGet(&RecFrameWr) + 1 - SDL_AtomicGet(&RecFrameRd) > REC_FRAMES)
+				SDL_Delay(1);
+			rec_publish();
+		}
+		RecQuit = 1;
+		SDL_SemPost(RecSem);
+		SDL_WaitThread(RecThread, NULL);
+		RecThread = NULL;
+		if (RecFrameDrop || RecAudioDrop)
+			fprintf(stderr, "Recorder: %u frames / %u PCM bytes dropped\n",
+				(unsigned int)RecFrameDrop, (unsigned int)RecAudioDrop);
+	}
+
+	if (RecVideo) {
+		fclose(RecVideo);
+		RecVideo = NULL;
+	}
+	if (RecWave) {
+		wave_header(RecWave, RecRate, RecWaveBytes);
+		fclose(RecWave);
+		RecWave = NULL;
+	}
+	if (RecSem) {
+		SDL_DestroySemaphore(RecSem);
+		RecSem = NULL;
+	}
+	for (i = 0; i < REC_FRAMES; i++) {
+		free(RecFrame[i].pix);
+		RecFrame[i].pix = NULL;
+	}
+	free(RecAudio);
+	RecAudio = NULL;
+	free(RecYUV);
+	RecYUV = NULL;
+}
+
+int Recorder_IsActive(void)
+{
+	return SDL_AtomicGet(&RecActive);
+}
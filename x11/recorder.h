@@ -0,0 +1,19 @@
+#ifndef winx68k_recorder_h
+#define winx68k_recorder_h
+
+#include "common.h"
+
+/*
+ * A/V recorder: frames and mixed PCM are queued in lock-free rings on the
+ * emulation side and written out as <base>.y4m / <base>.wav by a
+ * background thread, so recording never blocks the frame loop.
+ */
+
+int Recorder_Start(const char *base, DWORD rate, DWORD vsync);
+void Recorder_Stop(void);
+int Recorder_IsActive(void);
+void Recorder_FrameClock(DWORD clk);
+void Recorder_Frame(const WORD *src, int pitch, int w, int h);
+void Recorder_Audio(const BYTE *buf, int len);
+
+#endif //winx68k_recorder_h
@@ -0,0 +1,282 @@
+// -----------------------------------------------------------------------
+//   px68k-render: VGM (YM2151 + MSM6258) -> WAV, no CPU emulation
+//     --vgm で取ったログを fmgen と ADPCM デコーダだけで再生する
+// -----------------------------------------------------------------------
+extern "C" {
+
+#include <stdlib.h>
+#include <getopt.h>
+#include "common.h"
+#include "prop.h"
+#include "dmac.h"
+#include "adpcm.h"
+#include "vgmlog.h"
+
+// adpcm.c が参照する本体側のシンボル（再生ではログがデータを運ぶ）
+Win68Conf Config;
+dmac_ch DMA[4];
+
+int FASTCALL DMA_Exec(int ch)
+{
+	(void)ch;
+	return 0;
+}
+
+void VGMLog_ADPCM(BYTE reg, BYTE data) { (void)reg; (void)data; }
+void VGMLog_ADPCMPan(int n) { (void)n; }
+void VGMLog_ADPCMClock(int n) { (void)n; }
+
+}
+
+#include "opm.h"
+
+#define RENDER_BLOCK	512
+
+static FM::OPM opm;
+static FILE *WavFile = NULL;
+static DWORD WavBytes = 0;
+static DWORD OutRate = VGM_RATE;
+static int ADPCMPan = 0x0b;		// PPI ポート C と同じ並び（bit0-1: パン, bit2-3: 分周）
+static DWORD ADPCMClk = 0;
+
+static DWORD get_le(const BYTE *p, int n)
+{
+	DWORD v = 0;
+	int i;
+
+	for (i = n - 1; i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static void put_le(BYTE *p, DWORD v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++, v >>= 8)
+		p[i] = (BYTE)v;
+}
+
+static void wave_header(void)
+{
+	BYTE h[44];
+
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, WavBytes + 36, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);
+	put_le(h + 20, 1, 2);			// PCM
+	put_le(h + 22, 2, 2);			// stereo
+	put_le(h + 24, OutRate, 4);
+	put_le(h + 28, OutRate * 4, 4);
+	put_le(h + 32, 4, 2);
+	put_le(h + 34, 16, 2);
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, WavBytes, 4);
+	fseek(WavFile, 0, SEEK_SET);
+	fwrite(h, 1, sizeof(h), WavFile);
+	fseek(WavFile, 0, SEEK_END);
+}
+
+// -----------------------------------------------------------------------
+//   n フレーム描いて書き出す（本体のミキサーと同じくスロットごとに足す）
+// -----------------------------------------------------------------------
+static void render(DWORD length)
+{
+	int fm[RENDER_BLOCK * 2], pcm[RENDER_BLOCK * 2];
+	short out[RENDER_BLOCK * 2];
+	DWORD n;
+	int i;
+
+	while (length) {
+		n = (length > RENDER_BLOCK) ? RENDER_BLOCK : length;
+		opm.Mix((FM::ISample *)fm, (int)n);
+		ADPCM_Update(pcm, n);
+		for (i = 0; i < (int)n * 2; i++) {
+			int v = fm[i] + pcm[i];
+			if (v > 32767) v = 32767;
+			else if (v < -32767) v = -32767;
+			out[i] = (short)v;
+		}
+		// WAV はリトルエンディアン
+		for (i = 0; i < (int)n * 2; i++)
+			put_le((BYTE *)&out[i], (WORD)out[i], 2);
+		fwrite(out, sizeof(short), n * 2, WavFile);
+		WavBytes += n * 4;
+		length -= n;
+	}
+}
+
+static void adpcm_write(BYTE reg, BYTE data)
+{
+	switch (reg) {
+	case 0x00:
+		ADPCM_Write(0xe92001, data);
+		break;
+	case 0x01:
+		ADPCM_Write(0xe92003, data);
+		break;
+	case 0x02:
+		ADPCMPan = (ADPCMPan & 0x0c) | (data & 3);
+		ADPCM_SetPan(ADPCMPan);
+		break;
+	case 0x08: case 0x09: case 0x0a: case 0x0b:
+		ADPCMClk = (ADPCMClk & ~(0xffUL << ((reg - 8) * 8))) | ((DWORD)data << ((reg - 8) * 8));
+		if (reg == 0x0b)
+			ADPCM_SetClock((ADPCMClk <= VGM_ADPCM_CLOCK / 2) ? 4 : 0);
+		break;
+	case 0x0c:
+		ADPCMPan = (ADPCMPan & 3) | ((data & 3) << 2);
+		ADPCM_SetPan(ADPCMPan);
+		break;
+	}
+}
+
+// VGM コマンドのオペランド長（扱わないチップの分は読み飛ばす）
+static int vgm_skip(BYTE c)
+{
+	if (c >= 0x30 && c <= 0x3f) return 1;
+	if (c >= 0x40 && c <= 0x4e) return 2;
+	if (c == 0x4f || c == 0x50) return 1;
+	if (c >= 0x51 && c <= 0x5f) return 2;
+	if (c >= 0xa0 && c <= 0xbf) return 2;
+	if (c >= 0xc0 && c <= 0xdf) return 3;
+	if (c >= 0xe0) return 4;
+	switch (c) {
+	case 0x90: case 0x91: case 0x95: return 4;
+	case 0x92: return 5;
+	case 0x93: return 10;
+	case 0x94: return 1;
+	}
+	return 0;
+}
+
+static BYTE *load_file(const char *path, DWORD *size)
+{
+	FILE *fp;
+	BYTE *buf;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (BYTE *)malloc(len > 0 ? len : 1);
+	if (buf == NULL || fread(buf, 1, len, fp) != (size_t)len) {
+		free(buf);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+	*size = (DWORD)len;
+	return buf;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r rate] [-n] [-o opm_vol] [-p pcm_vol] input.vgm output.wav\n", prog);
+	fprintf(stderr, "  -r rate     output sample rate (default %d)\n", VGM_RATE);
+	fprintf(stderr, "  -n          synthesize OPM at its native rate and resample\n");
+	fprintf(stderr, "  -o, -p      OPM / ADPCM volume 0-16 (default 12 / 15)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	BYTE *vgm;
+	DWORD size, pos, ver, opmclk;
+	unsigned long long vgmpos = 0, outpos = 0;
+	int c, native = 0, opmvol = 12, pcmvol = 15;
+
+	while ((c = getopt(argc, argv, "r:no:p:h")) != -1) {
+		switch (c) {
+		case 'r': OutRate = (DWORD)atoi(optarg); break;
+		case 'n': native = 1; break;
+		case 'o': opmvol = atoi(optarg); break;
+		case 'p': pcmvol = atoi(optarg); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if (argc - optind != 2 || OutRate < 8000 || OutRate > 192000) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	vgm = load_file(argv[optind], &size);
+	if (vgm == NULL || size < 0x40 || memcmp(vgm, "Vgm ", 4)) {
+		fprintf(stderr, "%s: not a VGM file\n", argv[optind]);
+		return 1;
+	}
+	ver = get_le(vgm + 0x08, 4);
+	pos = (ver >= 0x150 && get_le(vgm + 0x34, 4)) ? 0x34 + get_le(vgm + 0x34, 4) : 0x40;
+	opmclk = get_le(vgm + 0x30, 4) & 0x3fffffff;
+	if (opmclk == 0) {
+		fprintf(stderr, "%s: no YM2151 in this log\n", argv[optind]);
+		return 1;
+	}
+
+	WavFile = fopen(argv[optind + 1], "wb");
+	if (WavFile == NULL) {
+		fprintf(stderr, "can't create %s\n", argv[optind + 1]);
+		return 1;
+	}
+	wave_header();
+
+	memset(&Config, 0, sizeof(Config));
+	Config.Sound_LPF = 1;
+	opm.Init(opmclk, OutRate, native != 0);
+	opm.SetVolume(-((opmvol > 0 && opmvol <= 16) ? (16 - opmvol) * 4 : 192));
+	ADPCM_Init(OutRate);
+	ADPCM_SetVolume((BYTE)pcmvol);
+	if (ver >= 0x161 && pos > 0x94 && get_le(vgm + 0x90, 4)) {
+		ADPCMPan = (ADPCMPan & 3) | ((vgm[0x94] & 3) << 2);
+		ADPCM_SetPan(ADPCMPan);
+		ADPCMClk = get_le(vgm + 0x90, 4);
+		ADPCM_SetClock((ADPCMClk <= VGM_ADPCM_CLOCK / 2) ? 4 : 0);
+	}
+
+	while (pos < size) {
+		BYTE cmd = vgm[pos++];
+		DWORD wait = 0;
+
+		if (cmd == 0x66)
+			break;
+		if (cmd == 0x54 && pos + 2 <= size) {
+			opm.SetReg(vgm[pos], vgm[pos + 1]);
+			pos += 2;
+		} else if (cmd == 0xb7 && pos + 2 <= size) {
+			adpcm_write(vgm[pos], vgm[pos + 1]);
+			pos += 2;
+		} else if (cmd == 0x61 && pos + 2 <= size) {
+			wait = get_le(vgm + pos, 2);
+			pos += 2;
+		} else if (cmd == 0x62) {
+			wait = 735;
+		} else if (cmd == 0x63) {
+			wait = 882;
+		} else if ((cmd & 0xf0) == 0x70) {
+			wait = (cmd & 15) + 1;
+		} else if ((cmd & 0xf0) == 0x80) {
+			wait = cmd & 15;
+		} else if (cmd == 0x67 && pos + 6 <= size) {
+			pos += 6 + get_le(vgm + pos + 2, 4);
+		} else {
+			pos += vgm_skip(cmd);
+		}
+
+		if (wait) {
+			unsigned long long target;
+			vgmpos += wait;
+			target = vgmpos * OutRate / VGM_RATE;
+			render((DWORD)(target - outpos));
+			outpos = target;
+		}
+	}
+
+	wave_header();
+	fclose(WavFile);
+	free(vgm);
+	printf("%s: %.1f sec\n", argv[optind + 1], (double)outpos / OutRate);
+	return 0;
+}
@@ -0,0 +1,268 @@
+// -----------------------------------------------------------------------
+//   RFMDRV client (timestamped OPM writes, batched by a sender thread)
+// -----------------------------------------------------------------------
+#ifdef RFMDRV
+
+#include <stdlib.h>
+#include <errno.h>
+#include "common.h"
+#include <SDL.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../rfmdrv/rfmproto.h"
+#include "winx68k.h"
+#include "rfmdrv.h"
+
+// 相手が切れても SIGPIPE で落ちないように（無い環境はソケット側で SO_NOSIGPIPE）
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+	DWORD time;
+	BYTE port;
+	BYTE data;
+} RFM_EVENT;
+
+static int RFMSock = -1;
+static SDL_Thread *RFMThread = NULL;
+static SDL_sem *RFMSem = NULL;
+static volatile int RFMQuit = 0;
+static volatile int RFMLost = 0;		// 切断後は書き込みを捨てる
+
+// 書き込み側はエミュレーションスレッド、読み出し側は sender のみ
+static RFM_EVENT RFMRing[RFM_RING];
+static SDL_atomic_t RFMRd, RFMWr;
+static DWORD RFMDrop = 0;
+static unsigned long long RFMTicks = 0;	// 10MHz 単位の経過時間
+
+static BYTE RFMPacket[2 + RFM_BATCH * RFM_RECSIZE];
+
+static void put_le(BYTE *p, DWORD v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++, v >>= 8)
+		p[i] = (BYTE)v;
+}
+
+static int send_all(const BYTE *buf, int len)
+{
+	while (len > 0) {
+		ssize_t r = send(RFMSock, buf, len, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0) {
+			// EPIPE / ECONNRESET 等はどれも切断として扱う
+			fprintf(stderr, "RFMDRV: send failed: %s\n", (r < 0) ? strerror(errno) : "closed");
+			return FALSE;
+		}
+		buf += r;
+		len -= (int)r;
+	}
+	return TRUE;
+}
+
+// -----------------------------------------------------------------------
+//   sender スレッド: リングに溜まった分をパケットにまとめて送る
+// -----------------------------------------------------------------------
+static int rfm_drain(void)
+{
+	DWORD rd = SDL_AtomicGet(&RFMRd);
+	DWORD wr = SDL_AtomicGet(&RFMWr);
+	int work = 0;
+
+	while (rd != wr) {
+		DWORD n = wr - rd, i;
+
+		if (n > RFM_BATCH)
+			n = RFM_BATCH;
+		put_le(RFMPacket, n, 2);
+		for (i = 0; i < n; i++) {
+			RFM_EVENT *e = &RFMRing[(rd + i) & (RFM_RING - 1)];
+			BYTE *p = RFMPacket + 2 + i * RFM_RECSIZE;
+			put_le(p, e->time, 4);
+			p[4] = e->port;
+			p[5] = e->data;
+		}
+		rd += n;
+		SDL_AtomicSet(&RFMRd, (int)rd);
+		if (!send_all(RFMPacket, 2 + n * RFM_RECSIZE)) {
+			fprintf(stderr, "RFMDRV: connection lost\n");
+			RFMLost = 1;
+			return -1;
+		}
+		work = 1;
+	}
+	return work;
+}
+
+static int rfm_thread(void *arg)
+{
+	(void)arg;
+
+	while (!RFMQuit) {
+		SDL_SemWaitTimeout(RFMSem, 20);
+		if (rfm_drain() < 0)
+			return 0;
+	}
+	rfm_drain();
+	return 0;
+}
+
+// -----------------------------------------------------------------------
+//   接続: "/path" なら Unix ソケット、それ以外は "host[:port]" の TCP
+// -----------------------------------------------------------------------
+static int rfm_connect(const char *dest)
+{
+	int fd;
+#ifdef SO_NOSIGPIPE
+	int nosig = 1;
+#endif
+
+	if (dest[0] == '/') {
+		struct sockaddr_un sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, dest, sizeof(sa.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+			close(fd);
+			return -1;
+		}
+	} else {
+		struct addrinfo hints, *res, *ai;
+		char host[256], port[16];
+		const char *colon = strrchr(dest, ':');
+		int one = 1;
+
+		if (colon && (size_t)(colon - dest) < sizeof(host)) {
+			memcpy(host, dest, colon - dest);
+			host[colon - dest] = '\0';
+			snprintf(port, sizeof(port), "%s", colon + 1);
+		} else {
+			snprintf(host, sizeof(host), "%s", dest);
+			snprintf(port, sizeof(port), "%d", RFM_PORT);
+		}
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host, port, &hints, &res) != 0)
+			return -1;
+		fd = -1;
+		for (ai = res; ai; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd < 0)
+				continue;
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		if (fd < 0)
+			return -1;
+		// まとめて送るので Nagle は不要
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+#ifdef SO_NOSIGPIPE
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosig, sizeof(nosig));
+#endif
+	return fd;
+}
+
+int RFM_Init(const char *dest)
+{
+	RFM_Cleanup();
+
+	RFMSock = rfm_connect(dest);
+	if (RFMSock < 0) {
+		fprintf(stderr, "RFMDRV: can't connect to %s\n", dest);
+		return FALSE;
+	}
+	if (!send_all((const BYTE *)RFM_MAGIC, 4)) {
+		close(RFMSock);
+		RFMSock = -1;
+		return FALSE;
+	}
+
+	SDL_AtomicSet(&RFMRd, 0);
+	SDL_AtomicSet(&RFMWr, 0);
+	RFMDrop = 0;
+	RFMQuit = 0;
+	RFMLost = 0;
+	RFMSem = SDL_CreateSemaphore(0);
+	RFMThread = SDL_CreateThread(rfm_thread, "rfmdrv", NULL);
+	if (RFMSem == NULL || RFMThread == NULL) {
+		fprintf(stderr, "RFMDRV: can't start sender thread\n");
+		RFM_Cleanup();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void RFM_Cleanup(void)
+{
+	if (RFMThread) {
+		RFMQuit = 1;
+		SDL_SemPost(RFMSem);
+		SDL_WaitThread(RFMThread, NULL);
+		RFMThread = NULL;
+	}
+	if (RFMSem) {
+		SDL_DestroySemaphore(RFMSem);
+		RFMSem = NULL;
+	}
+	if (RFMSock >= 0) {
+		close(RFMSock);
+		RFMSock = -1;
+	}
+	if (RFMDrop)
+		fprintf(stderr, "RFMDRV: %u writes dropped\n", (unsigned int)RFMDrop);
+	RFMDrop = 0;
+}
+
+// ライン毎に DSound_Send0 と同じクロックで進める
+void RFM_Advance(DWORD clock)
+{
+	RFMTicks += clock;
+}
+
+void RFM_Write(BYTE port, BYTE data)
+{
+	DWORD wr, n;
+	RFM_EVENT *e;
+
+	if (RFMThread == NULL || RFMLost)
+		return;
+	wr = SDL_AtomicGet(&RFMWr);
+	n = wr - (DWORD)SDL_AtomicGet(&RFMRd);
+	if (n >= RFM_RING) {
+		// 相手が詰まっている間はエミュレーションを止めずに捨てる
+		RFMDrop++;
+		return;
+	}
+	e = &RFMRing[wr & (RFM_RING - 1)];
+	e->time = (DWORD)((RFMTicks + WinX68k_GetLineClock()) / 10);
+	e->port = port;
+	e->data = data;
+	SDL_AtomicSet(&RFMWr, (int)(wr + 1));
+	if (n + 1 == RFM_RING / 2)
+		SDL_SemPost(RFMSem);
+}
+
+// フレーム毎に sender を起こす
+void RFM_Flush(void)
+{
+	if (RFMThread && SDL_AtomicGet(&RFMWr) != SDL_AtomicGet(&RFMRd))
+		SDL_SemPost(RFMSem);
+}
+
+#endif	// RFMDRV
@@ -0,0 +1,20 @@
+#ifndef winx68k_rfmdrv_h
+#define winx68k_rfmdrv_h
+
+#include "common.h"
+
+/*
+ * RFMDRV client: OPM writes are timestamped with the emulated clock and
+ * queued in a lock-free ring; a sender thread batches them into packets
+ * for rfmdrvd, so the CPU's memory-write path never makes a syscall.
+ */
+
+#define RFM_RING	8192		// power of 2
+
+int RFM_Init(const char *dest);
+void RFM_Cleanup(void);
+void RFM_Advance(DWORD clock);
+void RFM_Write(BYTE port, BYTE data);
+void RFM_Flush(void);
+
+#endif //winx68k_rfmdrv_h
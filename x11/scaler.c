@@ -0,0 +1,344 @@
+// -----------------------------------------------------------------------
+//   ScrBuf upscaler / scanline filter (row-band worker threads)
+// -----------------------------------------------------------------------
+#include <stdlib.h>
+#include "common.h"
+#include <SDL.h>
+#include "scaler.h"
+
+#if defined(__SSE2__)
+#include	<emmintrin.h>
+#elif defined(__ARM_NEON)
+#include	<arm_neon.h>
+#endif
+
+#define SCALER_SRC_W	800
+#define SCALER_SRC_H	600
+
+typedef struct {
+	SDL_Thread *thread;
+	SDL_sem *start;
+	int y0, y1;
+} SCALER_WORKER;
+
+static int ScaleFilter = SCALER_NONE;
+static int ScaleFactor = 1;
+static WORD *ScaleBuf = NULL;
+static int ScalePitch = 0;
+
+static SCALER_WORKER Workers[SCALER_MAX_THREADS];
+static int WorkerNum = 0;
+static SDL_sem *WorkerDone = NULL;
+static volatile int WorkerQuit = 0;
+
+// 現在のジョブ（ワーカー起動前にメインスレッドが設定する）
+static const WORD *JobSrc;
+static int JobSrcPitch, JobW, JobH;
+
+// RGB565 の各成分を 1/2 に
+#define SCANLINE_DARK(p)	((WORD)(((p) >> 1) & 0x7bef))
+
+// -----------------------------------------------------------------------
+//   1 ライン分を factor 倍に横拡大
+// -----------------------------------------------------------------------
+static void scale_row(WORD *d, const WORD *s, int w, int f)
+{
+	int x = 0, i;
+
+	if (f == 2) {
+#if defined(__SSE2__)
+		for (; x + 8 <= w; x += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+			_mm_storeu_si128((__m128i *)(d + x * 2), _mm_unpacklo_epi16(v, v));
+			_mm_storeu_si128((__m128i *)(d + x * 2 + 8), _mm_unpackhi_epi16(v, v));
+		}
+#elif defined(__ARM_NEON)
+		for (; x + 8 <= w; x += 8) {
+			uint16x8x2_t v;
+			v.val[0] = v.val[1] = vld1q_u16(s + x);
+			vst2q_u16(d + x * 2, v);
+		}
+#endif
+	} else if (f == 4) {
+#if defined(__SSE2__)
+		for (; x + 8 <= w; x += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+			__m128i lo = _mm_unpacklo_epi16(v, v);
+			__m128i hi = _mm_unpackhi_epi16(v, v);
+			_mm_storeu_si128((__m128i *)(d + x * 4), _mm_unpacklo_epi32(lo, lo));
+			_mm_storeu_si128((__m128i *)(d + x * 4 + 8), _mm_unpackhi_epi32(lo, lo));
+			_mm_storeu_si128((__m128i *)(d + x * 4 + 16), _mm_unpacklo_epi32(hi, hi));
+			_mm_storeu_si128((__m128i *)(d + x * 4 + 24), _mm_unpackhi_epi32(hi, hi));
+		}
+#elif defined(__ARM_NEON)
+		for (; x + 8 <= w; x += 8) {
+			uint16x8x4_t v;
+			v.val[0] = v.val[1] = v.val[2] = v.val[3] = vld1q_u16(s + x);
+			vst4q_u16(d + x * 4, v);
+		}
+#endif
+	}
+	for (; x < w; x++) {
+		for (i = 0; i < f; i++)
+			d[x * f + i] = s[x];
+	}
+}
+
+static void darken_row(WORD *d, const WORD *s, int n)
+{
+	int x = 0;
+
+#if defined(__SSE2__)
+	__m128i m = _mm_set1_epi16(0x7bef);
+
+	for (; x + 8 <= n; x += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+		_mm_storeu_si128((__m128i *)(d + x), _mm_and_si128(_mm_srli_epi16(v, 1), m));
+	}
+#elif defined(__ARM_NEON)
+	uint16x8_t m = vdupq_n_u16(0x7bef);
+
+	for (; x + 8 <= n; x += 8)
+		vst1q_u16(d + x, vandq_u16(vshrq_n_u16(vld1q_u16(s + x), 1), m));
+#endif
+	for (; x < n; x++)
+		d[x] = SCANLINE_DARK(s[x]);
+}
+
+// -----------------------------------------------------------------------
+//   Scale2x (EPX)
+//     B: 上, D: 左, F: 右, H: 下
+// -----------------------------------------------------------------------
+static void scale2x_pixel(WORD *d0, WORD *d1, WORD b, WORD d, WORD e, WORD f, WORD h)
+{
+	if (b != h && d != f) {
+		d0[0] = (d == b) ? d : e;
+		d0[1] = (b == f) ? f : e;
+		d1[0] = (d == h) ? d : e;
+		d1[1] = (h == f) ? f : e;
+	} else {
+		d0[0] = d0[1] = d1[0] = d1[1] = e;
+	}
+}
+
+static void scale2x_row(WORD *d0, WORD *d1, const WORD *up, const WORD *s, const WORD *dn, int w)
+{
+	int x;
+
+	if (w < 2) {
+		if (w == 1)
+			scale2x_pixel(d0, d1, up[0], s[0], s[0], s[0], dn[0]);
+		return;
+	}
+
+	scale2x_pixel(d0, d1, up[0], s[0], s[0], s[1], dn[0]);
+	x = 1;
+#if defined(__SSE2__)
+	for (; x + 8 < w; x += 8) {
+		__m128i B = _mm_loadu_si128((const __m128i *)(up + x));
+		__m128i H = _mm_loadu_si128((const __m128i *)(dn + x));
+		__m128i E = _mm_loadu_si128((const __m128i *)(s + x));
+		__m128i D = _mm_loadu_si128((const __m128i *)(s + x - 1));
+		__m128i F = _mm_loadu_si128((const __m128i *)(s + x + 1));
+		__m128i ok = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(B, H), _mm_cmpeq_epi16(D, F)), _mm_set1_epi16(-1));
+		__m128i m0 = _mm_and_si128(ok, _mm_cmpeq_epi16(D, B));
+		__m128i m1 = _mm_and_si128(ok, _mm_cmpeq_epi16(B, F));
+		__m128i m2 = _mm_and_si128(ok, _mm_cmpeq_epi16(D, H));
+		__m128i m3 = _mm_and_si128(ok, _mm_cmpeq_epi16(H, F));
+		__m128i e0 = _mm_or_si128(_mm_and_si128(m0, D), _mm_andnot_si128(m0, E));
+		__m128i e1 = _mm_or_si128(_mm_and_si128(m1, F), _mm_andnot_si128(m1, E));
+		__m128i e2 = _mm_or_si128(_mm_and_si128(m2, D), _mm_andnot_si128(m2, E));
+		__m128i e3 = _mm_or_si128(_mm_and_si128(m3, F), _mm_andnot_si128(m3, E));
+		_mm_storeu_si128((__m128i *)(d0 + x * 2), _mm_unpacklo_epi16(e0, e1));
+		_mm_storeu_si128((__m128i *)(d0 + x * 2 + 8), _mm_unpackhi_epi16(e0, e1));
+		_mm_storeu_si128((__m128i *)(d1 + x * 2), _mm_unpacklo_epi16(e2, e3));
+		_mm_storeu_si128((__m128i *)(d1 + x * 2 + 8), _mm_unpackhi_epi16(e2, e3));
+	}
+#elif defined(__ARM_NEON)
+	for (; x + 8 < w; x += 8) {
+		uint16x8_t B = vld1q_u16(up + x);
+		uint16x8_t H = vld1q_u16(dn + x);
+		uint16x8_t E = vld1q_u16(s + x);
+		uint16x8_t D = vld1q_u16(s + x - 1);
+		uint16x8_t F = vld1q_u16(s + x + 1);
+		uint16x8_t ok = vmvnq_u16(vorrq_u16(vceqq_u16(B, H), vceqq_u16(D, F)));
+		uint16x8x2_t r0, r1;
+		r0.val[0] = vbslq_u16(vandq_u16(ok, vceqq_u16(D, B)), D, E);
+		r0.val[1] = vbslq_u16(vandq_u16(ok, vceqq_u16(B, F)), F, E);
+		r1.val[0] = vbslq_u16(vandq_u16(ok, vceqq_u16(D, H)), D, E);
+		r1.val[1] = vbslq_u16(vandq_u16(ok, vceqq_u16(H, F)), F, E);
+		vst2q_u16(d0 + x * 2, r0);
+		vst2q_u16(d1 + x * 2, r1);
+	}
+#endif
+	for (; x < w - 1; x++)
+		scale2x_pixel(d0 + x * 2, d1 + x * 2, up[x], s[x - 1], s[x], s[x + 1], dn[x]);
+	scale2x_pixel(d0 + x * 2, d1 + x * 2, up[x], s[x - 1], s[x], s[x], dn[x]);
+}
+
+// -----------------------------------------------------------------------
+//   ソース y0〜y1-1 ラインを処理（バンド間で書き込み先は重ならない）
+// -----------------------------------------------------------------------
+static void scale_band(int y0, int y1)
+{
+	const WORD *src = JobSrc;
+	int sp = JobSrcPitch, w = JobW, h = JobH;
+	int f = ScaleFactor, dw = w * f;
+	int y, i;
+
+	for (y = y0; y < y1; y++) {
+		const WORD *s = src + y * sp;
+		WORD *d = ScaleBuf + y * f * ScalePitch;
+
+		if (ScaleFilter == SCALER_SCALE2X) {
+			const WORD *up = (y > 0) ? s - sp : s;
+			const WORD *dn = (y < h - 1) ? s + sp : s;
+			scale2x_row(d, d + ScalePitch, up, s, dn, w);
+			continue;
+		}
+
+		scale_row(d, s, w, f);
+		for (i = 1; i < f; i++) {
+			if (ScaleFilter == SCALER_SCANLINE && i == f - 1)
+				darken_row(d + i * ScalePitch, d, dw);
+			else
+				memcpy(d + i * ScalePitch, d, dw * sizeof(WORD));
+		}
+	}
+}
+
+static int scaler_thread(void *arg)
+{
+	SCALER_WORKER *wk = (SCALER_WORKER *)arg;
+
+	for (;;) {
+		SDL_SemWait(wk->start);
+		if (WorkerQuit)
+			break;
+		scale_band(wk->y0, wk->y1);
+		SDL_SemPost(WorkerDone);
+	}
+	return 0;
+}
+
+static void scaler_stop_workers(void)
+{
+	int i;
+
+	WorkerQuit = 1;
+	for (i = 0; i < WorkerNum; i++) {
+		SDL_SemPost(Workers[i].start);
+		SDL_WaitThread(Workers[i].thread, NULL);
+		SDL_DestroySemaphore(Workers[i].start);
+	}
+	WorkerNum = 0;
+	WorkerQuit = 0;
+	if (WorkerDone) {
+		SDL_DestroySemaphore(WorkerDone);
+		WorkerDone = NULL;
+	}
+}
+
+// -----------------------------------------------------------------------
+//   threads: 0 なら CPU 数に合わせる（メインスレッドも 1 本として数える）
+// -----------------------------------------------------------------------
+int Scaler_Init(int filter, int factor, int threads)
+{
+	int i;
+
+	Scaler_Cleanup();
+
+	if (filter <= SCALER_NONE || filter >= SCALER_MAX)
+		return TRUE;
+	if (filter == SCALER_SCALE2X)
+		factor = 2;
+	if (factor < 2)
+		factor = 2;
+	if (factor > SCALER_MAX_FACTOR)
+		factor = SCALER_MAX_FACTOR;
+
+	ScalePitch = SCALER_SRC_W * factor;
+	ScaleBuf = (WORD *)malloc(ScalePitch * SCALER_SRC_H * factor * sizeof(WORD));
+	if (ScaleBuf == NULL) {
+		fprintf(stderr, "Scaler: can't allocate output buffer\n");
+		return FALSE;
+	}
+	memset(ScaleBuf, 0, ScalePitch * SCALER_SRC_H * factor * sizeof(WORD));
+	ScaleFilter = filter;
+	ScaleFactor = factor;
+
+	if (threads <= 0)
+		threads = SDL_GetCPUCount();
+	if (threads > SCALER_MAX_THREADS)
+		threads = SCALER_MAX_THREADS;
+	if (threads <= 1)
+		return TRUE;
+
+	WorkerDone = SDL_CreateSemaphore(0);
+	if (WorkerDone == NULL)
+		return TRUE;
+	for (i = 0; i < threads - 1; i++) {
+		SCALER_WORKER *wk = &Workers[WorkerNum];
+		wk->start = SDL_CreateSemaphore(0);
+		if (wk->start == NULL)
+			break;
+		wk->thread = SDL_CreateThread(scaler_thread, "scaler", wk);
+		if (wk->thread == NULL) {
+			SDL_DestroySemaphore(wk->start);
+			break;
+		}
+		WorkerNum++;
+	}
+	return TRUE;
+}
+
+void Scaler_Cleanup(void)
+{
+	scaler_stop_workers();
+	if (ScaleBuf) {
+		free(ScaleBuf);
+		ScaleBuf = NULL;
+	}
+	ScaleFilter = SCALER_NONE;
+	ScaleFactor = 1;
+	ScalePitch = 0;
+}
+
+int Scaler_GetFactor(void)
+{
+	return ScaleFactor;
+}
+
+// -----------------------------------------------------------------------
+//   拡大結果のバッファを返す（無効時は NULL）
+//     src_pitch/dst_pitch は WORD 単位
+// -----------------------------------------------------------------------
+WORD *Scaler_Run(const WORD *src, int src_pitch, int w, int h, int *dst_pitch)
+{
+	int n, i;
+
+	if (ScaleBuf == NULL)
+		return NULL;
+	if (w > SCALER_SRC_W) w = SCALER_SRC_W;
+	if (h > SCALER_SRC_H) h = SCALER_SRC_H;
+
+	JobSrc = src;
+	JobSrcPitch = src_pitch;
+	JobW = w;
+	JobH = h;
+
+	n = WorkerNum + 1;
+	if (n > h)
+		n = 1;
+	for (i = 0; i < n - 1; i++) {
+		Workers[i].y0 = h * (i + 1) / n;
+		Workers[i].y1 = h * (i + 2) / n;
+		SDL_SemPost(Workers[i].start);
+	}
+	scale_band(0, h / n);
+	for (i = 0; i < n - 1; i++)
+		SDL_SemWait(WorkerDone);
+
+	*dst_pitch = ScalePitch;
+	return ScaleBuf;
+}
@@ -0,0 +1,28 @@
+#ifndef winx68k_scaler_h
+#define winx68k_scaler_h
+
+#include "common.h"
+
+/*
+ * CPU-side upscale stage between ScrBuf and the SDL texture.
+ * Works on RGB565 and splits the frame into row bands across worker
+ * threads, so the result does not depend on renderer-side filtering.
+ */
+
+enum {
+	SCALER_NONE = 0,	/* pass ScrBuf through unchanged */
+	SCALER_INTEGER,		/* nearest-neighbour, integer factor */
+	SCALER_SCALE2X,		/* Scale2x (EPX) edge smoothing, factor fixed at 2 */
+	SCALER_SCANLINE,	/* integer factor, last row of each group darkened */
+	SCALER_MAX
+};
+
+#define SCALER_MAX_FACTOR	4
+#define SCALER_MAX_THREADS	8
+
+int Scaler_Init(int filter, int factor, int threads);
+void Scaler_Cleanup(void);
+int Scaler_GetFactor(void);
+WORD *Scaler_Run(const WORD *src, int src_pitch, int w, int h, int *dst_pitch);
+
+#endif //winx68k_scaler_h
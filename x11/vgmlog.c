@@ -0,0 +1,200 @@
+// -----------------------------------------------------------------------
+//   VGM logger (YM2151 + MSM6258)
+// -----------------------------------------------------------------------
+#include "common.h"
+#include "winx68k.h"
+#include "vgmlog.h"
+
+#define VGM_HEADER	0x100
+
+static FILE *VGMFile = NULL;
+static unsigned long long VGMTicks = 0;		// 10MHz 単位の経過時間
+static unsigned long long VGMLast = 0;		// 最後に書いた位置（サンプル）
+static unsigned long long VGMStart = 0;
+static DWORD VGMBytes = 0;
+
+// ログ開始時に今の状態を書き出すための控え
+static BYTE OPMReg[256];
+static BYTE OPMSet[256];
+static int ADPCMPan = 0x0b;
+static int ADPCMClock = 0;
+
+static void put_le(BYTE *p, DWORD v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++, v >>= 8)
+		p[i] = (BYTE)v;
+}
+
+static void vgm_put(const BYTE *p, int n)
+{
+	fwrite(p, 1, n, VGMFile);
+	VGMBytes += n;
+}
+
+static void vgm_cmd(BYTE cmd, BYTE a, BYTE d)
+{
+	BYTE b[3];
+
+	b[0] = cmd;
+	b[1] = a;
+	b[2] = d;
+	vgm_put(b, 3);
+}
+
+// -----------------------------------------------------------------------
+//   今の位置まで待ちを書く
+// -----------------------------------------------------------------------
+static void vgm_sync(void)
+{
+	unsigned long long now;
+	BYTE b[3];
+
+	now = (VGMTicks + WinX68k_GetLineClock()) * VGM_RATE / 10000000;
+	while (now > VGMLast) {
+		unsigned long long n = now - VGMLast;
+		if (n <= 16) {
+			b[0] = (BYTE)(0x70 + n - 1);
+			vgm_put(b, 1);
+		} else if (n == 735 || n == 882) {
+			b[0] = (n == 735) ? 0x62 : 0x63;
+			vgm_put(b, 1);
+		} else {
+			if (n > 65535)
+				n = 65535;
+			b[0] = 0x61;
+			put_le(b + 1, (DWORD)n, 2);
+			vgm_put(b, 3);
+		}
+		VGMLast += n;
+	}
+}
+
+static void vgm_adpcm_clock(int n)
+{
+	DWORD clk = (n & 4) ? VGM_ADPCM_CLOCK / 2 : VGM_ADPCM_CLOCK;
+	int i;
+
+	for (i = 0; i < 4; i++, clk >>= 8)
+		vgm_cmd(0xb7, (BYTE)(0x08 + i), (BYTE)clk);
+}
+
+static void vgm_header(void)
+{
+	BYTE h[VGM_HEADER];
+
+	memset(h, 0, sizeof(h));
+	memcpy(h, "Vgm ", 4);
+	put_le(h + 0x04, VGM_HEADER + VGMBytes - 4, 4);
+	put_le(h + 0x08, 0x161, 4);
+	put_le(h + 0x18, (DWORD)(VGMLast - VGMStart), 4);
+	put_le(h + 0x30, VGM_OPM_CLOCK, 4);
+	put_le(h + 0x34, VGM_HEADER - 0x34, 4);
+	put_le(h + 0x90, VGM_ADPCM_CLOCK, 4);
+	h[0x94] = 0x00;		// 1024 分周, 4bit ADPCM, 10bit 出力
+	fseek(VGMFile, 0, SEEK_SET);
+	fwrite(h, 1, sizeof(h), VGMFile);
+	fseek(VGMFile, 0, SEEK_END);
+}
+
+// -----------------------------------------------------------------------
+//   開始: 今のレジスタ状態を先頭に書いておく
+// -----------------------------------------------------------------------
+int VGMLog_Start(const char *path)
+{
+	int i;
+
+	VGMLog_Stop();
+	VGMFile = fopen(path, "wb");
+	if (VGMFile == NULL) {
+		fprintf(stderr, "VGMLog: can't create %s\n", path);
+		return FALSE;
+	}
+	VGMBytes = 0;
+	vgm_header();
+
+	VGMStart = VGMLast = (VGMTicks + WinX68k_GetLineClock()) * VGM_RATE / 10000000;
+	for (i = 0x20; i < 0x100; i++) {
+		if (OPMSet[i])
+			vgm_cmd(0x54, (BYTE)i, OPMReg[i]);
+	}
+	for (i = 0x18; i < 0x20; i++) {
+		if (OPMSet[i])
+			vgm_cmd(0x54, (BYTE)i, OPMReg[i]);
+	}
+	// TEST とノイズも戻す（0x08 のキーオンと 0x10-0x14 のタイマーは再生側で要らない）
+	if (OPMSet[0x01])
+		vgm_cmd(0x54, 0x01, OPMReg[0x01]);
+	if (OPMSet[0x0f])
+		vgm_cmd(0x54, 0x0f, OPMReg[0x0f]);
+	vgm_adpcm_clock(ADPCMClock);
+	vgm_cmd(0xb7, 0x0c, (BYTE)((ADPCMPan >> 2) & 3));
+	vgm_cmd(0xb7, 0x02, (BYTE)(ADPCMPan & 3));
+	return TRUE;
+}
+
+void VGMLog_Stop(void)
+{
+	BYTE end = 0x66;
+
+	if (VGMFile == NULL)
+		return;
+	vgm_sync();
+	vgm_put(&end, 1);
+	vgm_header();
+	fclose(VGMFile);
+	VGMFile = NULL;
+}
+
+// ライン毎に DSound_Send0 と同じクロックで進める
+void VGMLog_Advance(DWORD clock)
+{
+	VGMTicks += clock;
+}
+
+void VGMLog_OPM(BYTE reg, BYTE data)
+{
+	OPMReg[reg] = data;
+	OPMSet[reg] = 1;
+	if (VGMFile == NULL)
+		return;
+	vgm_sync();
+	vgm_cmd(0x54, reg, data);
+}
+
+// reg: MSM6258 のレジスタ（0: コマンド, 1: データ）
+void VGMLog_ADPCM(BYTE reg, BYTE data)
+{
+	if (VGMFile == NULL)
+		return;
+	vgm_sync();
+	vgm_cmd(0xb7, reg, data);
+}
+
+// n: PPI ポート C の下位 4bit（bit0-1: パン, bit2-3: 分周）
+void VGMLog_ADPCMPan(int n)
+{
+	int old = ADPCMPan;
+
+	ADPCMPan = n;
+	if (VGMFile == NULL)
+		return;
+	vgm_sync();
+	if ((old ^ n) & 0x0c)
+		vgm_cmd(0xb7, 0x0c, (BYTE)((n >> 2) & 3));
+	if ((old ^ n) & 0x03)
+		vgm_cmd(0xb7, 0x02, (BYTE)(n & 3));
+}
+
+// n: OPM CT1 由来のクロック選択（0: 8MHz, 4: 4MHz）
+void VGMLog_ADPCMClock(int n)
+{
+	int old = ADPCMClock;
+
+	ADPCMClock = n;
+	if (VGMFile == NULL || old == n)
+		return;
+	vgm_sync();
+	vgm_adpcm_clock(n);
+}
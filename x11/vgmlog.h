@@ -0,0 +1,26 @@
+#ifndef winx68k_vgmlog_h
+#define winx68k_vgmlog_h
+
+#include "common.h"
+
+/*
+ * VGM 1.61 logger for the sound chips: YM2151 (OPM) register writes and
+ * the MSM6258 (ADPCM) command, data, pan, divider and clock, stamped with
+ * emulated time.  The register shadows are kept even while idle so that a
+ * log started mid-session begins from the current chip state.
+ * px68k-render (x11/render.cpp) plays such a log back to WAV.
+ */
+
+#define VGM_RATE		44100
+#define VGM_OPM_CLOCK		4000000
+#define VGM_ADPCM_CLOCK		8000000
+
+int VGMLog_Start(const char *path);
+void VGMLog_Stop(void);
+void VGMLog_Advance(DWORD clock);
+void VGMLog_OPM(BYTE reg, BYTE data);
+void VGMLog_ADPCM(BYTE reg, BYTE data);
+void VGMLog_ADPCMPan(int n);
+void VGMLog_ADPCMClock(int n);
+
+#endif //winx68k_vgmlog_h
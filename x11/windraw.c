@@ -42,6 +42,8 @@
 #include "mouse.h"
 #include "palette.h"
 #include "prop.h"
+#include "scaler.h"
+#include "recorder.h"
 #include "status.h"
 #include "tvram.h"
 #include "joystick.h"
@@ -96,6 +98,54 @@ extern SDL_Window *sdl_window;
 SDL_Renderer *sdl_renderer = NULL;
 SDL_Texture *sdl_texture = NULL;
 
+#if !defined(PSP) && !defined(USE_OGLES11)
+// Frame hash log / duplicate frame elision
+// ログの行はエミュレーション上のフレーム番号で並べる（自動フレームスキップは
+// 実時間次第なので、飛ばしたフレームも "skip" として 1 行出す）
+static FILE *FrameHashFp = NULL;
+static DWORD FrameHashCount = 0;
+static DWORD FrameHashLast = 0;
+static int FrameHashValid = 0;
+
+#define FHASH_P1	2654435761U
+#define FHASH_P2	2246822519U
+#define FHASH_P3	3266489917U
+#define FHASH_P4	668265263U
+#define FHASH_P5	374761393U
+#define FHASH_ROTL(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
+#define FHASH_ROUND(v, in)	((v) = FHASH_ROTL((v) + (in) * FHASH_P2, 13) * FHASH_P1)
+
+// xxHash32 と同じラウンド関数で表示領域を 1 ラインずつ流し込む
+static DWORD frame_hash(const WORD *buf, int pitch, int w, int h)
+{
+	DWORD v1 = FHASH_P1 + FHASH_P2, v2 = FHASH_P2, v3 = 0, v4 = 0 - FHASH_P1;
+	DWORD hash, in[4];
+	int x, y;
+
+	for (y = 0; y < h; y++) {
+		const WORD *p = buf + y * pitch;
+		for (x = 0; x + 8 <= w; x += 8) {
+			memcpy(in, p + x, sizeof(in));
+			FHASH_ROUND(v1, in[0]);
+			FHASH_ROUND(v2, in[1]);
+			FHASH_ROUND(v3, in[2]);
+			FHASH_ROUND(v4, in[3]);
+		}
+		for (; x < w; x++)
+			v1 = FHASH_ROTL(v1 + p[x] * FHASH_P5, 11) * FHASH_P1;
+	}
+
+	hash = FHASH_ROTL(v1, 1) + FHASH_ROTL(v2, 7) + FHASH_ROTL(v3, 12) + FHASH_ROTL(v4, 18);
+	hash += ((DWORD)w << 16) ^ (DWORD)h;
+	hash ^= hash >> 15;
+	hash *= FHASH_P2;
+	hash ^= hash >> 13;
+	hash *= FHASH_P3;
+	hash ^= hash >> 16;
+	return hash;
+}
+#endif
+
 #if !defined(PSP) && !defined(USE_OGLES11)
 SDL_Surface *menu_surface = NULL;
 SDL_Texture *menu_texture = NULL;
@@ -296,15 +346,28 @@ int WinDraw_Init(void)
 	// Set scaling quality hint for better visuals
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");  // Linear filtering
 
+	if (Config.FrameHashLog[0] != '\0') {
+		FrameHashFp = fopen(Config.FrameHashLog, "w");
+		if (FrameHashFp == NULL)
+			fprintf(stderr, "can't open frame hash log: %s\n", Config.FrameHashLog);
+	}
+	FrameHashCount = 0;
+	FrameHashValid = 0;
+
+	// Optional CPU upscaler; the texture grows by the scale factor
+	if (!Scaler_Init(Config.ScaleFilter, Config.ScaleFactor, Config.ScaleThreads))
+		Scaler_Init(SCALER_NONE, 1, 0);
+
 	// Create streaming texture for frame buffer (RGB565 format, 800x600)
 	sdl_texture = SDL_CreateTexture(sdl_renderer,
 		SDL_PIXELFORMAT_RGB565,
 		SDL_TEXTUREACCESS_STREAMING,
-		800, 600);
+		800 * Scaler_GetFactor(), 600 * Scaler_GetFactor());
 	if (sdl_texture == NULL) {
 		fprintf(stderr, "SDL_CreateTexture failed: %s\n", SDL_GetError());
 		SDL_DestroyRenderer(sdl_renderer);
 		sdl_renderer = NULL;
+		Scaler_Cleanup();
 		return FALSE;
 	}
 
@@ -462,6 +525,11 @@ WinDraw_Cleanup(void)
 		SDL_DestroyTexture(sdl_texture);
 		sdl_texture = NULL;
 	}
+	Scaler_Cleanup();
+	if (FrameHashFp) {
+		fclose(FrameHashFp);
+		FrameHashFp = NULL;
+	}
 	if (sdl_renderer) {
 		SDL_DestroyRenderer(sdl_renderer);
 		sdl_renderer = NULL;
@@ -474,12 +542,16 @@ WinDraw_Redraw(void)
 {
 
 	TVRAM_SetAllDirty();
+#if !defined(PSP) && !defined(USE_OGLES11)
+	FrameHashValid = 0;
+#endif
 }
 
 void
 WinDraw_ToggleFullscreen(void)
 {
 #ifndef USE_OGLES11
+	FrameHashValid = 0;
 	FullScreenFlag = !FullScreenFlag;
 	if (FullScreenFlag) {
 		SDL_SetWindowFullscreen(sdl_window, SDL_WINDOW_FULLSCREEN_DESKTOP);
@@ -534,6 +606,16 @@ void draw_all_buttons(GLfloat *tex, GLfloat *ver, GLfloat scale, int is_menu)
 }
 #endif // USE_OGLES11
 
+// 描画しなかったフレーム（フレームスキップ）
+void WinDraw_SkipFrame(void)
+{
+#if !defined(PSP) && !defined(USE_OGLES11)
+	if (FrameHashFp)
+		fprintf(FrameHashFp, "%lu skip\n", (unsigned long)FrameHashCount);
+	FrameHashCount++;
+#endif
+}
+
 void FASTCALL
 WinDraw_Draw(void)
 {
@@ -709,19 +791,49 @@ WinDraw_Draw(void)
 #else // OpenGL ES not supported - Use SDL_Renderer
 
 	SDL_Rect src_rect, dst_rect;
+	WORD *scaled;
+	int scaled_pitch, factor;
 
 	if (sdl_renderer == NULL || sdl_texture == NULL) {
 		return;
 	}
 
-	// Update texture with ScrBuf data (RGB565 format)
-	SDL_UpdateTexture(sdl_texture, NULL, ScrBuf, 800 * sizeof(WORD));
+	Recorder_Frame(ScrBuf, 800, TextDotX, TextDotY);
+
+	// Hash the visible area; an unchanged frame needs no upload/present
+	if (FrameHashFp || Config.SkipDupFrame) {
+		int hw = (TextDotX > 800) ? 800 : TextDotX;
+		int hh = (TextDotY > 600) ? 600 : TextDotY;
+		DWORD hash = frame_hash(ScrBuf, 800, hw, hh);
+		int dup = (FrameHashValid && hash == FrameHashLast);
+
+		if (FrameHashFp)
+			fprintf(FrameHashFp, "%lu %08lx\n", (unsigned long)FrameHashCount, (unsigned long)hash);
+		FrameHashCount++;
+		FrameHashLast = hash;
+		FrameHashValid = 1;
+		if (dup && Config.SkipDupFrame)
+			goto present_done;
+	}
+
+	// Update texture with ScrBuf data (RGB565 format), upscaled on the CPU if enabled
+	factor = Scaler_GetFactor();
+	scaled = Scaler_Run(ScrBuf, 800, TextDotX, TextDotY, &scaled_pitch);
+	if (scaled) {
+		SDL_Rect upd_rect = { 0, 0, TextDotX * factor, TextDotY * factor };
+		if (upd_rect.w > 800 * factor) upd_rect.w = 800 * factor;
+		if (upd_rect.h > 600 * factor) upd_rect.h = 600 * factor;
+		SDL_UpdateTexture(sdl_texture, &upd_rect, scaled, scaled_pitch * sizeof(WORD));
+	} else {
+		factor = 1;
+		SDL_UpdateTexture(sdl_texture, NULL, ScrBuf, 800 * sizeof(WORD));
+	}
 
 	// Calculate source rectangle based on current X68000 display size
 	src_rect.x = 0;
 	src_rect.y = 0;
-	src_rect.w = TextDotX;
-	src_rect.h = TextDotY;
+	src_rect.w = TextDotX * factor;
+	src_rect.h = TextDotY * factor;
 
 	// Calculate destination rectangle to maintain aspect ratio
 	{
@@ -744,6 +856,7 @@ WinDraw_Draw(void)
 	SDL_RenderClear(sdl_renderer);
 	SDL_RenderCopy(sdl_renderer, sdl_texture, &src_rect, &dst_rect);
 	SDL_RenderPresent(sdl_renderer);
+present_done:
 
 #endif
 
@@ -1036,6 +1149,7 @@ void WinDraw_DrawLine(void)
 
 	if (Debug_Grp)
 	{
+	GVRAM_ResolveLine();	// この行が使う GVRAM の行に、保留中の高速クリアを反映
 	switch(VCReg0[1]&3)
 	{
 	case 0:					// 16 colors
@@ -1787,6 +1901,11 @@ void WinDraw_DrawMenu(int menu_state, int mkey_pos, int mkey_y, int *mval_y)
 	int i, drv;
 	char tmp[256];
 
+#if !defined(PSP) && !defined(USE_OGLES11)
+	// メニューが画面を上書きするので、戻ったら必ず描き直す
+	FrameHashValid = 0;
+#endif
+
 // set_sbp(kbd_buffer)
 #if defined(PSP) || defined(USE_OGLES11)
 	set_sbp(menu_buffer);
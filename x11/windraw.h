@@ -23,6 +23,7 @@ void WinDraw_Cleanup(void);
 void WinDraw_Redraw(void);
 void WinDraw_ToggleFullscreen(void);
 void FASTCALL WinDraw_Draw(void);
+void WinDraw_SkipFrame(void);
 void WinDraw_ShowMenu(int flag);
 void WinDraw_DrawLine(void);
 void WinDraw_HideSplash(void);
@@ -114,7 +114,7 @@ char menu_item_key[][15] = {"SYSTEM", "Joy/Mouse", "FDD0", "FDD1", "HDD0", "HDD1
 // Max # of characters is 30.
 // Max # of items including terminater `""' in each line is 15.
 char menu_items[][15][30] = {
-	{"RESET", "NMI RESET", "QUIT", ""},
+	{"RESET", "NMI RESET", "QUIT", "COMMIT OVERLAY", "DISCARD OVERLAY", ""},
 	{"Joystick", "Mouse", ""},
 	{"dummy", "EJECT", ""},
 	{"dummy", "EJECT", ""},
@@ -348,6 +348,12 @@ static void menu_system(int v)
 	case 1:
 		IRQH_Int(7, NULL);
 		break;
+	case 3:
+		WinX68k_Overlay(TRUE, TRUE);
+		break;
+	case 4:
+		WinX68k_Overlay(FALSE, TRUE);
+		break;
 	}
 }
 
@@ -444,6 +450,7 @@ static void menu_create_flist(int v)
 			FDD_EjectFD(drv);
 			Config.FDDImage[drv][0] = '\0';
 		} else {
+			SASI_Eject(drv - 2);
 			Config.HDImage[drv - 2][0] = '\0';
 		}
 		strcpy(mfl.dir[drv], cur_dir_str);
@@ -814,6 +821,7 @@ int WinUI_Menu(int first)
 						FDD_SetFD(drv, tmpstr, 0);
 						strcpy(Config.FDDImage[drv], tmpstr);
 					} else {
+						SASI_Eject(drv - 2);
 						strcpy(Config.HDImage[drv - 2], tmpstr);
 					}
 				}
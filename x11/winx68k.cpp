@@ -22,7 +22,6 @@ extern "C" {
 #include "../m68000/m68000.h"
 #include "../x68k/memory.h"
 #include "mfp.h"
-#include "opm.h"
 #include "bg.h"
 #include "adpcm.h"
 #include "mercury.h"
@@ -35,6 +34,7 @@ extern "C" {
 #include "ioc.h"
 #include "rtc.h"
 #include "sasi.h"
+#include "diskio.h"
 #include "scsi.h"
 #include "sysport.h"
 #include "bg.h"
@@ -49,10 +49,12 @@ extern "C" {
 #include "mouse.h"
 
 #include "dswin.h"
+#include "recorder.h"
+#include "vgmlog.h"
 #include "fmg_wrap.h"
 
 #ifdef RFMDRV
-int rfd_sock;
+#include "rfmdrv.h"
 #endif
 
   //#define WIN68DEBUG
@@ -98,6 +100,7 @@ BYTE ForceDebugMode = 0;
 DWORD skippedframes = 0;
 
 static int ClkUsed = 0;
+static int ExecSlice = 0, ExecLineClk = 0, ExecClkDiv = 10;	// WinX68k_GetLineClock 用
 static int FrameSkipCount = 0;
 static int FrameSkipQueue = 0;
 
@@ -254,6 +257,43 @@ WinX68k_Reset(void)
 }
 
 
+// -----------------------------------------------------------------------
+//   全イメージのオーバーレイを確定 (commit=TRUE) ・破棄する
+//   running: 動作中。イメージを一旦閉じて書き出し待ちを出し切ってから行い、
+//            FD は入れ直す（破棄した時はリセットもする）
+// -----------------------------------------------------------------------
+int
+WinX68k_Overlay(int commit, int running)
+{
+	int i, ok = TRUE;
+
+	if ( running ) {
+		SASI_Eject(-1);
+		for (i=0; i<2; i++)
+			FDD_EjectFD(i);
+	}
+	for (i=0; i<16; i++) {
+		if ( Config.HDImage[i][0] )
+			ok &= (commit)?File_OverlayCommit(Config.HDImage[i]):File_OverlayDiscard(Config.HDImage[i]);
+	}
+	for (i=0; i<2; i++) {
+		if ( Config.FDDImage[i][0] )
+			ok &= (commit)?File_OverlayCommit(Config.FDDImage[i]):File_OverlayDiscard(Config.FDDImage[i]);
+	}
+	if ( running ) {
+		for (i=0; i<2; i++) {
+			if ( Config.FDDImage[i][0] )
+				FDD_SetFD(i, Config.FDDImage[i], 0);
+		}
+		if ( !commit )
+			WinX68k_Reset();
+	}
+	if ( !ok )
+		fprintf(stderr, "Overlay: %s failed for some images\n", (commit)?"commit":"discard");
+	return ok;
+}
+
+
 int
 WinX68k_Init(void)
 {
@@ -294,6 +334,17 @@ WinX68k_Cleanup(void)
 	}
 }
 
+// -----------------------------------------------------------------------------------
+//   今のラインの開始から進んだクロック（DSound_Send0 に渡すのと同じ単位）
+//   実行中の命令のサイクルまでは分からないので、スライス内は ICount から見積もる
+// -----------------------------------------------------------------------------------
+DWORD WinX68k_GetLineClock(void)
+{
+	int m = ExecSlice-C68K.ICount-m68000_ICountBk;
+	if ( m<0 ) m = 0;
+	return (DWORD)(ExecLineClk+(m*10)/ExecClkDiv);
+}
+
 #define CLOCK_SLICE 200
 // -----------------------------------------------------------------------------------
 // 
@@ -327,6 +378,7 @@ void WinX68k_Exec(void)
 	vline = 0;
 	clk_count = -ICount;
 	clk_total = CRTC_GetVSyncClock();
+	Recorder_FrameClock(clk_total);
 	if (Config.XVIMode == 1) {
 		clk_total = (clk_total*16)/10;
 		clkdiv = 16;
@@ -336,6 +388,7 @@ void WinX68k_Exec(void)
 	} else {
 		clkdiv = 10;
 	}
+	ExecClkDiv = clkdiv;
 	ICount += clk_total;
 	clk_next = (clk_total/VLINE_TOTAL);
 	hsync = 1;
@@ -347,6 +400,7 @@ void WinX68k_Exec(void)
 		if ( hsync ) {
 			hsync = 0;
 			clk_line = 0;
+			ExecLineClk = 0;
 			MFP_Int(0);
 			if ( (vline>=CRTC_VSTART)&&(vline<CRTC_VEND) )
 				VLINE = ((vline-CRTC_VSTART)*CRTC_VStep)/2;
@@ -404,7 +458,11 @@ void WinX68k_Exec(void)
 #endif
 		{
 			C68K.ICount = n;
+			ExecSlice = n;
+			ExecLineClk = clk_line;
+			GVRAM_ResolveFetch(C68k_Get_Reg(&C68K, C68K_PC));
 			C68k_Exec(&C68K, C68K.ICount);
+			ExecSlice = 0;
 			m = (n-C68K.ICount-m68000_ICountBk);
 			ClkUsed += m*10;
 			usedclk = ClkUsed/clkdiv;
@@ -414,6 +472,7 @@ void WinX68k_Exec(void)
 			clk_count += m;
 			C68K.ICount = m68000_ICountBk = 0;
 		}
+		ExecLineClk = clk_line;
 
 		MFP_Timer(usedclk);
 		RTC_Timer(usedclk);
@@ -423,7 +482,6 @@ void WinX68k_Exec(void)
 
 		if ( clk_count>=clk_next ) {
 			//OPM_RomeoOut(Config.BufferSize*5);
-			//MIDI_DelayOut((Config.MIDIAutoDelay)?(Config.BufferSize*5):Config.MIDIDelay);
 			MFP_TimerA();
 			if ( (MFP[MFP_AER]&0x40)&&(vline==CRTC_IntLine) )
 				MFP_Int(1);
@@ -457,7 +515,12 @@ void WinX68k_Exec(void)
 				MouseIntCnt = 0;
 				SCC_IntCheck();
 			}
+			DiskIO_Advance(clk_line);
 			DSound_Send0(clk_line);
+			VGMLog_Advance(clk_line);
+#ifdef RFMDRV
+			RFM_Advance(clk_line);
+#endif
 
 			vline++;
 			clk_next  = (clk_total*(vline+1))/VLINE_TOTAL;
@@ -465,6 +528,12 @@ void WinX68k_Exec(void)
 		}
 	} while ( vline<VLINE_TOTAL );
 
+	DSound_Flush();
+#ifdef RFMDRV
+	RFM_Flush();
+#endif
+	SASI_Sync();
+
 	if ( CRTC_Mode&2 ) {		// FastClrPITAPAT
 		if ( CRTC_FastClr ) {	// FastClr=1  CRTC_Mode&2
 			CRTC_FastClr--;
@@ -486,8 +555,12 @@ void WinX68k_Exec(void)
 	Joystick_Update(FALSE, SDLK_UNKNOWN);
 #endif
 	FDD_SetFDInt();
-	if ( !DispFrame )
+	if ( !DispFrame ) {
 		WinDraw_Draw();
+	} else {
+		WinDraw_SkipFrame();
+		Recorder_Frame(NULL, 0, 0, 0);
+	}
 	TimerICount += clk_total;
 
 	t_end = timeGetTime();
@@ -501,6 +574,14 @@ void WinX68k_Exec(void)
 //
 // Command line option definitions
 //
+static char record_base[MAX_PATH];
+static char vgm_path[MAX_PATH];
+static char overlay_dir[MAX_PATH];
+static int overlay_op = 0;	// 1: 起動時に確定、2: 起動時に破棄
+#ifdef RFMDRV
+static char rfm_dest[MAX_PATH] = "127.0.0.1";
+#endif
+
 static struct option long_options[] = {
 	{"help",       no_argument,       0, 'h'},
 	{"iplrom",     required_argument, 0, 'I'},
@@ -511,6 +592,15 @@ static struct option long_options[] = {
 	{"hdd1",       required_argument, 0, 'B'},
 	{"scsirom",    required_argument, 0, 'S'},
 	{"scsiintrom", required_argument, 0, 's'},
+	{"record",     required_argument, 0, 'R'},
+	{"vgm",        required_argument, 0, 'V'},
+	{"midi",       required_argument, 0, 'M'},
+	{"overlay",    required_argument, 0, 'O'},
+	{"overlay-commit",  no_argument,  0, 'c'},
+	{"overlay-discard", no_argument,  0, 'd'},
+#ifdef RFMDRV
+	{"rfmdrv",     required_argument, 0, 'F'},
+#endif
 	{0, 0, 0, 0}
 };
 
@@ -530,6 +620,15 @@ static void print_help(const char *progname)
 	printf("  --hdd1 <file>       Set HDD1 (SASI #1) disk image\n");
 	printf("  --scsirom <file>    Set External SCSI ROM (CZ-6BS1)\n");
 	printf("  --scsiintrom <file> Set Internal SCSI ROM\n");
+	printf("  --record <base>     Record video/audio to <base>.y4m and <base>.wav\n");
+	printf("  --vgm <file>        Log OPM/ADPCM activity to a VGM file\n");
+	printf("  --midi <dev>        MIDI out: /dev/midi*, hw:C,D (ALSA rawmidi) or a file\n");
+	printf("  --overlay <dir>     Open disk images read-only, keep writes in <dir>/<image>.<hash>.ovl\n");
+	printf("  --overlay-commit    Write the overlays back into the images at startup\n");
+	printf("  --overlay-discard   Throw the overlays away at startup (pristine images)\n");
+#ifdef RFMDRV
+	printf("  --rfmdrv <dest>     rfmdrvd address: host[:port] or /unix/socket\n");
+#endif
 	printf("\n");
 	printf("Path handling:\n");
 	printf("  All file options support both absolute and relative paths.\n");
@@ -540,7 +639,7 @@ static void print_help(const char *progname)
 	printf("  Font ROM: cgrom.dat (or cgrom.tmp)\n");
 	printf("  Default location: ~/.keropi/\n");
 	printf("\n");
-	printf("Note: ROM path options (--iplrom, --cgrom, --scsirom, --scsiintrom)\n");
+	printf("Note: ROM path options (--iplrom, --cgrom, --scsirom, --scsiintrom) and --midi\n");
 	printf("  are saved and will be reused in subsequent sessions.\n");
 	printf("\n");
 	printf("Supported disk formats: XDF, D88, DIM, 2HD, HDF\n");
@@ -591,6 +690,34 @@ static int parse_command_line(int argc, char *argv[])
 			strncpy(Config.ScsiIntRomPath, optarg, MAX_PATH - 1);
 			Config.ScsiIntRomPath[MAX_PATH - 1] = '\0';
 			break;
+		case 'R':  // --record (not saved)
+			strncpy(record_base, optarg, MAX_PATH - 1);
+			record_base[MAX_PATH - 1] = '\0';
+			break;
+		case 'V':  // --vgm (not saved)
+			strncpy(vgm_path, optarg, MAX_PATH - 1);
+			vgm_path[MAX_PATH - 1] = '\0';
+			break;
+		case 'M':  // --midi
+			strncpy(Config.MIDIDevice, optarg, MAX_PATH - 1);
+			Config.MIDIDevice[MAX_PATH - 1] = '\0';
+			break;
+		case 'O':  // --overlay (not saved)
+			strncpy(overlay_dir, optarg, MAX_PATH - 1);
+			overlay_dir[MAX_PATH - 1] = '\0';
+			break;
+		case 'c':  // --overlay-commit
+			overlay_op = 1;
+			break;
+		case 'd':  // --overlay-discard
+			overlay_op = 2;
+			break;
+#ifdef RFMDRV
+		case 'F':  // --rfmdrv (not saved)
+			strncpy(rfm_dest, optarg, MAX_PATH - 1);
+			rfm_dest[MAX_PATH - 1] = '\0';
+			break;
+#endif
 		case '?':
 			// getopt_long already printed an error message
 			return -1;
@@ -693,18 +820,6 @@ int main(int argc, char *argv[])
 
 	p6logd("PX68K Ver.%s\n", PX68KVERSTR);
 
-#ifdef RFMDRV
-	struct sockaddr_in dest;
-
-	memset(&dest, 0, sizeof(dest));
-	dest.sin_port = htons(2151);
-	dest.sin_family = AF_INET;
-	dest.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-	rfd_sock = socket(AF_INET, SOCK_STREAM, 0);
-	connect (rfd_sock, (struct sockaddr *)&dest, sizeof(dest));
-#endif
-
 	if (set_modulepath(winx68k_dir, sizeof(winx68k_dir)))
 		return 1;
 
@@ -719,6 +834,14 @@ int main(int argc, char *argv[])
 		return 0;  // --help was shown or error occurred
 	}
 
+	File_SetOverlayDir(overlay_dir);
+	if (overlay_op) {
+		if (overlay_dir[0] == '\0')
+			fprintf(stderr, "--overlay-commit/--overlay-discard need --overlay <dir>\n");
+		else
+			WinX68k_Overlay(overlay_op == 1, FALSE);
+	}
+
 #ifndef NOSOUND
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
 		p6logd("SDL_Init error\n");		
@@ -829,6 +952,7 @@ int main(int argc, char *argv[])
 #endif
 	}
 
+	DiskIO_Init();
 	FDD_Init();
 	SysPort_Init();
 	Mouse_Init();
@@ -863,6 +987,18 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "Can't init sound.\n");
 	}
 
+	if (record_base[0] != '\0') {
+		if (Recorder_Start(record_base, (sdlaudio == 0) ? Config.SampleRate : 0, CRTC_GetVSyncClock()))
+			printf("Recording to %s.y4m\n", record_base);
+	}
+	if (vgm_path[0] != '\0') {
+		if (VGMLog_Start(vgm_path))
+			printf("Logging sound to %s\n", vgm_path);
+	}
+#ifdef RFMDRV
+	RFM_Init(rfm_dest);
+#endif
+
 	ADPCM_SetVolume((BYTE)Config.PCM_VOL);
 	OPM_SetVolume((BYTE)Config.OPM_VOL);
 #ifndef	NO_MERCURY
@@ -914,10 +1050,12 @@ int main(int argc, char *argv[])
 					// Window resized - renderer will adapt automatically
 					// thanks to aspect ratio calculation in WinDraw_Draw
 					p6logd("Window resized: %dx%d\n", ev.window.data1, ev.window.data2);
+					WinDraw_Redraw();
 					break;
 				case SDL_WINDOWEVENT_EXPOSED:
 					// Window needs redraw
 					Draw_DrawFlag = 1;
+					WinDraw_Redraw();
 					break;
 				}
 				break;
@@ -1147,9 +1285,17 @@ end_loop:
 	Joystick_Cleanup();
 	SRAM_Cleanup();
 	FDD_Cleanup();
+	SASI_Cleanup();
+	SCSI_Cleanup();
+	DiskIO_Cleanup();
 	//CDROM_Cleanup();
 	MIDI_Cleanup();
 	DSound_Cleanup();
+	Recorder_Stop();
+	VGMLog_Stop();
+#ifdef RFMDRV
+	RFM_Cleanup();
+#endif
 	WinX68k_Cleanup();
 	WinDraw_Cleanup();
 	WinDraw_CleanupScreen();
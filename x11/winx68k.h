@@ -3,14 +3,6 @@
 
 #include "common.h"
 
-#ifdef RFMDRV
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-
-extern int rfd_sock;
-#endif
-
 #define vline HOGEvline // workaround for redefinition of 'vline'
 
 #define		SCREEN_WIDTH		768
@@ -43,6 +35,8 @@ extern int realdisp_w, realdisp_h;
 #endif
 
 int WinX68k_Reset(void);
+int WinX68k_Overlay(int commit, int running);
+DWORD WinX68k_GetLineClock(void);
 
 #ifndef	winx68k_gtkwarpper_h
 #define	winx68k_gtkwarpper_h
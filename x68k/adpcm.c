@@ -11,18 +11,21 @@
 #include "pia.h"
 #include "adpcm.h"
 #include "dmac.h"
+#include "vgmlog.h"
 
 #define ADPCM_BufSize      96000
+#define ADPCM_NibBufSize   1024		// デコード待ちのバイト数（DMA 1 バースト分を想定）
+#define ADPCM_BlockSize    256		// ADPCM_Update の 1 ブロック
+#define ADPCM_IPBITS       14		// 補間係数の精度
 #define ADPCMMAX           2047
 #define ADPCMMIN          -2048
 #define FM_IPSCALE         256L
 
 #define OVERSAMPLEMUL      2
 
-#define INTERPOLATE(y, x)	\
-	(((((((-y[0]+3*y[1]-3*y[2]+y[3]) * x + FM_IPSCALE/2) / FM_IPSCALE \
-	+ 3 * (y[0]-2*y[1]+y[2])) * x + FM_IPSCALE/2) / FM_IPSCALE \
-	- 2*y[0]-3*y[1]+6*y[2]-y[3]) * x + 3*FM_IPSCALE) / (6*FM_IPSCALE) + y[1])
+// 4 点 Lagrange 補間（y[1]〜y[2] 間）。係数は位相ごとに ADPCM_IpTable に展開済み
+#define INTERPOLATE(y, c)	\
+	((y[0]*c[0] + y[1]*c[1] + y[2]*c[2] + y[3]*c[3] + (1<<(ADPCM_IPBITS-1))) >> ADPCM_IPBITS)
 
 static int ADPCM_VolumeShift = 65536;
 static const int index_shift[16] = {
@@ -31,6 +34,7 @@ static const int index_shift[16] = {
 static const int ADPCM_Clocks[8] = {
 	93750, 125000, 187500, 125000, 46875, 62500, 93750, 62500 };
 static int dif_table[49*16];
+static int ADPCM_IpTable[FM_IPSCALE][4];
 static signed short ADPCM_BufR[ADPCM_BufSize];
 static signed short ADPCM_BufL[ADPCM_BufSize];
 
@@ -39,6 +43,7 @@ static long ADPCM_RdPtr = 0;
 static DWORD ADPCM_SampleRate = 44100*12;
        DWORD ADPCM_ClockRate = 7800*12;
 static DWORD ADPCM_Count = 0;
+static DWORD ADPCM_PhaseMul = 0;		// Count → 補間位相 (FM_IPSCALE/SampleRate, 32bit 固定小数)
 static int ADPCM_Step = 0;
 static int ADPCM_Out = 0;
 static BYTE ADPCM_Playing = 0;
@@ -51,8 +56,9 @@ static int ADPCM_Pan = 0x00;
 static int OldR = 0, OldL = 0;
 static int Outs[8];
 static int OutsIp[4];
-static int OutsIpR[4];
-static int OutsIpL[4];
+
+static BYTE ADPCM_NibBuf[ADPCM_NibBufSize];
+static int ADPCM_NibCount = 0;
 
 int ADPCM_IsReady(void)
 {
@@ -85,6 +91,14 @@ static void ADPCM_InitTable(void)
 				 val/8);
 		}
 	}
+
+	for (n=0; n<FM_IPSCALE; n++) {
+		double t = (double)n/FM_IPSCALE, sc = (double)(1<<ADPCM_IPBITS);
+		ADPCM_IpTable[n][0] = (int)floor(sc*(-t*t*t + 3*t*t - 2*t)/6 + 0.5);
+		ADPCM_IpTable[n][1] = (int)floor(sc*(3*t*t*t - 6*t*t - 3*t + 6)/6 + 0.5);
+		ADPCM_IpTable[n][2] = (int)floor(sc*(-3*t*t*t + 3*t*t + 6*t)/6 + 0.5);
+		ADPCM_IpTable[n][3] = (int)floor(sc*(t*t*t - t)/6 + 0.5);
+	}
 }
 
 
@@ -112,103 +126,117 @@ void FASTCALL ADPCM_PreUpdate(DWORD clock)
 
 
 // -----------------------------------------------------------------------
-//   DSoundが指定してくる分だけバッファにデータを書き出す
+//   溜めておいたバイト列をまとめてデコードし、出力レートに補間してバッファへ
 // -----------------------------------------------------------------------
-void FASTCALL ADPCM_Update(signed short *buffer, DWORD length, int rate, BYTE *pbsp, BYTE *pbep)
+static void ADPCM_Decode(void)
 {
-	int outs;
-	signed int outl, outr;
-
-	if ( length<=0 ) return;
-
-	while ( length ) {
-		if (buffer >= (signed short *)pbep) {
-			buffer = (signed short *)pbsp;
-		}
-		int tmpl, tmpr;
-
-		if ( (ADPCM_WrPtr==ADPCM_RdPtr)&&(!(DMA[3].CCR&0x40)) ) DMA_Exec(3);
-		if ( ADPCM_WrPtr!=ADPCM_RdPtr ) {
-			OldR = outr = ADPCM_BufR[ADPCM_RdPtr];
-			OldL = outl = ADPCM_BufL[ADPCM_RdPtr];
-			ADPCM_RdPtr++;
-			if ( ADPCM_RdPtr>=ADPCM_BufSize ) ADPCM_RdPtr = 0;
+	int dec[ADPCM_NibBufSize*2];
+	int i, n = ADPCM_NibCount*2;
+	int out = ADPCM_Out, step = ADPCM_Step;
+	int maskr = (ADPCM_Pan&1) ? 0 : -1;
+	int maskl = (ADPCM_Pan&2) ? 0 : -1;
+	long wr = ADPCM_WrPtr;
+	DWORD count = ADPCM_Count;
+
+	if ( !n ) return;
+
+	// 差分の積算は逐次依存なので先にまとめて済ませる
+	for (i=0; i<n; i++) {
+		int val = (i&1) ? (ADPCM_NibBuf[i>>1]>>4) : (ADPCM_NibBuf[i>>1]&15);
+		out += dif_table[step+val];
+		if ( out>ADPCMMAX ) out = ADPCMMAX; else if ( out<ADPCMMIN ) out = ADPCMMIN;
+		step += index_shift[val];
+		if ( step>(48*16) ) step = (48*16); else if ( step<0 ) step = 0;
+		dec[i] = out;
+	}
+	ADPCM_Out = out;
+	ADPCM_Step = step;
+	ADPCM_NibCount = 0;
+
+	for (i=0; i<n; i++) {
+		if ( OutsIp[0]==-1 ) {
+			OutsIp[0] =
+			OutsIp[1] =
+			OutsIp[2] =
+			OutsIp[3] = dec[i];
 		} else {
-			outr = OldR;
-			outl = OldL;
+			OutsIp[0] = OutsIp[1];
+			OutsIp[1] = OutsIp[2];
+			OutsIp[2] = OutsIp[3];
+			OutsIp[3] = dec[i];
 		}
 
-		if ( Config.Sound_LPF ) {
-			outr = (int)(outr*40*ADPCM_VolumeShift);
-			outs = (outr + Outs[3]*2 + Outs[2] + Outs[1]*157 - Outs[0]*61) >> 8;
-			Outs[2] = Outs[3];
-			Outs[3] = outr;
-			Outs[0] = Outs[1];
-			Outs[1] = outs;
-		} else {
-			outs = (int)(outr*ADPCM_VolumeShift);
+		while ( ADPCM_SampleRate>count ) {
+			const int *c = ADPCM_IpTable[(DWORD)(((unsigned long long)count*ADPCM_PhaseMul)>>32)];
+			int tmp = INTERPOLATE(OutsIp, c);
+			if ( tmp>ADPCMMAX ) tmp = ADPCMMAX; else if ( tmp<ADPCMMIN ) tmp = ADPCMMIN;
+			ADPCM_BufR[wr] = (short)(tmp&maskr);
+			ADPCM_BufL[wr] = (short)(tmp&maskl);
+			if ( ++wr>=ADPCM_BufSize ) wr = 0;
+			count += ADPCM_ClockRate;
 		}
+		count -= ADPCM_SampleRate;
+	}
+	ADPCM_WrPtr = wr;
+	ADPCM_Count = count;
+}
 
-		OutsIpR[0] = OutsIpR[1];
-		OutsIpR[1] = OutsIpR[2];
-		OutsIpR[2] = OutsIpR[3];
-		OutsIpR[3] = outs;
 
-		if ( Config.Sound_LPF ) {
-			outl = (int)(outl*40*ADPCM_VolumeShift);
-			outs = (outl + Outs[7]*2 + Outs[6] + Outs[5]*157 - Outs[4]*61) >> 8;
-			Outs[6] = Outs[7];
-			Outs[7] = outl;
-			Outs[4] = Outs[5];
-			Outs[5] = outs;
-		} else {
-			outs = (int)(outl*ADPCM_VolumeShift);
-		}
+// -----------------------------------------------------------------------
+//   指定された分だけ buffer（R,L 交互の int、飽和はミキサー側）に書き出す
+// -----------------------------------------------------------------------
+void FASTCALL ADPCM_Update(int *buffer, DWORD length)
+{
+	int bufr[ADPCM_BlockSize], bufl[ADPCM_BlockSize];
+	int i, n;
 
-		OutsIpL[0] = OutsIpL[1];
-		OutsIpL[1] = OutsIpL[2];
-		OutsIpL[2] = OutsIpL[3];
-		OutsIpL[3] = outs;
-
-#if 1
-		// Use latest sample (OutsIpR[3], OutsIpL[3]) for proper output
-		// ratio=0 was returning OutsIpR[1] which caused 2-sample delay
-		tmpr = OutsIpR[3];
-		if ( tmpr>32767 ) tmpr = 32767; else if ( tmpr<(-32768) ) tmpr = -32768;
-		*(buffer++) = (short)tmpr;
-		tmpl = OutsIpL[3];
-		if ( tmpl>32767 ) tmpl = 32767; else if ( tmpl<(-32768) ) tmpl = -32768;
-		*(buffer++) = (short)tmpl;
-		// PSP以外はrateは0
-		if (rate == 22050) {
-			if (buffer >= (signed short *)pbep) {
-				buffer = (signed short *)pbsp;
+	if ( length<=0 ) return;
+
+	ADPCM_Decode();
+
+	while ( length ) {
+		n = (length>ADPCM_BlockSize) ? ADPCM_BlockSize : (int)length;
+
+		// リングから 1 ブロック取り出す（空なら DMA を回して補充）
+		for (i=0; i<n; i++) {
+			if ( (ADPCM_WrPtr==ADPCM_RdPtr)&&(!(DMA[3].CCR&0x40)) ) {
+				DMA_Exec(3);
+				ADPCM_Decode();
 			}
-			*(buffer++) = (short)tmpr;
-			*(buffer++) = (short)tmpl;
-		} else if (rate == 11025) {
-			if (buffer >= (signed short *)pbep) {
-				buffer = (signed short *)pbsp;
+			if ( ADPCM_WrPtr!=ADPCM_RdPtr ) {
+				OldR = ADPCM_BufR[ADPCM_RdPtr];
+				OldL = ADPCM_BufL[ADPCM_RdPtr];
+				if ( ++ADPCM_RdPtr>=ADPCM_BufSize ) ADPCM_RdPtr = 0;
 			}
-			*(buffer++) = (short)tmpr;
-			*(buffer++) = (short)tmpl;
-			if (buffer >= (signed short *)pbep) {
-				buffer = (signed short *)pbsp;
+			bufr[i] = OldR;
+			bufl[i] = OldL;
+		}
+
+		// 音量と LPF（LPF は漸化式なので L/R を並べて回す）
+		if ( Config.Sound_LPF ) {
+			int vol = 40*ADPCM_VolumeShift;
+			int r0 = Outs[0], r1 = Outs[1], r2 = Outs[2], r3 = Outs[3];
+			int l0 = Outs[4], l1 = Outs[5], l2 = Outs[6], l3 = Outs[7];
+			for (i=0; i<n; i++) {
+				int inr = bufr[i]*vol, inl = bufl[i]*vol;
+				int outr = (inr + r3*2 + r2 + r1*157 - r0*61) >> 8;
+				int outl = (inl + l3*2 + l2 + l1*157 - l0*61) >> 8;
+				r2 = r3; r3 = inr; r0 = r1; r1 = outr;
+				l2 = l3; l3 = inl; l0 = l1; l1 = outl;
+				*(buffer++) = outr;
+				*(buffer++) = outl;
 			}
-			*(buffer++) = (short)tmpr;
-			*(buffer++) = (short)tmpl;
-			if (buffer >= (signed short *)pbep) {
-				buffer = (signed short *)pbsp;
+			Outs[0] = r0; Outs[1] = r1; Outs[2] = r2; Outs[3] = r3;
+			Outs[4] = l0; Outs[5] = l1; Outs[6] = l2; Outs[7] = l3;
+		} else {
+			int vol = ADPCM_VolumeShift;
+			for (i=0; i<n; i++) {
+				*(buffer++) = bufr[i]*vol;
+				*(buffer++) = bufl[i]*vol;
 			}
-			*(buffer++) = (short)tmpr;
-			*(buffer++) = (short)tmpl;
 		}
-#else
-		*(buffer++) = (short)OutsIpR[3];
-		*(buffer++) = (short)OutsIpL[3];
-#endif
 
-		length--;
+		length -= n;
 	}
 
 	ADPCM_DifBuf = ADPCM_WrPtr-ADPCM_RdPtr;
@@ -216,55 +244,14 @@ void FASTCALL ADPCM_Update(signed short *buffer, DWORD length, int rate, BYTE *p
 }
 
 
-// -----------------------------------------------------------------------
-//   1nibble（4bit）をデコード
-// -----------------------------------------------------------------------
-INLINE void ADPCM_WriteOne(int val)
-{
-	ADPCM_Out += dif_table[ADPCM_Step+val];
-	if ( ADPCM_Out>ADPCMMAX ) ADPCM_Out = ADPCMMAX; else if ( ADPCM_Out<ADPCMMIN ) ADPCM_Out = ADPCMMIN;
-	ADPCM_Step += index_shift[val];
-	if ( ADPCM_Step>(48*16) ) ADPCM_Step = (48*16); else if ( ADPCM_Step<0 ) ADPCM_Step = 0;
-
-	if ( OutsIp[0]==-1 ) {
-		OutsIp[0] =
-		OutsIp[1] =
-		OutsIp[2] =
-		OutsIp[3] = ADPCM_Out;
-	} else {
-		OutsIp[0] = OutsIp[1];
-		OutsIp[1] = OutsIp[2];
-		OutsIp[2] = OutsIp[3];
-		OutsIp[3] = ADPCM_Out;
-	}
-
-	while ( ADPCM_SampleRate>ADPCM_Count ) {
-		if ( ADPCM_Playing ) {
-			int ratio = (((ADPCM_Count/100)*FM_IPSCALE)/(ADPCM_SampleRate/100));
-			int tmp = INTERPOLATE(OutsIp, ratio);
-			if ( tmp>ADPCMMAX ) tmp = ADPCMMAX; else if ( tmp<ADPCMMIN ) tmp = ADPCMMIN;
-			if ( !(ADPCM_Pan&1) )
-				ADPCM_BufR[ADPCM_WrPtr] = (short)tmp;
-			else
-				ADPCM_BufR[ADPCM_WrPtr] = 0;
-			if ( !(ADPCM_Pan&2) )
-				ADPCM_BufL[ADPCM_WrPtr++] = (short)tmp;
-			else
-				ADPCM_BufL[ADPCM_WrPtr++] = 0;
-			if ( ADPCM_WrPtr>=ADPCM_BufSize ) ADPCM_WrPtr = 0;
-		}
-		ADPCM_Count += ADPCM_ClockRate;
-	}
-	ADPCM_Count -= ADPCM_SampleRate;
-}
-
-
 // -----------------------------------------------------------------------
 //   I/O Write
 // -----------------------------------------------------------------------
 void FASTCALL ADPCM_Write(DWORD adr, BYTE data)
 {
 	if ( adr==0xe92001 ) {
+		VGMLog_ADPCM(0, data);
+		ADPCM_Decode();
 		if ( data&1 ) {
 			ADPCM_Playing = 0;
 		} else if ( data&2 ) {
@@ -277,9 +264,11 @@ void FASTCALL ADPCM_Write(DWORD adr, BYTE data)
 			OutsIp[0] = OutsIp[1] = OutsIp[2] = OutsIp[3] = -1;
 		}
 	} else if ( adr==0xe92003 ) {
+		VGMLog_ADPCM(1, data);
 		if ( ADPCM_Playing ) {
-			ADPCM_WriteOne((int)(data&15));
-			ADPCM_WriteOne((int)((data>>4)&15));
+			// デコードは ADPCM_Update かパン/クロック変更時にまとめて行う
+			ADPCM_NibBuf[ADPCM_NibCount++] = data;
+			if ( ADPCM_NibCount>=ADPCM_NibBufSize ) ADPCM_Decode();
 		}
 	}
 }
@@ -317,6 +306,8 @@ void ADPCM_SetVolume(BYTE vol)
 // -----------------------------------------------------------------------
 void ADPCM_SetPan(int n)
 {
+	VGMLog_ADPCMPan(n);
+	ADPCM_Decode();
 	if ( (ADPCM_Pan&0x0c)!=(n&0x0c) ) {
 		ADPCM_Count = 0;
 		ADPCM_Clock = (ADPCM_Clock&4)|((n>>2)&3);
@@ -331,6 +322,8 @@ void ADPCM_SetPan(int n)
 // -----------------------------------------------------------------------
 void ADPCM_SetClock(int n)
 {
+	VGMLog_ADPCMClock(n);
+	ADPCM_Decode();
 	if ( (ADPCM_Clock&4)!=n ) {
 		ADPCM_Count = 0;
 		ADPCM_Clock = n|((ADPCM_Pan>>2)&3);
@@ -350,11 +343,11 @@ void ADPCM_Init(DWORD samplerate)
 	ADPCM_Step = 0;
 	ADPCM_Playing = 0;
 	ADPCM_SampleRate = (samplerate*12);
+	ADPCM_PhaseMul = (DWORD)(((unsigned long long)FM_IPSCALE<<32)/ADPCM_SampleRate);
 	ADPCM_PreCounter = 0;
+	ADPCM_NibCount = 0;
 	memset(Outs, 0, sizeof(Outs));
 	OutsIp[0] = OutsIp[1] = OutsIp[2] = OutsIp[3] = -1;
-	OutsIpR[0] = OutsIpR[1] = OutsIpR[2] = OutsIpR[3] = 0;
-	OutsIpL[0] = OutsIpL[1] = OutsIpL[2] = OutsIpL[3] = 0;
 	OldL = OldR = 0;
 
 	ADPCM_SetPan(0x0b);
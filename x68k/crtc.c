@@ -11,6 +11,11 @@
 #include	"m68000.h"
 #include	"crtc.h"
 
+#if defined(__SSE2__)
+#include	<emmintrin.h>
+#elif defined(__ARM_NEON)
+#include	<arm_neon.h>
+#endif
 
 static WORD FastClearMask[16] = {
 	0xffff, 0xfff0, 0xff0f, 0xff00, 0xf0ff, 0xf0f0, 0xf00f, 0xf000,
@@ -83,6 +88,48 @@ const char* CRTC_GetDispFreqStr(void)
 }
 
 
+// 16バイト単位のコピーと、展開済みテキストのプレーン単位ブレンド
+INLINE void rc_copy16(BYTE *d, const BYTE *s)
+{
+#if defined(__SSE2__)
+	_mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+#elif defined(__ARM_NEON)
+	vst1q_u8(d, vld1q_u8(s));
+#else
+	memcpy(d, s, 16);
+#endif
+}
+
+static void rc_blend_work(BYTE *d, const BYTE *s, BYTE planes)
+{
+	DWORD i;
+
+	if (planes == 15) {
+		for (i = 0; i < 4096; i += 16)
+			rc_copy16(d + i, s + i);
+		return;
+	}
+#if defined(__SSE2__)
+	{
+		__m128i m = _mm_set1_epi8((char)planes);
+		for (i = 0; i < 4096; i += 16) {
+			__m128i vs = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + i)), m);
+			__m128i vd = _mm_andnot_si128(m, _mm_loadu_si128((const __m128i *)(d + i)));
+			_mm_storeu_si128((__m128i *)(d + i), _mm_or_si128(vd, vs));
+		}
+	}
+#elif defined(__ARM_NEON)
+	{
+		uint8x16_t m = vdupq_n_u8(planes);
+		for (i = 0; i < 4096; i += 16)
+			vst1q_u8(d + i, vbslq_u8(m, vld1q_u8(s + i), vld1q_u8(d + i)));
+	}
+#else
+	for (i = 0; i < 4096; i++)
+		d[i] = (d[i] & ~planes) | (s[i] & planes);
+#endif
+}
+
 // -----------------------------------------------------------------------
 //   らすたーこぴー
 // -----------------------------------------------------------------------
@@ -165,6 +212,7 @@ void CRTC_RasterCopy(void)
 		dec	dl
 		jnz	rcdirtylp
 	}
+	TVRAM_RCUpdate();
 #elif defined(USE_GAS) && defined(__i386__)
 	if (CRTC_Regs[0x2b] & 1) {
 		asm (
@@ -248,16 +296,25 @@ void CRTC_RasterCopy(void)
 	: /* output: nothing */
 	: "m" (line), "g" (TextScrollY)
 	: "cx", "dx", "memory");
+	TVRAM_RCUpdate();
 #else /* !USE_ASM && !(USE_GAS && __i386__) */
 {
 	static const DWORD off[4] = { 0, 0x20000, 0x40000, 0x60000 };
-	int i, bit;
-
-	for (bit = 0; bit < 4; bit++) {
-		if (CRTC_Regs[0x2b] & (1 << bit)) {
-			memmove(&TVRAM[dst + off[bit]], &TVRAM[src + off[bit]],
-			    sizeof(DWORD) * 128);
+	BYTE planes = CRTC_Regs[0x2b] & 15;
+	DWORD i;
+	int bit;
+
+	// 選択された全プレーンを1パスでコピー（4ライン = 各プレーン512バイト）
+	if (planes && src != dst) {
+		for (i = 0; i < 512; i += 16) {
+			for (bit = 0; bit < 4; bit++) {
+				if (planes & (1 << bit))
+					rc_copy16(&TVRAM[dst + off[bit] + i], &TVRAM[src + off[bit] + i]);
+			}
 		}
+		// 展開済みテキスト（1ドット1バイト、bit0-3 がプレーン0-3）も
+		// コピーしたプレーンのビットだけ転送元から持ってくる
+		rc_blend_work(&TextDrawWork[dst << 3], &TextDrawWork[src << 3], planes);
 	}
 
 	line = (line - TextScrollY) & 0x3ff;
@@ -267,8 +324,6 @@ void CRTC_RasterCopy(void)
 	}
 }
 #endif	/* USE_ASM */
-
-	TVRAM_RCUpdate();
 }
 
 
@@ -348,6 +403,8 @@ void CRTC_Init(void)
 	TextScrollX = 0, TextScrollY = 0;
 	ZeroMemory(GrphScrollX, sizeof(GrphScrollX));
 	ZeroMemory(GrphScrollY, sizeof(GrphScrollY));
+	GVRAM_SetAccessMode();
+	TVRAM_SetAccessMode();
 }
 
 
@@ -445,6 +502,7 @@ void FASTCALL CRTC_Write(DWORD adr, BYTE data)
 			break;
 		case 0x28:
 			TVRAM_SetAllDirty();
+			GVRAM_SetAccessMode();
 			break;
 		case 0x29:
 			HSYNC_CLK = CRTC_GetVSyncClock()/VLINE_TOTAL;
@@ -508,6 +566,8 @@ void FASTCALL CRTC_Write(DWORD adr, BYTE data)
 			GrphScrollY[3] = (((DWORD)CRTC_Regs[0x26]<<8)+CRTC_Regs[0x27])&511;
 			break;
 		case 0x2a:
+			TVRAM_SetAccessMode();
+			break;
 		case 0x2b:
 			break;
 		case 0x2c:				// CRTC動作ポートのラスタコピーをONにしておいて（しておいたまま）、
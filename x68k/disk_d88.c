@@ -59,7 +59,7 @@ int D88_SetFD(int drv, char* filename)
 	strncpy(D88File[drv], filename, MAX_PATH);
 	D88File[drv][MAX_PATH-1] = 0;
 
-	fp = File_Open(D88File[drv]);
+	fp = File_OpenImage(D88File[drv]);
 	if ( !fp ) {
 		ZeroMemory(D88File[drv], MAX_PATH);
 		return FALSE;
@@ -67,7 +67,7 @@ int D88_SetFD(int drv, char* filename)
 	File_Seek(fp, 0, FSEEK_SET);
 	if ( File_Read(fp, &D88Head[drv], sizeof(D88_HEADER))!=sizeof(D88_HEADER) ) goto d88_set_error;
 
-	if ( D88Head[drv].protect ) {
+	if ( D88Head[drv].protect || File_IsReadOnly(fp) ) {
 		FDD_SetReadOnly(drv);
 	}
 
@@ -111,7 +111,7 @@ int D88_Eject(int drv)
 	if ( !D88File[drv][0] ) return FALSE;
 
 	if ( !FDD_IsReadOnly(drv) ) {
-		fp = File_Open(D88File[drv]);
+		fp = File_OpenImage(D88File[drv]);
 		if ( fp ) {
 			pos = sizeof(D88_HEADER);
 			for (trk=0; trk<164; trk++) {
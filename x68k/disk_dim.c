@@ -65,13 +65,16 @@ int DIM_SetFD(int drv, char* filename)
 	DIMImg[drv] = (unsigned char*)malloc(1024*9*170+sizeof(DIM_HEADER));		// Maximum size
 	if ( !DIMImg[drv] ) return FALSE;
 	memset(DIMImg[drv], 0xe5, 1024*9*170+sizeof(DIM_HEADER));
-	fp = File_Open(DIMFile[drv]);
+	fp = File_OpenImage(DIMFile[drv]);
 	if ( !fp ) {
 		ZeroMemory(DIMFile[drv], MAX_PATH);
 		FDD_SetReadOnly(drv);
 		return FALSE;
 	}
 
+	if ( File_IsReadOnly(fp) ) {
+		FDD_SetReadOnly(drv);
+	}
 	File_Seek(fp, 0, FSEEK_SET);
 	if ( File_Read(fp, DIMImg[drv], sizeof(DIM_HEADER))!=sizeof(DIM_HEADER) ) goto dim_set_error;
 	dh = (DIM_HEADER*)DIMImg[drv];
@@ -111,7 +114,7 @@ int DIM_Eject(int drv)
 	len = SctLength[dh->type];
 	p = DIMImg[drv]+sizeof(DIM_HEADER);
 	if ( !FDD_IsReadOnly(drv) ) {
-		fp = File_Open(DIMFile[drv]);
+		fp = File_OpenImage(DIMFile[drv]);
 		if ( !fp ) goto dim_eject_error;
 		File_Seek(fp, 0, FSEEK_SET);
 		if ( File_Write(fp, DIMImg[drv], sizeof(DIM_HEADER))!=sizeof(DIM_HEADER) ) goto dim_eject_error;
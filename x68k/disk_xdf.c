@@ -38,12 +38,15 @@ int XDF_SetFD(int drv, char* filename)
 	XDFImg[drv] = (unsigned char*)malloc(1261568);
 	if ( !XDFImg[drv] ) return FALSE;
 	memset(XDFImg[drv], 0xe5, 1261568);
-	fp = File_Open(XDFFile[drv]);
+	fp = File_OpenImage(XDFFile[drv]);
 	if ( !fp ) {
 		ZeroMemory(XDFFile[drv], MAX_PATH);
 		FDD_SetReadOnly(drv);
 		return FALSE;
 	}
+	if ( File_IsReadOnly(fp) ) {
+		FDD_SetReadOnly(drv);
+	}
 	File_Seek(fp, 0, FSEEK_SET);
 	File_Read(fp, XDFImg[drv], 1261568);
 	File_Close(fp);
@@ -60,7 +63,7 @@ int XDF_Eject(int drv)
 		return FALSE;
 	}
 	if ( !FDD_IsReadOnly(drv) ) {
-		fp = File_Open(XDFFile[drv]);
+		fp = File_OpenImage(XDFFile[drv]);
 		if ( !fp ) goto xdf_eject_error;
 		File_Seek(fp, 0, FSEEK_SET);
 		if ( File_Write(fp, XDFImg[drv], 1261568)!=1261568 ) goto xdf_eject_error;
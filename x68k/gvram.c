@@ -12,6 +12,12 @@
 #include	"m68000.h"
 #include	"memory.h"
 
+#if defined(__SSE2__)
+#include	<emmintrin.h>
+#elif defined(__ARM_NEON)
+#include	<arm_neon.h>
+#endif
+
 	BYTE	GVRAM[0x80000];
 	WORD	Grp_LineBuf[1024];
 	WORD	Grp_LineBufSP[1024];		// 特殊プライオリティ／半透明用バッファ
@@ -19,6 +25,12 @@
 
 	WORD	Pal16Adr[256];			// 16bit color パレットアドレス計算用
 
+static	BYTE	FastClrPend[512];		// 高速クリア保留中のライン
+static	WORD	FastClrPendMask[512];
+static	WORD	FastClrPendX[512];
+static	WORD	FastClrPendW[512];
+static	DWORD	FastClrPendCount = 0;
+
 // xxx: for little endian only
 #define GET_WORD_W8(src) (*(BYTE *)(src) | *((BYTE *)(src) + 1) << 8)
 
@@ -31,6 +43,8 @@ void GVRAM_Init(void)
 	int i;
 
 	ZeroMemory(GVRAM, 0x80000);
+	ZeroMemory(FastClrPend, sizeof(FastClrPend));
+	FastClrPendCount = 0;
 	for (i=0; i<128; i++)			// 16bit color パレットアドレス計算用
 	{
 		Pal16Adr[i*2] = i*4;
@@ -42,246 +56,340 @@ void GVRAM_Init(void)
 // -----------------------------------------------------------------------------------
 //  高速クリア用ルーチン
 // -----------------------------------------------------------------------------------
+// The fast clear is not applied to GVRAM when it is issued.  Each affected
+// row only records the mask and the horizontal window, and the AND is done
+// the next time the row is drawn (GVRAM_ResolveLine) or accessed by the CPU
+// or DMA.  A row cleared again before it is looked at just merges the mask.
+
+static void gvram_and_mask(WORD *p, WORD mask, DWORD n)
+{
+#if defined(__SSE2__)
+	__m128i m = _mm_set1_epi16((short)mask);
+
+	for (; n >= 8; n -= 8, p += 8)
+		_mm_storeu_si128((__m128i *)p,
+		    _mm_and_si128(_mm_loadu_si128((__m128i *)p), m));
+#elif defined(__ARM_NEON)
+	uint16x8_t m = vdupq_n_u16(mask);
+
+	for (; n >= 8; n -= 8, p += 8)
+		vst1q_u16(p, vandq_u16(vld1q_u16(p), m));
+#endif
+	for (; n > 0; n--)
+		*p++ &= mask;
+}
+
+static void FASTCALL GVRAM_ResolveRow(DWORD row)
+{
+	WORD *p = (WORD *)(GVRAM + (row << 10));
+	DWORD x = FastClrPendX[row];
+	DWORD w = FastClrPendW[row];
+	WORD mask = FastClrPendMask[row];
+
+	FastClrPend[row] = 0;
+	FastClrPendCount--;
+
+	if (x + w > 512) {
+		gvram_and_mask(p + x, mask, 512 - x);
+		gvram_and_mask(p, mask, x + w - 512);
+	} else {
+		gvram_and_mask(p + x, mask, w);
+	}
+}
+
+#define	GVRAM_RESOLVE(row)	do { if (FastClrPend[row]) GVRAM_ResolveRow(row); } while (0)
 
 void FASTCALL GVRAM_FastClear(void)
 {
-	DWORD v, h;
+	DWORD v, h, x, y;
+
+	if (CRTC_FastClrMask == 0xffff)
+		return;
+
 	v = ((CRTC_Regs[0x29]&4)?512:256);
 	h = ((CRTC_Regs[0x29]&3)?512:256);
 	// やっぱちゃんと範囲指定しないと変になるものもある（ダイナマイトデュークとか）
-#ifdef USE_ASM
-	_asm
-	{
-		push	ebx
-		push	ecx
-		push	edx
-		push	esi
-		mov	ax, CRTC_FastClrMask
-		mov	ecx, v
-		mov	esi, GrphScrollY[0]
-		and	esi, 511
-		shl	esi, 10
-	fclp2:
-		mov	edx, GrphScrollX[0]
-		and	edx, 511
-		mov	ebx, h
-	fclp:
-		and	word ptr GVRAM[esi+edx*2], ax
-		inc	edx
-		and	edx, 511
-		dec	ebx
-		jne	fclp
-		add	esi, 1024
-		and	esi, 07fc00h
-		dec	ecx
-		jne	fclp2
-		pop	esi
-		pop	edx
-		pop	ecx
-		pop	ebx
+	x = GrphScrollX[0] & 0x1ff;
+	y = GrphScrollY[0] & 0x1ff;
+
+	for (; v > 0; v--, y = (y + 1) & 0x1ff) {
+		if (FastClrPend[y]) {
+			if (FastClrPendX[y] == x && FastClrPendW[y] == h) {
+				FastClrPendMask[y] &= CRTC_FastClrMask;
+				continue;
+			}
+			GVRAM_ResolveRow(y);
+		}
+		FastClrPend[y] = 1;
+		FastClrPendMask[y] = CRTC_FastClrMask;
+		FastClrPendX[y] = (WORD)x;
+		FastClrPendW[y] = (WORD)h;
+		FastClrPendCount++;
 	}
-#elif defined(USE_GAS) && defined(__i386__)
-	__asm__ __volatile__ (
-		"pushl	%%ebx;"
-		"pushl	%%ecx;"
-		"pushl	%%edx;"
-		"pushl	%%esi;"
-		"movw	%0, %%ax;"
-		"movl	%3, %%ecx;"
-		"movl	%1, %%esi;"
-		"andl	$511, %%esi;"
-		"shll	$10, %%esi;"
-	".fclp2:"
-		"movl	%2, %%edx;"
-		"andl	$511, %%edx;"
-		"movl	%4, %%ebx;"
-	".fclp:"
-		"andw	%%ax, GVRAM(%%esi, %%edx, 2);"
-		"incl	%%edx;"
-		"andl	$511, %%edx;"
-		"decl	%%ebx;"
-		"jne	.fclp;"
-		"addl	$1024, %%esi;"
-		"andl	$0x7fc00, %%esi;"
-		"decl	%%ecx;"
-		"jne	.fclp2;"
-		"popl	%%esi;"
-		"popl	%%edx;"
-		"popl	%%ecx;"
-		"popl	%%ebx;"
-	: /* output: nothing */
-	: "m" (CRTC_FastClrMask), "m" (GrphScrollY[0]), "m" (GrphScrollX[0]),
-	  "m" (v), "m" (h)
-	: "eax");
-#else /* !USE_ASM && !(USE_GAS && __i386__) */
-{
-	WORD *p;
-	DWORD x, y;
-	DWORD offx, offy;
+}
 
-	offy = (GrphScrollY[0] & 0x1ff) << 10;
-	for (y = 0; y < v; ++y) {
-		offx = GrphScrollX[0] & 0x1ff;
-		p = (WORD *)(GVRAM + offy + offx * 2);
+// Apply every pending clear (direct GVRAM users, e.g. opcode fetch)
+void FASTCALL GVRAM_ResolveAll(void)
+{
+	DWORD y;
 
-		for (x = 0; x < h; ++x) {
-			*p++ &= CRTC_FastClrMask;
-			offx = (offx + 1) & 0x1ff;
-		}
+	for (y = 0; FastClrPendCount && y < 512; y++)
+		GVRAM_RESOLVE(y);
+}
 
-		offy = (offy + 0x400) & 0x7fc00;
-	}
+// Opcode fetch reads GVRAM through the CPU core's fetch map, not through
+// the read handlers.  The core calls this whenever the PC is set into GVRAM
+// (C68k_Set_FetchHook), and the emulation loop before each execution slice
+// for a PC that is already there: apply every pending clear first.
+void GVRAM_ResolveFetch(DWORD pc)
+{
+	if (FastClrPendCount && (pc & 0xffffff) >= 0xc00000 && (pc & 0xffffff) < 0xc80000)
+		GVRAM_ResolveAll();
 }
-#endif /* USE_ASM */
+
+// Apply pending clears on the rows the current VLINE will be drawn from
+void FASTCALL GVRAM_ResolveLine(void)
+{
+	DWORD y, i;
+
+	if (!FastClrPendCount)
+		return;
+
+	y = VLINE;
+	if ((CRTC_Regs[0x29] & 0x1c) == 0x1c)
+		y += VLINE;
+	for (i = 0; i < 4; i++)
+		GVRAM_RESOLVE((GrphScrollY[i] + y) & 0x1ff);
 }
 
 
 // -----------------------------------------------------------------------
 //   VRAM Read
 // -----------------------------------------------------------------------
-BYTE FASTCALL GVRAM_Read(DWORD adr)
+// CRTC R20 (CRTC_Regs[0x28]) decides how GVRAM looks from the CPU.  Each
+// layout has its own handler, and GVRAM_SetAccessMode() installs the
+// matching pair into the memory map whenever R20 changes.
+
+static BYTE FASTCALL GVRAM_Read16(DWORD adr)		// 16 colors 512dot
 {
-	BYTE ret=0;
 	BYTE page;
 	WORD *ram = (WORD*)(&GVRAM[adr&0x7fffe]);
+
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
+
 	adr ^= 1;
 	adr -= 0xc00000;
+	if (adr&1)
+		return 0;
+	page = (BYTE)((adr>>17)&0x0c);
+	return (((*ram)>>page)&15);
+}
 
-	if (CRTC_Regs[0x28]&8) {			// 読み込み側も65536モードのVRAM配置（苦胃頭捕物帳）
-		if (adr<0x80000) ret = GVRAM[adr];
-	} else {
-		switch(CRTC_Regs[0x28]&3)
-		{
-		case 0:					// 16 colors
-			if (!(adr&1))
-			{
-				if (CRTC_Regs[0x28]&4)		// 1024dot
-				{
-					ram = (WORD*)(&GVRAM[((adr&0xff800)>>1)+(adr&0x3fe)]);
-					page = (BYTE)((adr>>17)&0x08);
-					page += (BYTE)((adr>>8)&4);
-					ret = (((*ram)>>page)&15);
-				}
-				else
-				{
-					page = (BYTE)((adr>>17)&0x0c);
-					ret = (((*ram)>>page)&15);
-				}
-			}
-			break;
-		case 1:					// 256
-		case 2:					// Unknown
-			if ( adr<0x100000 )
-			{
-				if (!(adr&1))
-				{
-					page = (BYTE)((adr>>16)&0x08);
-					ret = (BYTE)((*ram)>>page);
-				}
-			}
-//			else
-//				BusErrFlag = 1;
-			break;
-		case 3:					// 65536
-			if (adr<0x80000)
-				ret = GVRAM[adr];
-//			else
-//				BusErrFlag = 1;
-			break;
-		}
+static BYTE FASTCALL GVRAM_Read16h(DWORD adr)		// 16 colors 1024dot
+{
+	BYTE page;
+	WORD *ram;
+
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>11)&0x1ff);
+
+	adr ^= 1;
+	adr -= 0xc00000;
+	if (adr&1)
+		return 0;
+	ram = (WORD*)(&GVRAM[((adr&0xff800)>>1)+(adr&0x3fe)]);
+	page = (BYTE)((adr>>17)&0x08);
+	page += (BYTE)((adr>>8)&4);
+	return (((*ram)>>page)&15);
+}
+
+static BYTE FASTCALL GVRAM_Read256(DWORD adr)		// 256 colors / Unknown
+{
+	BYTE page;
+	WORD *ram = (WORD*)(&GVRAM[adr&0x7fffe]);
+
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
+
+	adr ^= 1;
+	adr -= 0xc00000;
+	if ( (adr>=0x100000)||(adr&1) )
+		return 0;				// BusErrFlag = 1 ?
+	page = (BYTE)((adr>>16)&0x08);
+	return (BYTE)((*ram)>>page);
+}
+
+static BYTE FASTCALL GVRAM_Read64k(DWORD adr)		// 65536 colors (Nemesis 配置も同じ)
+{
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
+
+	adr ^= 1;
+	adr -= 0xc00000;
+	if (adr<0x80000)
+		return GVRAM[adr];
+	return 0;					// BusErrFlag = 1 ?
+}
+
+BYTE FASTCALL GVRAM_Read(DWORD adr)
+{
+	if (CRTC_Regs[0x28]&8)				// 読み込み側も65536モードのVRAM配置（苦胃頭捕物帳）
+		return GVRAM_Read64k(adr);
+
+	switch(CRTC_Regs[0x28]&3)
+	{
+	case 0:						// 16 colors
+		if (CRTC_Regs[0x28]&4)			// 1024dot
+			return GVRAM_Read16h(adr);
+		return GVRAM_Read16(adr);
+	case 1:						// 256
+	case 2:						// Unknown
+		return GVRAM_Read256(adr);
+	default:					// 65536
+		return GVRAM_Read64k(adr);
 	}
-	return ret;
 }
 
 
 // -----------------------------------------------------------------------
 //   VRAM Write
 // -----------------------------------------------------------------------
-void FASTCALL GVRAM_Write(DWORD adr, BYTE data)
+static void FASTCALL GVRAM_Write16(DWORD adr, BYTE data)	// 16 colors 512dot
 {
 	BYTE page;
-	int line = 1023, scr = 0;
 	WORD *ram = (WORD*)(&GVRAM[adr&0x7fffe]);
 	WORD temp;
 
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
+
+	adr ^= 1;
+	adr -= 0xc00000;
+	if (adr&1)
+		return;
+	page = (BYTE)((adr>>17)&0x0c);
+	temp = ((WORD)data&15)<<page;
+	*ram = ((*ram)&(~(0xf<<page)))|temp;
+	TextDirtyLine[(((adr&0x7ffff)/1024)-GrphScrollY[(adr>>19)&3])&511] = 1;
+}
+
+static void FASTCALL GVRAM_Write16h(DWORD adr, BYTE data)	// 16 colors 1024dot
+{
+	BYTE page;
+	WORD *ram;
+	WORD temp;
+
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>11)&0x1ff);
+
 	adr ^= 1;
 	adr -= 0xc00000;
+	if (adr&1)
+		return;
+	ram = (WORD*)(&GVRAM[((adr&0xff800)>>1)+(adr&0x3fe)]);
+	page = (BYTE)((adr>>17)&0x08);
+	page += (BYTE)((adr>>8)&4);
+	temp = ((WORD)data&15)<<page;
+	*ram = ((*ram)&(~(0xf<<page)))|temp;
+	TextDirtyLine[((adr/2048)-GrphScrollY[0])&1023] = 1;
+}
+
+static void FASTCALL GVRAM_Write256(DWORD adr, BYTE data)	// 256 colors / Unknown
+{
+	DWORD scr;
 
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
 
-	if (CRTC_Regs[0x28]&8)				// 65536モードのVRAM配置？（Nemesis）
+	adr ^= 1;
+	adr -= 0xc00000;
+	if ( (adr>=0x100000)||(adr&1) )
+		return;					// BusErrFlag = 1 ?
+	scr = GrphScrollY[(adr>>18)&2];
+	TextDirtyLine[(((adr&0x7ffff)>>10)-scr)&511] = 1;	// 32色4面みたいな使用方法時
+	scr = GrphScrollY[((adr>>18)&2)+1];
+	TextDirtyLine[(((adr&0x7ffff)>>10)-scr)&511] = 1;
+	if (adr&0x80000) adr+=1;
+	adr &= 0x7ffff;
+	GVRAM[adr] = data;
+}
+
+static void FASTCALL GVRAM_Write64k(DWORD adr, BYTE data)	// 65536 colors
+{
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
+
+	adr ^= 1;
+	adr -= 0xc00000;
+	if (adr>=0x80000)
+		return;					// BusErrFlag = 1 ?
+	GVRAM[adr] = data;
+	TextDirtyLine[((adr>>10)-GrphScrollY[0])&511] = 1;
+}
+
+static void FASTCALL GVRAM_WriteNemesis(DWORD adr, BYTE data)	// 65536モードのVRAM配置（Nemesis）
+{
+	if (FastClrPendCount)
+		GVRAM_RESOLVE((adr>>10)&0x1ff);
+
+	adr ^= 1;
+	adr -= 0xc00000;
+	if (adr<0x80000)
+		GVRAM[adr] = data;
+}
+
+void FASTCALL GVRAM_Write(DWORD adr, BYTE data)
+{
+	if (CRTC_Regs[0x28]&8) {
+		GVRAM_WriteNemesis(adr, data);
+		return;
+	}
+
+	switch(CRTC_Regs[0x28]&3)
 	{
-		if ( adr<0x80000 )
-		{
-			GVRAM[adr] = data;
-			line = (((adr&0x7ffff)/1024)-GrphScrollY[0])&511;
-		}
+	case 0:						// 16 colors
+		if (CRTC_Regs[0x28]&4)			// 1024dot
+			GVRAM_Write16h(adr, data);
+		else
+			GVRAM_Write16(adr, data);
+		break;
+	case 1:						// 256 colors
+	case 2:						// Unknown
+		GVRAM_Write256(adr, data);
+		break;
+	case 3:						// 65536 colors
+		GVRAM_Write64k(adr, data);
+		break;
 	}
-	else
+}
+
+
+// -----------------------------------------------------------------------
+//   R20 変更時のアクセスルーチン切り替え
+// -----------------------------------------------------------------------
+void GVRAM_SetAccessMode(void)
+{
+	if (CRTC_Regs[0x28]&8) {
+		Memory_SetGVRAMHandler(GVRAM_Read64k, GVRAM_WriteNemesis);
+		return;
+	}
+
+	switch(CRTC_Regs[0x28]&3)
 	{
-		switch(CRTC_Regs[0x28]&3)
-		{
-		case 0:					// 16 colors
-			if (adr&1) break;
-			if (CRTC_Regs[0x28]&4)		// 1024dot
-			{
-				ram = (WORD*)(&GVRAM[((adr&0xff800)>>1)+(adr&0x3fe)]);
-				page = (BYTE)((adr>>17)&0x08);
-				page += (BYTE)((adr>>8)&4);
-				temp = ((WORD)data&15)<<page;
-				*ram = ((*ram)&(~(0xf<<page)))|temp;
-				line = ((adr/2048)-GrphScrollY[0])&1023;
-			}
-			else
-			{
-				page = (BYTE)((adr>>17)&0x0c);
-				temp = ((WORD)data&15)<<page;
-				*ram = ((*ram)&(~(0xf<<page)))|temp;
-				switch(adr/0x80000)
-				{
-					case 0:	scr = GrphScrollY[0]; break;
-					case 1: scr = GrphScrollY[1]; break;
-					case 2: scr = GrphScrollY[2]; break;
-					case 3: scr = GrphScrollY[3]; break;
-				}
-				line = (((adr&0x7ffff)/1024)-scr)&511;
-			}
-			break;
-		case 1:					// 256 colors
-		case 2:					// Unknown
-			if ( adr<0x100000 )
-			{
-				if ( !(adr&1) )
-				{
-					scr = GrphScrollY[(adr>>18)&2];
-					line = (((adr&0x7ffff)>>10)-scr)&511;
-					TextDirtyLine[line] = 1;			// 32色4面みたいな使用方法時
-					scr = GrphScrollY[((adr>>18)&2)+1];		//
-					line = (((adr&0x7ffff)>>10)-scr)&511;		//
-					if (adr&0x80000) adr+=1;
-					adr &= 0x7ffff;
-					GVRAM[adr] = data;
-				}
-			}
-//			else
-//			{
-//				BusErrFlag = 1;
-//				return;
-//			}
-			break;
-		case 3:					// 65536 colors
-			if ( adr<0x80000 )
-			{
-				GVRAM[adr] = data;
-				line = (((adr&0x7ffff)>>10)-GrphScrollY[0])&511;
-			}
-//			else
-//			{
-//				BusErrFlag = 1;
-//				return;
-//			}
-			break;
-		}
-		TextDirtyLine[line] = 1;
+	case 0:
+		if (CRTC_Regs[0x28]&4)
+			Memory_SetGVRAMHandler(GVRAM_Read16h, GVRAM_Write16h);
+		else
+			Memory_SetGVRAMHandler(GVRAM_Read16, GVRAM_Write16);
+		break;
+	case 1:
+	case 2:
+		Memory_SetGVRAMHandler(GVRAM_Read256, GVRAM_Write256);
+		break;
+	case 3:
+		Memory_SetGVRAMHandler(GVRAM_Read64k, GVRAM_Write64k);
+		break;
 	}
 }
 
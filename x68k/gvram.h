@@ -11,9 +11,13 @@ extern	WORD	Grp_LineBufSP2[1024];
 void GVRAM_Init(void);
 
 void FASTCALL GVRAM_FastClear(void);
+void FASTCALL GVRAM_ResolveAll(void);
+void FASTCALL GVRAM_ResolveLine(void);
+void GVRAM_ResolveFetch(DWORD pc);
 
 BYTE FASTCALL GVRAM_Read(DWORD adr);
 void FASTCALL GVRAM_Write(DWORD adr, BYTE data);
+void GVRAM_SetAccessMode(void);
 
 void Grp_DrawLine16(void);
 void FASTCALL Grp_DrawLine8(int page, int opaq);
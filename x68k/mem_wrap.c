@@ -26,6 +26,9 @@
 #include "tvram.h"
 
 #include "fmg_wrap.h"
+#ifdef RFMDRV
+#include "rfmdrv.h"
+#endif
 
 void AdrError(DWORD, DWORD);
 void BusError(DWORD, DWORD);
@@ -125,6 +128,9 @@ void (FASTCALL *MemWriteTable[])(DWORD, BYTE) = {
 	wm_buserr, wm_buserr, wm_buserr, wm_buserr, wm_buserr, wm_buserr, wm_buserr, wm_buserr,
 };
 
+static BYTE (FASTCALL *rm_gvram)(DWORD) = GVRAM_Read;
+static void (FASTCALL *wm_gvram)(DWORD, BYTE) = GVRAM_Write;
+
 BYTE *IPL;
 BYTE *MEM;
 BYTE *OP_ROM;
@@ -257,7 +263,7 @@ wm_cnt(DWORD addr, BYTE val)
 	} else if (addr < 0x00c00000) {
 		wm_buserr(addr, val);
 	} else if (addr < 0x00e00000) {
-		GVRAM_Write(addr, val);
+		wm_gvram(addr, val);
 	} else {
 		MemWriteTable[(addr >> 13) & 0xff](addr, val);
 	}
@@ -276,9 +282,6 @@ static void FASTCALL
 wm_opm(DWORD addr, BYTE val)
 {
 	BYTE t;
-#ifdef RFMDRV
-	char buf[2];
-#endif
 
 	t = addr & 3;
 	if (t == 1) {
@@ -287,9 +290,7 @@ wm_opm(DWORD addr, BYTE val)
 		OPM_Write(1, val);
 	}
 #ifdef RFMDRV
-	buf[0] = t;
-	buf[1] = val;
-	send(rfd_sock, buf, sizeof(buf), 0);
+	RFM_Write(t, val);
 #endif
 }
 
@@ -422,7 +423,7 @@ rm_main(DWORD addr)
 		rm_buserr(addr);
 		v = 0;
 	} else if (addr < 0x00e00000) {
-		v = GVRAM_Read(addr);
+		v = rm_gvram(addr);
 	} else {
 		v = MemReadTable[(addr >> 13) & 0xff](addr);
 	}
@@ -504,6 +505,7 @@ cpu_setOPbase24(DWORD addr)
 		break;
 
 	case 0xc: case 0xd:
+		GVRAM_ResolveAll();
 		OP_ROM = GVRAM - 0x00c00000;
 		break;
 
@@ -545,6 +547,28 @@ Memory_SetSCSIMode(void)
 	}
 }
 
+/*
+ * GVRAM/TVRAM access routines depend on CRTC R20/R21; the CRTC installs
+ * the specialised ones here whenever those registers change.
+ */
+void FASTCALL
+Memory_SetGVRAMHandler(BYTE (FASTCALL *rd)(DWORD), void (FASTCALL *wr)(DWORD, BYTE))
+{
+
+	rm_gvram = rd;
+	wm_gvram = wr;
+}
+
+void FASTCALL
+Memory_SetTVRAMHandler(void (FASTCALL *wr)(DWORD, BYTE))
+{
+	int i;
+
+	for (i = 0; i < 0x40; i++) {
+		MemWriteTable[i] = wr;
+	}
+}
+
 void FASTCALL
 Memory_ErrTrace(void)
 {
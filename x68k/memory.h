@@ -48,5 +48,7 @@ void FASTCALL dma_writemem24_dword(DWORD adr, DWORD data);
 void FASTCALL cpu_setOPbase24(DWORD adr);
 
 void FASTCALL Memory_SetSCSIMode(void);
+void FASTCALL Memory_SetGVRAMHandler(BYTE (FASTCALL *rd)(DWORD), void (FASTCALL *wr)(DWORD, BYTE));
+void FASTCALL Memory_SetTVRAMHandler(void (FASTCALL *wr)(DWORD, BYTE));
 
 #endif
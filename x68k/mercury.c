@@ -12,7 +12,8 @@
 #include <math.h>
 
 #define MCRY_IRQ 4
-#define Mcry_BufSize		48000*2
+#define Mcry_BufSize		(48000*2)
+#define Mcry_MaxPend		16		// DMA が止まっている間に溜める要求数の上限
 
 long	Mcry_WrPtr = 0;
 long	Mcry_RdPtr = 0;
@@ -28,9 +29,9 @@ short	Mcry_BufR[Mcry_BufSize];
 long	Mcry_PreCounter = 0;
 
 short	Mcry_OldR, Mcry_OldL;
-int	Mcry_DMABytes = 0;
-static double Mcry_VolumeShift = 65536;
+static int Mcry_Volume = 0;		// 16.16 固定小数（0: Mute）
 static int Mcry_SampleCnt = 0;
+static DWORD Mcry_DataWrites = 0;	// データポートへの書き込み回数（DMA の進み具合を見る）
 static BYTE Mcry_Vector = 255;
 
 extern BYTE BusErrFlag;
@@ -66,57 +67,63 @@ int Mcry_IsReady(void)
 
 // -----------------------------------------------------------------------
 //   MPU経過クロック時間分だけデータをバッファに溜める
+//   DMA はここ（エミュレーションスレッドのライン処理）でだけ回す
 // -----------------------------------------------------------------------
 void FASTCALL Mcry_PreUpdate(DWORD clock)
 {
+	int i;
+
 	Mcry_PreCounter += (Mcry_ClockRate*clock);
 	while(Mcry_PreCounter>=10000000L)
 	{
 		Mcry_SampleCnt++;
 		Mcry_PreCounter -= 10000000L;
 	}
+	if ( Mcry_SampleCnt>Mcry_MaxPend ) Mcry_SampleCnt = Mcry_MaxPend;
+
+	// 要求分を取り込む（REQ 転送は 1 回の DMA_Exec で 1 ワードしか進まない）
+	for (i=0; (Mcry_SampleCnt>0)&&(i<Mcry_MaxPend*4); i++) {
+		DWORD w = Mcry_DataWrites;
+		DMA_Exec(2);
+		if ( w==Mcry_DataWrites ) break;
+	}
 	M288_Timer(clock);
 }
 
 
 // -----------------------------------------------------------------------
-//   DSoundからの要求分だけバッファを埋める
+//   ミキサーからの要求分だけ buffer（L,R 交互の int）を埋める
+//   YMF288 はチップとしてミキサーに別途登録してある
 // -----------------------------------------------------------------------
-void FASTCALL Mcry_Update(signed short *buffer, DWORD length)
+void FASTCALL Mcry_Update(int *buffer, DWORD length)
 {
-	int data;
-
-	if (!length) return;
-
-	M288_Update(buffer, length);
-	while (length)
-	{
-		if ( Mcry_WrPtr==Mcry_RdPtr ) {
-			Mcry_SampleCnt = 1;
-			DMA_Exec(2); DMA_Exec(2);
+	long rd = Mcry_RdPtr, wr = Mcry_WrPtr;
+	int vol = Mcry_Volume;
+	DWORD i, n;
+
+	while ( length && rd!=wr ) {
+		// リングの連続している部分をまとめて
+		n = (DWORD)(((wr>rd) ? wr : Mcry_BufSize) - rd);
+		if ( n>length ) n = length;
+		for (i=0; i<n; i++) {
+			*(buffer++) = (Mcry_BufL[rd+i]*vol)>>16;
+			*(buffer++) = (Mcry_BufR[rd+i]*vol)>>16;
 		}
-
-		if (Mcry_WrPtr!=Mcry_RdPtr)
-		{
-			Mcry_OldL = Mcry_BufL[Mcry_RdPtr];
-			Mcry_OldR = Mcry_BufR[Mcry_RdPtr];
-			Mcry_RdPtr++;
-			if (Mcry_RdPtr>=Mcry_BufSize) Mcry_RdPtr=0;
+		rd += n;
+		if ( rd>=Mcry_BufSize ) rd = 0;
+		length -= n;
+		Mcry_OldL = Mcry_BufL[(rd ? rd : Mcry_BufSize)-1];
+		Mcry_OldR = Mcry_BufR[(rd ? rd : Mcry_BufSize)-1];
+	}
+	Mcry_RdPtr = rd;
+
+	// 足りない分は最後の値を保持
+	if ( length ) {
+		int l = (Mcry_OldL*vol)>>16, r = (Mcry_OldR*vol)>>16;
+		while ( length-- ) {
+			*(buffer++) = l;
+			*(buffer++) = r;
 		}
-
-		data = *buffer;
-		data += Mcry_OldL;
-		if (data>32767) data = 32767;
-		else if (data<(-32768)) data = -32768;
-		*(buffer++) = (short)data;
-
-		data = *buffer;
-		data += Mcry_OldR;
-		if (data>32767) data = 32767;
-		else if (data<(-32768)) data = -32768;
-		*(buffer++) = (short)data;
-
-		length--;
 	}
 }
 
@@ -128,8 +135,8 @@ INLINE void Mcry_WriteOne(void)
 {
 	while (Mcry_Count<Mcry_SampleRate)
 	{
-		Mcry_BufL[Mcry_WrPtr] = (short)(Mcry_OutDataL/Mcry_VolumeShift);
-		Mcry_BufR[Mcry_WrPtr] = (short)(Mcry_OutDataR/Mcry_VolumeShift);
+		Mcry_BufL[Mcry_WrPtr] = Mcry_OutDataL;
+		Mcry_BufR[Mcry_WrPtr] = Mcry_OutDataR;
 		Mcry_Count += Mcry_ClockRate;
 		Mcry_WrPtr++;
 		if (Mcry_WrPtr>=Mcry_BufSize) Mcry_WrPtr=0;
@@ -147,6 +154,7 @@ void FASTCALL Mcry_Write(DWORD adr, BYTE data)
 	if ((adr == 0xecc080)||(adr == 0xecc081)||(adr == 0xecc000)||(adr == 0xecc001))	// Data Port
 	{
 		if ( Mcry_SampleCnt<=0 ) return;
+		Mcry_DataWrites++;
 		if ( Mcry_Status&2 ) {		// Stereo
 			if (Mcry_LRTiming)		// 右
 			{
@@ -283,10 +291,11 @@ void Mcry_SetVolume(BYTE vol)
 	if (vol>16) vol=16;
 //	if (vol<0) vol=0;
 
+	// 音量はバッファから読み出す時に掛ける
 	if (vol)
-		Mcry_VolumeShift = pow(1.189207115, (16-vol));
+		Mcry_Volume = (int)(65536.0/pow(1.189207115, (16-vol)));
 	else
-		Mcry_VolumeShift = 65536;		// Mute
+		Mcry_Volume = 0;		// Mute
 	M288_SetVolume(vol);
 }
 
@@ -307,6 +316,8 @@ void Mcry_Init(DWORD samplerate, const char* path)
 	Mcry_SampleRate = (long)samplerate;
 	Mcry_LRTiming = 0;
 	Mcry_PreCounter = 0;
+	Mcry_SampleCnt = 0;
+	Mcry_OldL = Mcry_OldR = 0;
 
 	Mcry_SetClock();
 
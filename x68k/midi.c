@@ -20,16 +20,16 @@
 #include "prop.h"
 #include "winx68k.h"
 #include "fileio.h"
-#include "mmsystem.h"
 #include "memory.h"
 #include "irqh.h"
 #include "midi.h"
 #include "m68000.h"
+#include "midiout.h"
+#include "dswin.h"
 
 #define MIDIBUFFERS 1024			// 1024は流石に越えないでしょう^_^;
 #define MIDIBUFTIMER 3200			// 10MHz / (31.25K / 10bit) = 3200 が正解になります... 
 #define MIDIFIFOSIZE 256
-#define MIDIDELAYBUF 4096			// 31250/10 = 3125 byts (1s分) あればおっけ？
 
 enum {						// 各機種リセット用に一応。
 	MIDI_NOTUSED,
@@ -47,15 +47,11 @@ enum {						// 各機種リセット用に一応。
 	MIDI_XG,
 };
 
-HMIDIOUT	hOut = 0;
-MIDIHDR		hHdr;
 int		MIDI_CTRL;
 int		MIDI_POS;
 int		MIDI_SYSCOUNT;
 BYTE		MIDI_LAST;
 BYTE		MIDI_BUF[MIDIBUFFERS];
-BYTE		MIDI_EXCVBUF[MIDIBUFFERS];
-BYTE		MIDI_EXCVWAIT;
 
 BYTE		MIDI_RegHigh = 0;				// X68K用
 BYTE		MIDI_Playing = 0;				// マスタスイッチ
@@ -77,14 +73,7 @@ static BYTE MIDI_ResetType[5] = {		// Config.MIDI_Type に合わせて…
 	MIDI_LA, MIDI_GM, MIDI_GS, MIDI_XG
 };
 
-typedef struct {
-	DWORD time;
-	BYTE msg;
-} DELAYBUFITEM;
-
-static DELAYBUFITEM DelayBuf[MIDIDELAYBUF];
-static int DBufPtrW = 0;
-static int DBufPtrR = 0;
+static unsigned long long MIDI_Ticks = 0;	// 10MHz 単位の経過時間（送出時刻用）
 
 // ------------------------------------------------------------------
 // ねこみぢ6、MIMPIトーンマップ対応関係
@@ -131,7 +120,7 @@ static BYTE EXCV_XGRESET[] = { 0xf0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0
 #define	MIDI_ACTIVESENSE	0xfe
 #define	MIDI_SYSTEMRESET	0xff
 
-#define MIDIOUTS(a,b,c) (((DWORD)c << 16) | ((DWORD)b << 8) | (DWORD)a)
+static BYTE MIDI_ALLNOTEOFF[] = { 0xb0, 0x7b, 0x00 };
 
 // -----------------------------------------------------------------------
 //   割り込み
@@ -158,6 +147,7 @@ DWORD FASTCALL MIDI_Int(BYTE irq)
 // -----------------------------------------------------------------------
 void FASTCALL MIDI_Timer(DWORD clk)
 {
+	MIDI_Ticks += clk;
 	if ( !Config.MIDI_SW ) return;	// MIDI OFF時は帰る
 
 	MIDI_BufTimer -= clk;
@@ -221,32 +211,11 @@ void MIDI_SetModule(void)
 
 
 // -----------------------------------------------------------------------
-//   えくすくるーしぶ ごー
+//   送出（エミュレーション上の今の時刻を付けて sender スレッドへ）
 // -----------------------------------------------------------------------
-void MIDI_Sendexclusive(BYTE *excv, int length)
+static void MIDI_Send(BYTE *msg, int length)
 {
-	// エクスクルーシヴを送ります
-	CopyMemory(MIDI_EXCVBUF, excv, length);
-	hHdr.lpData = MIDI_EXCVBUF;
-	hHdr.dwFlags = 0;
-	hHdr.dwBufferLength = length;
-	midiOutPrepareHeader(hOut, &hHdr, sizeof(MIDIHDR));
-	midiOutLongMsg(hOut, &hHdr, sizeof(MIDIHDR));
-	MIDI_EXCVWAIT = 1;
-}
-
-
-// -----------------------------------------------------------------------
-//   えくすくるーしぶを送り終えるまで待つお
-// -----------------------------------------------------------------------
-void MIDI_Waitlastexclusiveout(void) {
-
-	// エクスクルーシヴ送信完了まで待ちましょう〜
-	if (MIDI_EXCVWAIT) {
-		while(midiOutUnprepareHeader(hOut, &hHdr, sizeof(MIDIHDR))
-						== MIDIERR_STILLPLAYING);
-		MIDI_EXCVWAIT = 0;
-	}
+	MIDIOut_Send((DWORD)((MIDI_Ticks + WinX68k_GetLineClock()) / 10), msg, length);
 }
 
 
@@ -255,12 +224,9 @@ void MIDI_Waitlastexclusiveout(void) {
 // -----------------------------------------------------------------------
 void MIDI_Reset(void) {
 
-	DWORD msg;
-
-	memset(DelayBuf, 0, sizeof(DelayBuf));
-	DBufPtrW = DBufPtrR = 0;
+	int ch;
 
-	if (hOut) {
+	if (MIDIOut_IsOpen()) {
 		switch(MIDI_MODULE) {
 			case MIDI_NOTUSED:
 				return;
@@ -270,27 +236,23 @@ void MIDI_Reset(void) {
 			case MIDI_LA:
 				// ちょっと乱暴かなぁ…
 				// 一応 SC系でも通る筈ですけど…
-				MIDI_Waitlastexclusiveout();
-				MIDI_Sendexclusive(EXCV_MTRESET, sizeof(EXCV_MTRESET));
+				MIDI_Send(EXCV_MTRESET, sizeof(EXCV_MTRESET));
 				break;
 			case MIDI_SC55:
 			case MIDI_SC88:
 			case MIDI_GS:
-				MIDI_Waitlastexclusiveout();
-				MIDI_Sendexclusive(EXCV_GSRESET, sizeof(EXCV_GSRESET));
+				MIDI_Send(EXCV_GSRESET, sizeof(EXCV_GSRESET));
 				break;
 			case MIDI_XG:
-				MIDI_Waitlastexclusiveout();
-				MIDI_Sendexclusive(EXCV_XGRESET, sizeof(EXCV_XGRESET));
+				MIDI_Send(EXCV_XGRESET, sizeof(EXCV_XGRESET));
 				break;
 			default:
-				MIDI_Waitlastexclusiveout();
-				MIDI_Sendexclusive(EXCV_GMRESET, sizeof(EXCV_GMRESET));
+				MIDI_Send(EXCV_GMRESET, sizeof(EXCV_GMRESET));
 				break;
 		}
-		MIDI_Waitlastexclusiveout();
-		for (msg=0x7bb0; msg<0x7bc0; msg++) {
-			midiOutShortMsg(hOut, msg);
+		for (ch=0; ch<16; ch++) {
+			MIDI_ALLNOTEOFF[0] = 0xb0 | ch;
+			MIDI_Send(MIDI_ALLNOTEOFF, sizeof(MIDI_ALLNOTEOFF));
 		}
 	}
 }
@@ -301,9 +263,6 @@ void MIDI_Reset(void) {
 // -----------------------------------------------------------------------
 void MIDI_Init(void) {
 
-	memset(DelayBuf, 0, sizeof(DelayBuf));
-	DBufPtrW = DBufPtrR = 0;
-
 	MIDI_SetModule();
 	MIDI_RegHigh = 0;		// X68K
 	MIDI_Vector = 0;		// X68K
@@ -314,15 +273,12 @@ void MIDI_Init(void) {
 
 	MIDI_CTRL = MIDICTRL_READY;
 	MIDI_LAST = 0x80;
-	MIDI_EXCVWAIT = 0;
 
-	if (!hOut) {
-		if (midiOutOpen(&hOut, MIDI_MAPPER, 0, 0, CALLBACK_NULL)
-							== MMSYSERR_NOERROR) {
-			midiOutReset(hOut);
-		}
-		else
-			hOut = 0;
+	if (!MIDIOut_IsOpen() && Config.MIDI_SW && Config.MIDIDevice[0]) {
+		MIDIOut_Open(Config.MIDIDevice,
+		    (Config.MIDIAutoDelay) ? Config.BufferSize : (DWORD)Config.MIDIDelay);
+		// 自動なら音の出力位置に合わせる（音が止まっている間は固定遅延）
+		MIDIOut_SetSync((Config.MIDIAutoDelay) ? DSound_HostTime : NULL);
 	}
 }
 
@@ -332,12 +288,9 @@ void MIDI_Init(void) {
 // -----------------------------------------------------------------------
 void MIDI_Cleanup(void) {
 
-	if (hOut) {
+	if (MIDIOut_IsOpen()) {
 		MIDI_Reset();
-		MIDI_Waitlastexclusiveout();
-		midiOutReset(hOut);
-		midiOutClose(hOut);
-		hOut = 0;
+		MIDIOut_Close();
 	}
 }
 
@@ -347,7 +300,7 @@ void MIDI_Cleanup(void) {
 // -----------------------------------------------------------------------
 void MIDI_Message(BYTE mes) {
 
-	if (!hOut) {
+	if (!MIDIOut_IsOpen()) {
 		return;
 	}
 
@@ -467,23 +420,19 @@ void MIDI_Message(BYTE mes) {
 						MIDI_BUF[1] = TONEMAP[ TONE_CH[MIDI_BUF[0] & 0x0f] ][ MIDI_BUF[1] & 0x7f ];
 					}
 				}
-				MIDI_Waitlastexclusiveout();
-				midiOutShortMsg(hOut, MIDIOUTS(MIDI_BUF[0], MIDI_BUF[1], 0));
+				MIDI_Send(MIDI_BUF, 2);
 				MIDI_CTRL = MIDICTRL_READY;
 			}
 			break;
 		case MIDICTRL_3BYTES:
 			if (MIDI_POS >= 3) {
-				MIDI_Waitlastexclusiveout();
-				midiOutShortMsg(hOut, 
-							MIDIOUTS(MIDI_BUF[0], MIDI_BUF[1], MIDI_BUF[2]));
+				MIDI_Send(MIDI_BUF, 3);
 				MIDI_CTRL = MIDICTRL_READY;
 			}
 			break;
 		case MIDICTRL_EXCLUSIVE:
 			if (mes == MIDI_EOX) {
-				MIDI_Waitlastexclusiveout();
-				MIDI_Sendexclusive(MIDI_BUF, MIDI_POS);
+				MIDI_Send(MIDI_BUF, MIDI_POS);
 				MIDI_CTRL = MIDICTRL_READY;
 			}
 			else if (MIDI_POS >= MIDIBUFFERS) {		// おーばーふろー
@@ -648,30 +597,6 @@ BYTE FASTCALL MIDI_Read(DWORD adr)
 }
 
 
-static void AddDelayBuf(BYTE msg)
-{
-	int newptr = (DBufPtrW+1)%MIDIDELAYBUF;
-	if ( newptr!=DBufPtrR ) {
-		DelayBuf[DBufPtrW].time = timeGetTime();
-		DelayBuf[DBufPtrW].msg  = msg;
-		DBufPtrW = newptr;
-	}
-}
-
-
-void MIDI_DelayOut(unsigned int delay)
-{
-	unsigned int t = timeGetTime();
-	while ( DBufPtrW!=DBufPtrR ) {
-		if ( (t-DelayBuf[DBufPtrR].time)>=delay ) {
-			MIDI_Message(DelayBuf[DBufPtrR].msg);
-			DBufPtrR = (DBufPtrR+1)%MIDIDELAYBUF;
-		} else
-			break;
-	}
-}
-
-
 // -----------------------------------------------------------------------
 //   I/O Write
 // -----------------------------------------------------------------------
@@ -769,7 +694,7 @@ void FASTCALL MIDI_Write(DWORD adr, BYTE data)
 			if (!MIDI_Buffered)
 				MIDI_BufTimer = MIDIBUFTIMER;
 			MIDI_Buffered ++;
-			AddDelayBuf(data);
+			MIDI_Message(data);
 			break;
 		case 6:
 			break;
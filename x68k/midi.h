@@ -12,6 +12,5 @@ void MIDI_SetModule(void);
 void FASTCALL MIDI_Timer(DWORD clk);
 int MIDI_SetMimpiMap(char *filename);
 int MIDI_EnableMimpiDef(int enable);
-void MIDI_DelayOut(unsigned int delay);
 
 #endif
@@ -12,8 +12,9 @@
 #include "sasi.h"
 #include "scsi.h"
 #include "irqh.h"
+#include "diskio.h"
 
-BYTE SASI_Buf[256];
+BYTE *SASI_Buf;				// 今のセクタ（SASI_Drive の窓の中を指す）
 BYTE SASI_Phase = 0;
 DWORD SASI_Sector = 0;
 DWORD SASI_Blocks = 0;
@@ -31,6 +32,222 @@ BYTE SASI_SenseStatPtr = 0;
 
 extern int hddtrace;
 
+// イメージはドライブ毎に開きっぱなしにして、SASI_WinSect セクタ分を
+// 窓としてまとめて読む。書き込みは窓の中に溜めて、窓を動かす時・取り出し時・
+// リセット時・バスが暫く空いた時にまとめて書き出す
+#define SASI_WinSect	256		// 64KB
+#define SASI_SyncFrames	30		// 書き込み後、これだけバスが空いたら書き出す
+#define SASI_LoadClk	10000		// 窓の読み込みにかかる時間（1ms）
+
+typedef struct {
+	char	path[MAX_PATH];		// 開いているイメージ（Config.HDImage が変われば開き直す）
+	FILEH	fh;
+	DWORD	sectors;		// イメージのセクタ数
+	BYTE	*win;
+	DWORD	winsec, winlen;		// 窓の先頭セクタとセクタ数
+	DWORD	dirtylo, dirtyhi;	// 書き出していない範囲（窓内のセクタ、dirtylo<dirtyhi なら有効）
+} SASI_DRIVE;
+
+static SASI_DRIVE SASI_Drive[16];
+static BYTE SASI_NullSect[256];
+static int SASI_SyncCnt = 0;
+
+// 窓の読み込みは I/O スレッドに任せて、その間は SASI_Phase=6（BSY のみで REQ を出さない）
+static SASI_DRIVE *SASI_Loading = NULL;
+static DWORD SASI_LoadSec = 0;
+
+DWORD FASTCALL SASI_Int(BYTE irq);
+
+
+// -----------------------------------------------------------------------
+//   窓の書き出し
+// -----------------------------------------------------------------------
+static short SASI_WriteBack(SASI_DRIVE *d)
+{
+	DWORD pos, len;
+	short ret = 1;
+
+	if ( d->dirtylo>=d->dirtyhi ) return 1;
+	pos = (d->winsec+d->dirtylo)<<8;
+	len = (d->dirtyhi-d->dirtylo)<<8;
+	if ( (File_Seek(d->fh, pos, FSEEK_SET)!=pos)||(File_Write(d->fh, d->win+(d->dirtylo<<8), len)!=len) )
+		ret = 0;
+if (hddtrace) {
+FILE *fp;
+fp=fopen("_trace68.txt", "a");
+fprintf(fp, "Sec Write  - Sector:%d-%d  (Time:%08X)\n", d->winsec+d->dirtylo, d->winsec+d->dirtyhi-1, timeGetTime());
+fclose(fp);
+}
+	d->dirtylo = d->dirtyhi = 0;
+	return ret;
+}
+
+
+static void SASI_CloseDrive(SASI_DRIVE *d)
+{
+	if ( d->fh ) {
+		SASI_WriteBack(d);
+		File_Close(d->fh);
+		d->fh = 0;
+	}
+	d->path[0] = 0;
+	d->sectors = 0;
+	d->winlen = 0;
+}
+
+
+// -----------------------------------------------------------------------
+//   今のデバイス・ユニットのイメージ（設定が変わっていたら開き直す）
+// -----------------------------------------------------------------------
+static SASI_DRIVE* SASI_GetDrive(void)
+{
+	int n = SASI_Device*2+SASI_Unit;
+	SASI_DRIVE *d;
+	DWORD size;
+
+	if ( n>=16 ) return NULL;
+	d = &SASI_Drive[n];
+	if ( (d->fh)&&(!strcmp(d->path, Config.HDImage[n])) )
+		return d;
+
+	SASI_CloseDrive(d);
+	if ( !Config.HDImage[n][0] ) return NULL;
+	d->fh = File_OpenImage(Config.HDImage[n]);
+	if ( !d->fh ) return NULL;
+	size = File_Seek(d->fh, 0, FSEEK_END);
+	if ( size==(DWORD)-1 ) size = 0;
+	strncpy(d->path, Config.HDImage[n], MAX_PATH-1);
+	d->path[MAX_PATH-1] = 0;
+	d->sectors = size>>8;
+	if ( !d->win ) d->win = (BYTE*)malloc(SASI_WinSect*256);
+	if ( !d->win ) {
+		SASI_CloseDrive(d);
+		return NULL;
+	}
+	return d;
+}
+
+
+// -----------------------------------------------------------------------
+//   sector が窓の中ならそのセクタへのポインタを返す
+// -----------------------------------------------------------------------
+static BYTE* SASI_Map(SASI_DRIVE *d, DWORD sector)
+{
+	if ( (d->winlen)&&(sector>=d->winsec)&&(sector<d->winsec+d->winlen) )
+		return d->win+((sector-d->winsec)<<8);
+	return NULL;
+}
+
+
+// -----------------------------------------------------------------------
+//   窓を書き出して、sector から読み込み直す
+// -----------------------------------------------------------------------
+static int SASI_Fill(SASI_DRIVE *d, DWORD sector)
+{
+	DWORD pos, len;
+
+	SASI_WriteBack(d);
+	d->winlen = 0;
+	len = d->sectors-sector;
+	if ( len>SASI_WinSect ) len = SASI_WinSect;
+	pos = sector<<8;
+	if ( (File_Seek(d->fh, pos, FSEEK_SET)!=pos)||(File_Read(d->fh, d->win, len<<8)!=(len<<8)) )
+		return FALSE;
+	d->winsec = sector;
+	d->winlen = len;
+	return TRUE;
+}
+
+
+// I/O スレッド側
+static int SASI_Load(void *param)
+{
+	return SASI_Fill((SASI_DRIVE*)param, SASI_LoadSec);
+}
+
+
+// 読み込み完了。データフェーズに戻る（失敗ならステータスフェーズへ）
+static void SASI_Loaded(void *param, int result)
+{
+	SASI_DRIVE *d = (SASI_DRIVE*)param;
+
+	SASI_Loading = NULL;
+	if ( SASI_Phase!=6 ) return;
+	if ( result ) {
+		SASI_Buf = SASI_Map(d, SASI_LoadSec);
+		SASI_Phase = 3;
+	} else {
+		SASI_Error = 0x0f;
+		SASI_Phase = 4;
+		IOC_IntStat|=0x10;
+		if (IOC_IntStat&8) IRQH_Int(1, &SASI_Int);
+	}
+	StatBar_HDD(2);
+}
+
+
+// 読み込み中なら終わらせる（ドライブを外から触る前に呼ぶ）
+static void SASI_WaitIO(void)
+{
+	if ( SASI_Loading )
+		DiskIO_Wait(SASI_Loading);
+}
+
+
+// -----------------------------------------------------------------------
+//   全ドライブの書き出し（eject = TRUE なら閉じる）
+// -----------------------------------------------------------------------
+static void SASI_SyncAll(int eject)
+{
+	int i;
+
+	SASI_WaitIO();
+	for (i=0; i<16; i++) {
+		if ( eject )
+			SASI_CloseDrive(&SASI_Drive[i]);
+		else if ( SASI_Drive[i].fh )
+			SASI_WriteBack(&SASI_Drive[i]);
+	}
+	SASI_SyncCnt = 0;
+}
+
+
+// フレーム毎に呼ぶ。書き込みの後、バスが暫く空いていたら書き出す
+void SASI_Sync(void)
+{
+	if ( !SASI_SyncCnt ) return;
+	if ( SASI_Phase ) {
+		SASI_SyncCnt = 1;
+		return;
+	}
+	if ( ++SASI_SyncCnt>SASI_SyncFrames )
+		SASI_SyncAll(FALSE);
+}
+
+
+// 取り出し（drive: 0〜15、-1 なら全部）。書き出して閉じる
+void SASI_Eject(int drive)
+{
+	if ( drive<0 )
+		SASI_SyncAll(TRUE);
+	else if ( drive<16 ) {
+		SASI_WaitIO();
+		SASI_CloseDrive(&SASI_Drive[drive]);
+	}
+}
+
+
+void SASI_Cleanup(void)
+{
+	int i;
+
+	SASI_SyncAll(TRUE);
+	for (i=0; i<16; i++) {
+		free(SASI_Drive[i].win);
+		SASI_Drive[i].win = NULL;
+	}
+}
+
 
 int SASI_IsReady(void)
 {
@@ -65,6 +282,8 @@ fclose(fp);
 // -----------------------------------------------------------------------
 void SASI_Init(void)
 {
+	SASI_SyncAll(FALSE);
+	SASI_Buf = SASI_NullSect;
 	SASI_Phase = 0;
 	SASI_Sector = 0;
 	SASI_Blocks = 0;
@@ -84,7 +303,7 @@ void SASI_Init(void)
 // -----------------------------------------------------------------------
 short SASI_Seek(void)
 {
-	FILEH fp;
+	SASI_DRIVE *d;
 
 if (hddtrace) {
 FILE *fp;
@@ -92,55 +311,61 @@ fp=fopen("_trace68.txt", "a");
 fprintf(fp, "Seek  - Sector:%d  (Time:%08X)\n", SASI_Sector, timeGetTime());
 fclose(fp);
 }
-	ZeroMemory(SASI_Buf, 256);
-	fp = File_Open(Config.HDImage[SASI_Device*2+SASI_Unit]);
-	if (!fp)
-	{
-		ZeroMemory(SASI_Buf, 256);
+	SASI_Buf = SASI_NullSect;
+	ZeroMemory(SASI_NullSect, 256);
+	d = SASI_GetDrive();
+	if (!d)
 		return -1;
-	}
-	if (File_Seek(fp, SASI_Sector<<8, FSEEK_SET)!=(SASI_Sector<<8)) 
-	{
-		File_Close(fp);
+	if (SASI_Sector>=d->sectors)
 		return 0;
-	}
-	if (File_Read(fp, SASI_Buf, 256)!=256)
+	SASI_Buf = SASI_Map(d, SASI_Sector);
+	if (SASI_Buf)
+		return 1;
+
+	// 窓の外。読み込みが終わるまでバスはビジーのまま（result=2）
+	SASI_Buf = SASI_NullSect;
+	SASI_Loading = d;
+	SASI_LoadSec = SASI_Sector;
+	if ( DiskIO_Submit(SASI_Load, SASI_Loaded, d, SASI_LoadClk) )
 	{
-		File_Close(fp);
-		return 0;
+		SASI_Phase = 6;
+		return 2;
 	}
-	File_Close(fp);
-
+	SASI_Loading = NULL;
+	if ( !SASI_Fill(d, SASI_Sector) )
+		return 0;
+	SASI_Buf = SASI_Map(d, SASI_Sector);
 	return 1;
 }
 
 
 // -----------------------------------------------------------------------
 //   しーく（ライト時）
+//   SASI_Buf は窓の中なので、書いた範囲を覚えておくだけ
+//   書けないイメージ（圧縮イメージ）なら -1
 // -----------------------------------------------------------------------
 short SASI_Flush(void)
-{	FILEH fp;
+{
+	SASI_DRIVE *d;
+	DWORD sec;
 
-	fp = File_Open(Config.HDImage[SASI_Device*2+SASI_Unit]);
-	if (!fp) return -1;
-	if (File_Seek(fp, SASI_Sector<<8, FSEEK_SET)!=(SASI_Sector<<8))
-	{
-		File_Close(fp);
+	d = SASI_GetDrive();
+	if (!d) return -1;
+	if ( (SASI_Buf==SASI_NullSect)||(!d->winlen)||(SASI_Sector<d->winsec)||(SASI_Sector>=d->winsec+d->winlen) )
 		return 0;
+	if ( File_IsReadOnly(d->fh) ) {		// 書けないイメージ（圧縮イメージ）なら、書かれた窓は捨てる
+		d->winlen = 0;
+		return -1;
 	}
-	if (File_Write(fp, SASI_Buf, 256)!=256)
-	{
-		File_Close(fp);
-		return 0;
+	sec = SASI_Sector-d->winsec;
+	if ( d->dirtylo>=d->dirtyhi ) {
+		d->dirtylo = sec;
+		d->dirtyhi = sec+1;
+	} else {
+		if ( sec<d->dirtylo ) d->dirtylo = sec;
+		if ( sec>=d->dirtyhi ) d->dirtyhi = sec+1;
 	}
-	File_Close(fp);
-
-if (hddtrace) {
-FILE *fp;
-fp=fopen("_trace68.txt", "a");
-fprintf(fp, "Sec Write  - Sector:%d  (Time:%08X)\n", SASI_Sector, timeGetTime());
-fclose(fp);
-}
+	SASI_SyncCnt = 1;
 	return 1;
 }
 
@@ -162,7 +387,7 @@ BYTE FASTCALL SASI_Read(DWORD adr)
 	{
 		if (SASI_Phase)
 			ret |= 2;		// Busy
-		if (SASI_Phase>1)
+		if ((SASI_Phase>1)&&(SASI_Phase!=6))	// Phase=6:窓の読み込み中
 			ret |= 1;		// Req
 		if (SASI_Phase==2)
 			ret |= 8;		// C/D
@@ -308,7 +533,6 @@ void SASI_CheckCmd(void)
 		SASI_RW = 0;
 		SASI_BufPtr = 0;
 		SASI_Stat = 0;
-		ZeroMemory(SASI_Buf, 256);
 		result = SASI_Seek();
 		if ( (result==0)||(result==-1) )
 		{
@@ -403,6 +627,8 @@ fclose(fp);
 	}
 	else if (adr==0xe96005)						// SASI Reset
 	{
+		SASI_WaitIO();
+		SASI_Buf = SASI_NullSect;
 		SASI_Phase = 0;
 		SASI_Sector = 0;
 		SASI_Blocks = 0;
@@ -433,7 +659,12 @@ fclose(fp);
 			{
 				result = SASI_Flush();		// 現在のバッファを書き出す
 				SASI_Blocks--;
-				if (SASI_Blocks)		// まだ書くブロックがある？
+				if (result<0)			// 書けないイメージならライトフォールトで終わる
+				{
+					SASI_Error = 0x03;
+					SASI_Phase++;
+				}
+				else if (SASI_Blocks)		// まだ書くブロックがある？
 				{
 					SASI_Sector++;
 					SASI_BufPtr = 0;
@@ -4,6 +4,9 @@
 #include "common.h"
 
 void SASI_Init(void);
+void SASI_Cleanup(void);
+void SASI_Sync(void);
+void SASI_Eject(int drive);
 BYTE FASTCALL SASI_Read(DWORD adr);
 void FASTCALL SASI_Write(DWORD adr, BYTE data);
 int SASI_IsReady(void);
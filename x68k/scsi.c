@@ -77,6 +77,12 @@ void SCSI_Init(void)
 
     SCSI_DEBUG("Init\n");
 
+    /* HDDs cache writes; don't lose them across a reset */
+    for (i = 0; i < SCSI_MAX_DEVS; i++) {
+        if (scsi_system.int_hdd[i]) SCSI_HDD_Flush(scsi_system.int_hdd[i]);
+        if (scsi_system.ext_hdd[i]) SCSI_HDD_Flush(scsi_system.ext_hdd[i]);
+    }
+
     memset(&scsi_system, 0, sizeof(SCSI_SYSTEM));
 
     /* Initialize buses */
@@ -63,8 +63,10 @@ static void hdd_set_sense(SCSI_HDD *hdd, BYTE key, BYTE asc, BYTE ascq);
 static void hdd_clear_sense(SCSI_HDD *hdd);
 static void hdd_start_command(SCSI_HDD *hdd);
 static void hdd_execute_command(SCSI_HDD *hdd);
-static int hdd_read_sector(SCSI_HDD *hdd, DWORD lba, BYTE *buf);
-static int hdd_write_sector(SCSI_HDD *hdd, DWORD lba, const BYTE *buf);
+static int hdd_cache_init(SCSI_HDD *hdd);
+static DWORD hdd_read_sectors(SCSI_HDD *hdd, DWORD lba, DWORD count, BYTE *buf);
+static DWORD hdd_write_sectors(SCSI_HDD *hdd, DWORD lba, DWORD count, const BYTE *buf);
+static void hdd_note_read(SCSI_HDD *hdd, DWORD lba, DWORD blocks);
 
 /* Command handlers */
 static void cmd_test_unit_ready(SCSI_HDD *hdd);
@@ -82,6 +84,7 @@ static void cmd_read_capacity(SCSI_HDD *hdd);
 static void cmd_read_10(SCSI_HDD *hdd);
 static void cmd_write_10(SCSI_HDD *hdd);
 static void cmd_verify_10(SCSI_HDD *hdd);
+static void cmd_synchronize_cache(SCSI_HDD *hdd);
 
 /*
  * Calculate disk geometry from file size
@@ -170,6 +173,9 @@ void SCSI_HDD_Destroy(SCSI_HDD *hdd)
     if (hdd->data_buf) {
         free(hdd->data_buf);
     }
+    if (hdd->cache_mem) {
+        free(hdd->cache_mem);
+    }
 
     free(hdd);
     HDD_DEBUG("Destroyed\n");
@@ -189,7 +195,7 @@ int SCSI_HDD_Open(SCSI_HDD *hdd, const char *path)
     SCSI_HDD_Close(hdd);
 
     /* Open image file */
-    fp = File_Open(path);
+    fp = File_OpenImage(path);
     if (!fp) {
         HDD_DEBUG("Failed to open: %s\n", path);
         return 0;
@@ -208,11 +214,19 @@ int SCSI_HDD_Open(SCSI_HDD *hdd, const char *path)
 
     /* Store file handle and path */
     hdd->image_fp = fp;
+    hdd->read_only = File_IsReadOnly(fp);
     strncpy(hdd->image_path, path, MAX_PATH - 1);
     hdd->image_path[MAX_PATH - 1] = '\0';
 
     /* Calculate geometry */
     hdd_calc_geometry(hdd, file_size);
+    hdd->image_size = file_size;
+
+    if (!hdd_cache_init(hdd)) {
+        HDD_DEBUG("Can't allocate block cache\n");
+        SCSI_HDD_Close(hdd);
+        return 0;
+    }
 
     /* Mark as ready */
     hdd->unit_ready = 1;
@@ -233,9 +247,14 @@ void SCSI_HDD_Close(SCSI_HDD *hdd)
     if (!hdd) return;
 
     if (hdd->image_fp) {
+        /* Write back everything still in the cache */
+        SCSI_HDD_Flush(hdd);
         File_Close((FILEH)hdd->image_fp);
         hdd->image_fp = NULL;
     }
+    if (hdd->cache_mem) {
+        hdd_cache_init(hdd);
+    }
 
     hdd->image_path[0] = '\0';
     hdd->total_sectors = 0;
@@ -425,25 +444,21 @@ static int hdd_data_write(SCSI_DEVICE *dev, const BYTE *buf, int len)
     /* Copy data to buffer */
     while (count < len && hdd->data_pos < hdd->data_len) {
         hdd->data_buf[hdd->data_pos++] = buf[count++];
-
-        /* Check if we have a complete sector to write */
-        if (hdd->data_pos > 0 &&
-            (hdd->data_pos % hdd->bytes_per_sector) == 0) {
-            /* Write the sector */
-            DWORD sector_offset = (hdd->data_pos / hdd->bytes_per_sector) - 1;
-            if (!hdd_write_sector(hdd, hdd->current_lba + sector_offset,
-                    hdd->data_buf + sector_offset * hdd->bytes_per_sector)) {
-                hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
-                    SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
-                hdd->status = SCSI_STATUS_CHECK_CONDITION;
-                hdd->state = HDD_STATE_STATUS;
-                return count;
-            }
-        }
     }
 
     /* Check if data transfer is complete */
     if (hdd->data_pos >= hdd->data_len) {
+        /* Hand the whole transfer to the cache at once, so blocks that
+           are completely overwritten don't have to be read first */
+        DWORD blocks = hdd->data_len / hdd->bytes_per_sector;
+        DWORD done = hdd_write_sectors(hdd, hdd->current_lba, blocks,
+            hdd->data_buf);
+        if (done < blocks) {
+            hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
+                SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
+            hdd->sense_info = hdd->current_lba + done;
+            hdd->status = SCSI_STATUS_CHECK_CONDITION;
+        }
         hdd->state = HDD_STATE_STATUS;
         HDD_DEBUG("DATA_OUT complete, moving to STATUS\n");
     }
@@ -578,6 +593,10 @@ static void hdd_execute_command(SCSI_HDD *hdd)
         cmd_verify_10(hdd);
         break;
 
+    case SCSI_CMD_SYNCHRONIZE_CACHE:
+        cmd_synchronize_cache(hdd);
+        break;
+
     default:
         /* Unknown command */
         HDD_DEBUG("Unknown command: 0x%02X\n", opcode);
@@ -589,50 +608,279 @@ static void hdd_execute_command(SCSI_HDD *hdd)
     }
 }
 
+/* ======================================================================
+ * Block cache
+ *
+ * The image is cached in HDD_CACHE_BLOCK_SIZE blocks with LRU
+ * replacement. Misses read the block plus the rest of the request in
+ * one pass, and while READs are sequential HDD_READAHEAD_BLOCKS more.
+ * Writes only touch the cache; dirty ranges go to the image when the
+ * block is evicted, on SYNCHRONIZE CACHE and on close.
+ * ====================================================================== */
+
+/*
+ * Reset the cache (allocates the block memory on first use). A miss
+ * reads into the HDD_FILL_BLOCKS staging area after the cache blocks.
+ */
+static int hdd_cache_init(SCSI_HDD *hdd)
+{
+    int i;
+
+    if (!hdd->cache_mem) {
+        hdd->cache_mem = (BYTE*)malloc(HDD_CACHE_BLOCK_SIZE * (HDD_CACHE_BLOCKS + HDD_FILL_BLOCKS));
+        if (!hdd->cache_mem) return 0;
+    }
+
+    for (i = 0; i < HDD_CACHE_BLOCKS; i++) {
+        hdd->cache[i].block = HDD_CACHE_NONE;
+        hdd->cache[i].last_use = 0;
+        hdd->cache[i].dirty_lo = 0;
+        hdd->cache[i].dirty_hi = 0;
+        hdd->cache[i].data = hdd->cache_mem + i * HDD_CACHE_BLOCK_SIZE;
+    }
+    hdd->cache_clock = 0;
+    hdd->seq_next_lba = HDD_CACHE_NONE;
+    hdd->seq_reads = 0;
+    return 1;
+}
+
 /*
- * Read sector from image
+ * Bytes of the image covered by a block (the last one may be short)
  */
-static int hdd_read_sector(SCSI_HDD *hdd, DWORD lba, BYTE *buf)
+static DWORD hdd_block_bytes(SCSI_HDD *hdd, DWORD block)
+{
+    DWORD offset = block * HDD_CACHE_BLOCK_SIZE;
+
+    if (offset >= hdd->image_size) return 0;
+    if (hdd->image_size - offset < HDD_CACHE_BLOCK_SIZE)
+        return hdd->image_size - offset;
+    return HDD_CACHE_BLOCK_SIZE;
+}
+
+/*
+ * Write the dirty range of a block back to the image
+ */
+static int hdd_cache_writeback(SCSI_HDD *hdd, HDD_CACHE_ENTRY *e)
 {
     FILEH fp = (FILEH)hdd->image_fp;
-    DWORD offset;
+    DWORD offset, len;
 
+    if (e->dirty_lo >= e->dirty_hi) return 1;
     if (!fp) return 0;
-    if (lba >= hdd->total_sectors) return 0;
 
-    offset = lba * hdd->bytes_per_sector;
+    offset = e->block * HDD_CACHE_BLOCK_SIZE + e->dirty_lo;
+    len = e->dirty_hi - e->dirty_lo;
     if (File_Seek(fp, offset, FSEEK_SET) != offset) {
         return 0;
     }
-
-    if (File_Read(fp, buf, hdd->bytes_per_sector) != (signed)hdd->bytes_per_sector) {
+    if (File_Write(fp, e->data + e->dirty_lo, len) != len) {
         return 0;
     }
 
+    e->dirty_lo = e->dirty_hi = 0;
     return 1;
 }
 
+static HDD_CACHE_ENTRY* hdd_cache_find(SCSI_HDD *hdd, DWORD block)
+{
+    int i;
+
+    for (i = 0; i < HDD_CACHE_BLOCKS; i++) {
+        if (hdd->cache[i].block == block) return &hdd->cache[i];
+    }
+    return NULL;
+}
+
+/*
+ * Pick the least recently used block and free it
+ */
+static HDD_CACHE_ENTRY* hdd_cache_victim(SCSI_HDD *hdd)
+{
+    HDD_CACHE_ENTRY *e = &hdd->cache[0];
+    int i;
+
+    for (i = 0; i < HDD_CACHE_BLOCKS; i++) {
+        if (hdd->cache[i].block == HDD_CACHE_NONE) {
+            e = &hdd->cache[i];
+            break;
+        }
+        if (hdd->cache[i].last_use < e->last_use) e = &hdd->cache[i];
+    }
+
+    if (!hdd_cache_writeback(hdd, e)) return NULL;
+    e->block = HDD_CACHE_NONE;
+    return e;
+}
+
 /*
- * Write sector to image
+ * Read up to count consecutive blocks starting at block (stops at the
+ * first one already cached) with a single read of the image, then hand
+ * them out to cache entries. Returns the entry for block.
  */
-static int hdd_write_sector(SCSI_HDD *hdd, DWORD lba, const BYTE *buf)
+static HDD_CACHE_ENTRY* hdd_cache_fill(SCSI_HDD *hdd, DWORD block, DWORD count)
 {
     FILEH fp = (FILEH)hdd->image_fp;
-    DWORD offset;
+    BYTE *stage = hdd->cache_mem + HDD_CACHE_BLOCKS * HDD_CACHE_BLOCK_SIZE;
+    HDD_CACHE_ENTRY *e, *first = NULL;
+    DWORD i, n, offset, len;
 
-    if (!fp) return 0;
-    if (lba >= hdd->total_sectors) return 0;
+    if (!fp) return NULL;
+    if (count > HDD_FILL_BLOCKS) count = HDD_FILL_BLOCKS;
 
-    offset = lba * hdd->bytes_per_sector;
-    if (File_Seek(fp, offset, FSEEK_SET) != offset) {
-        return 0;
+    for (n = 0; n < count; n++) {
+        if (!hdd_block_bytes(hdd, block + n)) break;
+        if (n > 0 && hdd_cache_find(hdd, block + n)) break;
     }
+    if (!n) return NULL;
 
-    if (File_Write(fp, (void*)buf, hdd->bytes_per_sector) != (signed)hdd->bytes_per_sector) {
-        return 0;
+    offset = block * HDD_CACHE_BLOCK_SIZE;
+    len = (n - 1) * HDD_CACHE_BLOCK_SIZE + hdd_block_bytes(hdd, block + n - 1);
+    if (File_Seek(fp, offset, FSEEK_SET) != offset) return NULL;
+    if (File_Read(fp, stage, len) != len) return NULL;
+
+    for (i = 0; i < n; i++) {
+        e = hdd_cache_victim(hdd);
+        if (!e) break;
+
+        len = hdd_block_bytes(hdd, block + i);
+        memcpy(e->data, stage + i * HDD_CACHE_BLOCK_SIZE, len);
+        if (len < HDD_CACHE_BLOCK_SIZE)
+            memset(e->data + len, 0, HDD_CACHE_BLOCK_SIZE - len);
+
+        e->block = block + i;
+        e->last_use = ++hdd->cache_clock;
+        if (i == 0) first = e;
     }
 
-    return 1;
+    return first;
+}
+
+/*
+ * Look up a block; on a miss read it (fill != 0, with count blocks of
+ * read-ahead) or just claim an entry the caller will overwrite.
+ */
+static HDD_CACHE_ENTRY* hdd_cache_get(SCSI_HDD *hdd, DWORD block, int fill, DWORD count)
+{
+    HDD_CACHE_ENTRY *e = hdd_cache_find(hdd, block);
+
+    if (!e) {
+        if (fill) return hdd_cache_fill(hdd, block, count);
+        e = hdd_cache_victim(hdd);
+        if (!e) return NULL;
+        e->block = block;
+    }
+    e->last_use = ++hdd->cache_clock;
+    return e;
+}
+
+/*
+ * Track sequential READs for read-ahead
+ */
+static void hdd_note_read(SCSI_HDD *hdd, DWORD lba, DWORD blocks)
+{
+    if (lba == hdd->seq_next_lba)
+        hdd->seq_reads++;
+    else
+        hdd->seq_reads = 0;
+    hdd->seq_next_lba = lba + blocks;
+}
+
+/*
+ * Read sectors from the image. Returns the number of sectors read.
+ */
+static DWORD hdd_read_sectors(SCSI_HDD *hdd, DWORD lba, DWORD count, BYTE *buf)
+{
+    DWORD pos, end, block, last, ofs, n, ahead;
+    HDD_CACHE_ENTRY *e;
+
+    if (!hdd->image_fp || lba >= hdd->total_sectors) return 0;
+    if (count > hdd->total_sectors - lba) count = hdd->total_sectors - lba;
+
+    pos = lba * hdd->bytes_per_sector;
+    end = pos + count * hdd->bytes_per_sector;
+    last = (end - 1) / HDD_CACHE_BLOCK_SIZE;
+    ahead = (hdd->seq_reads > 0) ? HDD_READAHEAD_BLOCKS : 0;
+
+    while (pos < end) {
+        block = pos / HDD_CACHE_BLOCK_SIZE;
+        ofs = pos % HDD_CACHE_BLOCK_SIZE;
+        n = HDD_CACHE_BLOCK_SIZE - ofs;
+        if (n > end - pos) n = end - pos;
+
+        e = hdd_cache_get(hdd, block, 1, last - block + 1 + ahead);
+        if (!e) break;
+        memcpy(buf, e->data + ofs, n);
+        buf += n;
+        pos += n;
+    }
+
+    return count - (end - pos + hdd->bytes_per_sector - 1) / hdd->bytes_per_sector;
+}
+
+/*
+ * Write sectors into the cache. Returns the number of sectors written.
+ */
+static DWORD hdd_write_sectors(SCSI_HDD *hdd, DWORD lba, DWORD count, const BYTE *buf)
+{
+    DWORD pos, end, block, ofs, n;
+    HDD_CACHE_ENTRY *e;
+
+    if (!hdd->image_fp || lba >= hdd->total_sectors) return 0;
+    if (count > hdd->total_sectors - lba) count = hdd->total_sectors - lba;
+
+    pos = lba * hdd->bytes_per_sector;
+    end = pos + count * hdd->bytes_per_sector;
+
+    while (pos < end) {
+        block = pos / HDD_CACHE_BLOCK_SIZE;
+        ofs = pos % HDD_CACHE_BLOCK_SIZE;
+        n = HDD_CACHE_BLOCK_SIZE - ofs;
+        if (n > end - pos) n = end - pos;
+
+        /* A block overwritten as a whole needn't be read first */
+        e = hdd_cache_get(hdd, block,
+            !(ofs == 0 && n == hdd_block_bytes(hdd, block)), 1);
+        if (!e) break;
+        memcpy(e->data + ofs, buf, n);
+        if (e->dirty_lo >= e->dirty_hi) {
+            e->dirty_lo = ofs;
+            e->dirty_hi = ofs + n;
+        } else {
+            if (ofs < e->dirty_lo) e->dirty_lo = ofs;
+            if (ofs + n > e->dirty_hi) e->dirty_hi = ofs + n;
+        }
+        buf += n;
+        pos += n;
+    }
+
+    return count - (end - pos + hdd->bytes_per_sector - 1) / hdd->bytes_per_sector;
+}
+
+/*
+ * Write all dirty blocks back to the image, in block order
+ */
+int SCSI_HDD_Flush(SCSI_HDD *hdd)
+{
+    HDD_CACHE_ENTRY *e;
+    int i, ok = 1;
+
+    if (!hdd || !hdd->image_fp) return 0;
+
+    for (;;) {
+        e = NULL;
+        for (i = 0; i < HDD_CACHE_BLOCKS; i++) {
+            HDD_CACHE_ENTRY *c = &hdd->cache[i];
+            if (c->dirty_lo < c->dirty_hi && (!e || c->block < e->block)) e = c;
+        }
+        if (!e) break;
+        if (!hdd_cache_writeback(hdd, e)) {
+            /* Drop it rather than retrying forever */
+            e->dirty_lo = e->dirty_hi = 0;
+            ok = 0;
+        }
+    }
+
+    return ok;
 }
 
 /* ======================================================================
@@ -733,7 +981,7 @@ static void cmd_read_6(SCSI_HDD *hdd)
 {
     DWORD lba;
     DWORD blocks;
-    DWORD i;
+    DWORD done;
     DWORD total_bytes;
 
     lba = ((hdd->cmd_buf[1] & 0x1F) << 16) |
@@ -767,17 +1015,16 @@ static void cmd_read_6(SCSI_HDD *hdd)
         blocks = total_bytes / hdd->bytes_per_sector;
     }
 
-    /* Read all sectors into buffer */
-    for (i = 0; i < blocks; i++) {
-        if (!hdd_read_sector(hdd, lba + i,
-                hdd->data_buf + i * hdd->bytes_per_sector)) {
-            hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
-                SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
-            hdd->sense_info = lba + i;
-            hdd->status = SCSI_STATUS_CHECK_CONDITION;
-            hdd->state = HDD_STATE_STATUS;
-            return;
-        }
+    /* Read all sectors into buffer (through the block cache) */
+    hdd_note_read(hdd, lba, blocks);
+    done = hdd_read_sectors(hdd, lba, blocks, hdd->data_buf);
+    if (done < blocks) {
+        hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
+            SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
+        hdd->sense_info = lba + done;
+        hdd->status = SCSI_STATUS_CHECK_CONDITION;
+        hdd->state = HDD_STATE_STATUS;
+        return;
     }
 
     hdd->data_len = total_bytes;
@@ -812,6 +1059,14 @@ static void cmd_write_6(SCSI_HDD *hdd)
         return;
     }
 
+    if (hdd->read_only) {
+        hdd_set_sense(hdd, SCSI_SENSE_DATA_PROTECT,
+            SCSI_ASC_WRITE_PROTECTED, 0);
+        hdd->status = SCSI_STATUS_CHECK_CONDITION;
+        hdd->state = HDD_STATE_STATUS;
+        return;
+    }
+
     if (lba + blocks > hdd->total_sectors) {
         hdd_set_sense(hdd, SCSI_SENSE_ILLEGAL_REQUEST,
             SCSI_ASC_LBA_OUT_OF_RANGE, 0);
@@ -945,7 +1200,7 @@ static void cmd_mode_sense_6(SCSI_HDD *hdd)
     pos = 0;
     hdd->data_buf[pos++] = 0;     /* Mode data length (filled later) */
     hdd->data_buf[pos++] = 0x00;  /* Medium type */
-    hdd->data_buf[pos++] = 0x00;  /* Device-specific parameter */
+    hdd->data_buf[pos++] = hdd->read_only ? 0x80 : 0x00;  /* Device-specific parameter (WP) */
     hdd->data_buf[pos++] = 8;     /* Block descriptor length */
 
     /* Block descriptor */
@@ -1106,7 +1361,7 @@ static void cmd_read_10(SCSI_HDD *hdd)
 {
     DWORD lba;
     DWORD blocks;
-    DWORD i;
+    DWORD done;
     DWORD total_bytes;
 
     lba = (hdd->cmd_buf[2] << 24) |
@@ -1146,17 +1401,16 @@ static void cmd_read_10(SCSI_HDD *hdd)
         blocks = total_bytes / hdd->bytes_per_sector;
     }
 
-    /* Read sectors into buffer */
-    for (i = 0; i < blocks; i++) {
-        if (!hdd_read_sector(hdd, lba + i,
-                hdd->data_buf + i * hdd->bytes_per_sector)) {
-            hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
-                SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
-            hdd->sense_info = lba + i;
-            hdd->status = SCSI_STATUS_CHECK_CONDITION;
-            hdd->state = HDD_STATE_STATUS;
-            return;
-        }
+    /* Read all sectors into buffer (through the block cache) */
+    hdd_note_read(hdd, lba, blocks);
+    done = hdd_read_sectors(hdd, lba, blocks, hdd->data_buf);
+    if (done < blocks) {
+        hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
+            SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
+        hdd->sense_info = lba + done;
+        hdd->status = SCSI_STATUS_CHECK_CONDITION;
+        hdd->state = HDD_STATE_STATUS;
+        return;
     }
 
     hdd->data_len = total_bytes;
@@ -1191,6 +1445,14 @@ static void cmd_write_10(SCSI_HDD *hdd)
         return;
     }
 
+    if (hdd->read_only) {
+        hdd_set_sense(hdd, SCSI_SENSE_DATA_PROTECT,
+            SCSI_ASC_WRITE_PROTECTED, 0);
+        hdd->status = SCSI_STATUS_CHECK_CONDITION;
+        hdd->state = HDD_STATE_STATUS;
+        return;
+    }
+
     if (blocks == 0) {
         /* Zero blocks - just return success */
         hdd->state = HDD_STATE_STATUS;
@@ -1254,3 +1516,27 @@ static void cmd_verify_10(SCSI_HDD *hdd)
     /* Without BytChk, just return success */
     hdd->state = HDD_STATE_STATUS;
 }
+
+/*
+ * SYNCHRONIZE CACHE (0x35)
+ */
+static void cmd_synchronize_cache(SCSI_HDD *hdd)
+{
+    HDD_DEBUG("SYNCHRONIZE CACHE\n");
+
+    if (!hdd->unit_ready) {
+        hdd_set_sense(hdd, SCSI_SENSE_NOT_READY,
+            SCSI_ASC_MEDIUM_NOT_PRESENT, 0);
+        hdd->status = SCSI_STATUS_CHECK_CONDITION;
+        hdd->state = HDD_STATE_STATUS;
+        return;
+    }
+
+    if (!SCSI_HDD_Flush(hdd)) {
+        hdd_set_sense(hdd, SCSI_SENSE_MEDIUM_ERROR,
+            SCSI_ASC_NO_ADDITIONAL_SENSE, 0);
+        hdd->status = SCSI_STATUS_CHECK_CONDITION;
+    }
+
+    hdd->state = HDD_STATE_STATUS;
+}
@@ -32,6 +32,7 @@
 #define SCSI_CMD_WRITE_10         0x2A
 #define SCSI_CMD_SEEK_10          0x2B
 #define SCSI_CMD_VERIFY_10        0x2F
+#define SCSI_CMD_SYNCHRONIZE_CACHE 0x35
 #define SCSI_CMD_READ_BUFFER      0x3C
 #define SCSI_CMD_WRITE_BUFFER     0x3B
 
@@ -63,6 +64,7 @@
 #define SCSI_ASC_LBA_OUT_OF_RANGE     0x21
 #define SCSI_ASC_INVALID_FIELD_IN_CDB 0x24
 #define SCSI_ASC_LUN_NOT_SUPPORTED    0x25
+#define SCSI_ASC_WRITE_PROTECTED      0x27
 #define SCSI_ASC_MEDIUM_NOT_PRESENT   0x3A
 
 /* HDD Device States */
@@ -82,6 +84,21 @@ typedef enum {
 /* Command buffer size */
 #define HDD_CMD_BUFFER_SIZE  16
 
+/* Block cache: LRU of fixed-size image blocks, write-back */
+#define HDD_CACHE_BLOCK_SIZE   32768
+#define HDD_CACHE_BLOCKS       64     /* 2MB per drive */
+#define HDD_READAHEAD_BLOCKS   4      /* blocks fetched per miss while streaming */
+#define HDD_FILL_BLOCKS        (HDD_CACHE_BLOCKS / 2)  /* most blocks read by one miss */
+#define HDD_CACHE_NONE         0xFFFFFFFF
+
+typedef struct {
+    DWORD block;       /* image block number, HDD_CACHE_NONE if unused */
+    DWORD last_use;    /* LRU stamp */
+    DWORD dirty_lo;    /* dirty byte range in the block (lo < hi if dirty) */
+    DWORD dirty_hi;
+    BYTE *data;
+} HDD_CACHE_ENTRY;
+
 /* SCSI HDD Structure */
 typedef struct _SCSI_HDD {
     SCSI_DEVICE base;  /* Base SCSI device (inherited) */
@@ -89,6 +106,7 @@ typedef struct _SCSI_HDD {
     /* Image file */
     char image_path[MAX_PATH];
     void *image_fp;    /* FILEH handle */
+    int read_only;     /* image can't be written (packed, no overlay) */
 
     /* Disk geometry */
     DWORD total_sectors;
@@ -130,6 +148,14 @@ typedef struct _SCSI_HDD {
     int unit_ready;
     int media_changed;
 
+    /* Block cache */
+    HDD_CACHE_ENTRY cache[HDD_CACHE_BLOCKS];
+    BYTE *cache_mem;
+    DWORD cache_clock;
+    DWORD image_size;      /* bytes */
+    DWORD seq_next_lba;    /* LBA following the last READ */
+    int seq_reads;         /* consecutive sequential READs */
+
 } SCSI_HDD;
 
 /* Initialization and Cleanup */
@@ -140,6 +166,7 @@ void SCSI_HDD_Destroy(SCSI_HDD *hdd);
 int SCSI_HDD_Open(SCSI_HDD *hdd, const char *path);
 void SCSI_HDD_Close(SCSI_HDD *hdd);
 int SCSI_HDD_IsOpened(SCSI_HDD *hdd);
+int SCSI_HDD_Flush(SCSI_HDD *hdd);
 
 /* Bus connection */
 void SCSI_HDD_AttachToBus(SCSI_HDD *hdd, SCSI_BUS *bus, int id);
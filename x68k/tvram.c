@@ -10,6 +10,7 @@
 #include	"crtc.h"
 #include	"palette.h"
 #include	"m68000.h"
+#include	"memory.h"
 #include	"tvram.h"
 
 	BYTE	TVRAM[0x80000];
@@ -105,41 +106,10 @@ INLINE void TVRAM_WriteByteMask(DWORD adr, BYTE data)
 
 
 // -----------------------------------------------------------------------
-//   書くなり
+//   書いた位置の展開済みパターンを更新
 // -----------------------------------------------------------------------
-void FASTCALL TVRAM_Write(DWORD adr, BYTE data)
+INLINE void TVRAM_UpdateWork(DWORD adr)
 {
-	adr &= 0x7ffff;
-	adr ^= 1;
-	if (CRTC_Regs[0x2a]&1)			// 同時アクセス
-	{
-		adr &= 0x1ffff;
-		if (CRTC_Regs[0x2a]&2)		// Text Mask
-		{
-			if (CRTC_Regs[0x2b]&0x10) TVRAM_WriteByteMask(adr        , data);
-			if (CRTC_Regs[0x2b]&0x20) TVRAM_WriteByteMask(adr+0x20000, data);
-			if (CRTC_Regs[0x2b]&0x40) TVRAM_WriteByteMask(adr+0x40000, data);
-			if (CRTC_Regs[0x2b]&0x80) TVRAM_WriteByteMask(adr+0x60000, data);
-		}
-		else
-		{
-			if (CRTC_Regs[0x2b]&0x10) TVRAM_WriteByte(adr        , data);
-			if (CRTC_Regs[0x2b]&0x20) TVRAM_WriteByte(adr+0x20000, data);
-			if (CRTC_Regs[0x2b]&0x40) TVRAM_WriteByte(adr+0x40000, data);
-			if (CRTC_Regs[0x2b]&0x80) TVRAM_WriteByte(adr+0x60000, data);
-		}
-	}
-	else					// シングルアクセス
-	{
-		if (CRTC_Regs[0x2a]&2)		// Text Mask
-		{
-			TVRAM_WriteByteMask(adr, data);
-		}
-		else
-		{
-			TVRAM_WriteByte(adr, data);
-		}
-	}
 #ifdef USE_ASM
 	_asm {
 		push	edi
@@ -239,6 +209,88 @@ void FASTCALL TVRAM_Write(DWORD adr, BYTE data)
 }
 
 
+// -----------------------------------------------------------------------
+//   書くなり
+// -----------------------------------------------------------------------
+// R21 (CRTC_Regs[0x2a]) の同時アクセス／マスク指定ごとに専用ルーチンを用意し、
+// TVRAM_SetAccessMode() でメモリマップに登録する
+
+static void FASTCALL TVRAM_WriteSingle(DWORD adr, BYTE data)	// シングルアクセス
+{
+	adr &= 0x7ffff;
+	adr ^= 1;
+	TVRAM_WriteByte(adr, data);
+	TVRAM_UpdateWork(adr);
+}
+
+static void FASTCALL TVRAM_WriteSingleMask(DWORD adr, BYTE data)	// シングルアクセス＋マスク
+{
+	adr &= 0x7ffff;
+	adr ^= 1;
+	TVRAM_WriteByteMask(adr, data);
+	TVRAM_UpdateWork(adr);
+}
+
+static void FASTCALL TVRAM_WriteMulti(DWORD adr, BYTE data)	// 同時アクセス
+{
+	BYTE planes = CRTC_Regs[0x2b];
+
+	adr &= 0x1ffff;
+	adr ^= 1;
+	if (planes&0x10) TVRAM_WriteByte(adr        , data);
+	if (planes&0x20) TVRAM_WriteByte(adr+0x20000, data);
+	if (planes&0x40) TVRAM_WriteByte(adr+0x40000, data);
+	if (planes&0x80) TVRAM_WriteByte(adr+0x60000, data);
+	TVRAM_UpdateWork(adr);
+}
+
+static void FASTCALL TVRAM_WriteMultiMask(DWORD adr, BYTE data)	// 同時アクセス＋マスク
+{
+	BYTE planes = CRTC_Regs[0x2b];
+
+	adr &= 0x1ffff;
+	adr ^= 1;
+	if (planes&0x10) TVRAM_WriteByteMask(adr        , data);
+	if (planes&0x20) TVRAM_WriteByteMask(adr+0x20000, data);
+	if (planes&0x40) TVRAM_WriteByteMask(adr+0x40000, data);
+	if (planes&0x80) TVRAM_WriteByteMask(adr+0x60000, data);
+	TVRAM_UpdateWork(adr);
+}
+
+void FASTCALL TVRAM_Write(DWORD adr, BYTE data)
+{
+	if (CRTC_Regs[0x2a]&1)			// 同時アクセス
+	{
+		if (CRTC_Regs[0x2a]&2)		// Text Mask
+			TVRAM_WriteMultiMask(adr, data);
+		else
+			TVRAM_WriteMulti(adr, data);
+	}
+	else					// シングルアクセス
+	{
+		if (CRTC_Regs[0x2a]&2)		// Text Mask
+			TVRAM_WriteSingleMask(adr, data);
+		else
+			TVRAM_WriteSingle(adr, data);
+	}
+}
+
+
+// -----------------------------------------------------------------------
+//   R21 変更時の書き込みルーチン切り替え
+// -----------------------------------------------------------------------
+void TVRAM_SetAccessMode(void)
+{
+	switch (CRTC_Regs[0x2a]&3)
+	{
+	case 0: Memory_SetTVRAMHandler(TVRAM_WriteSingle); break;
+	case 1: Memory_SetTVRAMHandler(TVRAM_WriteMulti); break;
+	case 2: Memory_SetTVRAMHandler(TVRAM_WriteSingleMask); break;
+	case 3: Memory_SetTVRAMHandler(TVRAM_WriteMultiMask); break;
+	}
+}
+
+
 // -----------------------------------------------------------------------
 //   らすたこぴー時のあっぷでーと
 // -----------------------------------------------------------------------
@@ -16,6 +16,7 @@ void TVRAM_Cleanup(void);
 
 BYTE FASTCALL TVRAM_Read(DWORD adr);
 void FASTCALL TVRAM_Write(DWORD adr, BYTE data);
+void TVRAM_SetAccessMode(void);
 void FASTCALL TVRAM_RCUpdate(void);
 void FASTCALL Text_DrawLine(int opaq);
 